@@ -25,6 +25,8 @@
 
 #include "base.h"
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace lajkonik {
 
@@ -40,6 +42,20 @@ const unsigned char kMultiplyDeBruijnBitPosition[32] = {
   31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
 };
 
+int GetPhysicalMemoryInMegabytes() {
+  const long long pages = sysconf(_SC_PHYS_PAGES);
+  const long long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0)
+    return 0;
+  return pages * page_size >> 20;
+}
+
+long long GetMonotonicMilliseconds() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
 std::string StringVPrintf(const char* format, va_list ap) {
   const int kBufferSize = 1024;
   char buffer[kBufferSize];
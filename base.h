@@ -41,6 +41,13 @@ static const unsigned kAndTo6Neighbors = 0x3330;
 // Causes a compile-time error if condition is false.
 #define STATIC_ASSERT(name, condition) typedef int name[1 / (condition)]
 
+// Returns the size of physical memory in megabytes.
+int GetPhysicalMemoryInMegabytes();
+
+// Returns the number of milliseconds elapsed since some fixed point
+// in the past. Unlike the wall clock, never goes back.
+long long GetMonotonicMilliseconds();
+
 // Modifications of sprintf() and vprintf() that return a string.
 std::string StringPrintf(const char* format, ...);
 std::string StringVPrintf(const char* format, va_list ap);
@@ -0,0 +1,79 @@
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// The main module for measuring the speed of selection in the game tree
+// and of playouts.
+// Usage: benchmark-N [num_kids [num_rounds [num_playouts]]]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "define-playout-patterns.h"
+#include "mcts.h"
+#include "options.h"
+#include "patterns.h"
+#include "playout.h"
+
+int main(int argc, char* argv[]) {
+  int num_kids = lajkonik::kNumMovesOnBoard;
+  int num_rounds = 200000;
+  int num_playouts = 10000;
+  if (argc > 1)
+    num_kids = atoi(argv[1]);
+  if (argc > 2)
+    num_rounds = atoi(argv[2]);
+  if (argc > 3)
+    num_playouts = atoi(argv[3]);
+  if (argc > 4 || num_kids <= 0 || num_rounds <= 0 || num_playouts <= 0) {
+    fprintf(stderr, "Usage: %s [num_kids [num_rounds [num_playouts]]]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  lajkonik::MctsOptions mcts_options;
+  mcts_options.exploration_factor = 0.2;
+  mcts_options.rave_bias = 1e-4;
+  mcts_options.first_play_urgency = 1e3;
+
+  printf("%d kids, %d rounds\n", num_kids, num_rounds);
+  lajkonik::BenchmarkExplorationStrategies(
+      mcts_options, num_kids, num_rounds);
+
+  lajkonik::PlayoutOptions playout_options;
+  playout_options.initial_chance_of_ring_notice = 150.0;
+  playout_options.final_chance_of_ring_notice = -350.0;
+  playout_options.chance_of_forced_connection_intercept = 34.0;
+  playout_options.chance_of_forced_connection_slope = -30.0;
+  playout_options.chance_of_connection_defense_intercept = 42.0;
+  playout_options.chance_of_connection_defense_slope = -28.0;
+  playout_options.retries_of_isolated_moves = 1;
+  playout_options.moves_before_filling_board = -1;
+  playout_options.use_havannah_mate = true;
+  playout_options.use_havannah_antimate = true;
+  playout_options.use_ring_detection = true;
+  lajkonik::Patterns patterns(lajkonik::kPlayoutPatterns);
+
+  printf("\n%d playouts\n", num_playouts);
+  lajkonik::BenchmarkPlayouts(playout_options, &patterns, num_playouts);
+  return EXIT_SUCCESS;
+}
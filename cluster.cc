@@ -0,0 +1,247 @@
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// The definition of the RemoteEngine class.
+
+#include "cluster.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "base.h"
+
+namespace lajkonik {
+namespace {
+
+// How long past the thinking time a remote engine may take to answer.
+const int kAnswerTimeoutMarginMs = 1000;
+
+// No sane answer has longer lines.
+const int kMaxLineLength = 1024;
+
+}  // namespace
+
+int AcceptCoordinator(int port) {
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    perror("socket");
+    return -1;
+  }
+  const int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address),
+           sizeof address) != 0 ||
+      listen(listener, 1) != 0) {
+    perror("bind");
+    close(listener);
+    return -1;
+  }
+  fprintf(stderr, "Waiting for a coordinator on port %d\n", port);
+  const int connection = accept(listener, NULL, NULL);
+  if (connection < 0)
+    perror("accept");
+  close(listener);
+  return connection;
+}
+
+RemoteEngine::RemoteEngine()
+    : socket_(-1),
+      deadline_ms_(0),
+      num_pending_answers_(0) {}
+
+RemoteEngine::~RemoteEngine() {
+  if (socket_ >= 0) {
+    Send("quit\n");
+    close(socket_);
+  }
+}
+
+bool RemoteEngine::Connect(
+    const std::string& host, int port, std::string* error) {
+  name_ = StringPrintf("%s:%d", host.c_str(), port);
+  addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses;
+  const std::string service = StringPrintf("%d", port);
+  const int status =
+      getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+  if (status != 0) {
+    *error = gai_strerror(status);
+    return false;
+  }
+  for (addrinfo* a = addresses; a != NULL; a = a->ai_next) {
+    socket_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (socket_ < 0)
+      continue;
+    if (connect(socket_, a->ai_addr, a->ai_addrlen) == 0)
+      break;
+    close(socket_);
+    socket_ = -1;
+  }
+  freeaddrinfo(addresses);
+  if (socket_ < 0) {
+    *error = "cannot connect to " + name_;
+    return false;
+  }
+  return true;
+}
+
+bool RemoteEngine::StartSearch(
+    const Position& position, Player player, int thinking_time_ms) {
+  // The stones are sent with their current colors, which takes care
+  // of a swap. Cells are sent as strings, because move indices are
+  // permuted differently in every process.
+  std::string commands = "clear_board\n";
+  for (int i = position.MoveCount() - 1; i >= 0; --i) {
+    const Cell cell = position.MoveNPliesAgo(i);
+    const int color = (position.GetCell(cell) & 3) - 1;
+    commands += StringPrintf("play %c %s\n",
+                             "wb"[color], ToString(cell).c_str());
+  }
+  commands += StringPrintf("root_moves %c %.3f\n", "wb"[player],
+                           thinking_time_ms / 1000.0f);
+  num_pending_answers_ = position.MoveCount() + 1;
+  // A hung remote engine must not hold up the move past the clock,
+  // however many answers it trickles in until then.
+  deadline_ms_ = GetMonotonicMilliseconds() +
+      thinking_time_ms + kAnswerTimeoutMarginMs;
+  return Send(commands);
+}
+
+bool RemoteEngine::GetRootMoves(std::vector<MoveInfo>* moves) {
+  std::vector<std::string> lines;
+  for (/**/; num_pending_answers_ > 0; --num_pending_answers_) {
+    if (!ReadAnswer(&lines))
+      return false;
+  }
+  lines.clear();
+  if (!ReadAnswer(&lines))
+    return false;
+  std::vector<MoveInfo> remote_moves;
+  for (int i = 0, size = lines.size(); i < size; ++i) {
+    char cell_string[16];
+    MoveInfo move;
+    if (sscanf(lines[i].c_str(), "%15s %d %f", cell_string,
+               &move.num_simulations, &move.win_ratio) != 3)
+      continue;
+    const Cell cell = FromString(cell_string);
+    if (cell == kZerothCell)
+      return false;
+    // Lightly explored moves can come with skewed statistics, which
+    // would only bias the merge. Forced defeats and draws come as large
+    // negative numbers. The comparisons also reject NaN.
+    if ((move.num_simulations <= 0 &&
+         !ResultIsForced(move.num_simulations)) ||
+        !(move.win_ratio >= 0.0f && move.win_ratio <= 1.0f))
+      continue;
+    move.move = Position::CellToMoveIndex(cell);
+    remote_moves.push_back(move);
+  }
+  moves->insert(moves->end(), remote_moves.begin(), remote_moves.end());
+  return true;
+}
+
+bool RemoteEngine::Send(const std::string& commands) {
+  const char* data = commands.data();
+  int size = commands.size();
+  while (size > 0) {
+    // MSG_NOSIGNAL keeps a dead remote engine from killing us by SIGPIPE.
+    const int sent = send(socket_, data, size, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool RemoteEngine::ReadLine(std::string* line) {
+  for (;;) {
+    const std::string::size_type end = unread_input_.find('\n');
+    if (end != std::string::npos) {
+      line->assign(unread_input_, 0, unread_input_.find_first_of("\r\n"));
+      unread_input_.erase(0, end + 1);
+      return true;
+    }
+    if (static_cast<int>(unread_input_.size()) > kMaxLineLength)
+      return false;
+    // Every wait gets only what is left of the time for the whole
+    // exchange, so a slow engine cannot stretch it read by read.
+    const long long remaining_ms = deadline_ms_ - GetMonotonicMilliseconds();
+    if (remaining_ms <= 0)
+      return false;
+    pollfd readable;
+    readable.fd = socket_;
+    readable.events = POLLIN;
+    readable.revents = 0;
+    const int status = poll(&readable, 1, static_cast<int>(remaining_ms));
+    if (status < 0 && errno == EINTR)
+      continue;
+    if (status <= 0)
+      return false;
+    char buffer[256];
+    const int received = recv(socket_, buffer, sizeof buffer, 0);
+    if (received <= 0)
+      return false;
+    unread_input_.append(buffer, received);
+  }
+}
+
+bool RemoteEngine::ReadAnswer(std::vector<std::string>* lines) {
+  std::string line;
+  bool is_first_line = true;
+  bool succeeded = false;
+  while (ReadLine(&line)) {
+    if (is_first_line) {
+      if (line.empty())
+        continue;
+      succeeded = (line[0] == '=');
+      const std::string::size_type space = line.find(' ');
+      if (space != std::string::npos && space + 1 < line.size())
+        lines->push_back(line.substr(space + 1));
+      is_first_line = false;
+    } else if (line.empty()) {
+      return succeeded;
+    } else {
+      lines->push_back(line);
+    }
+  }
+  return false;
+}
+
+}  // namespace lajkonik
@@ -0,0 +1,91 @@
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Root-parallel search by several processes. A coordinator sends
+// the position to remote engines, which search it with their own trees
+// and report the statistics of all moves from the root.
+
+#include <string>
+#include <vector>
+
+#include "havannah.h"
+#include "mcts.h"
+
+namespace lajkonik {
+
+// Waits for a coordinator to connect to the given TCP port and returns
+// the socket of the connection, or -1 on error.
+int AcceptCoordinator(int port);
+
+// A connection to a lajkonik process started with --listen. Speaks
+// to it in GTP, so the answers of every command must be read in order.
+class RemoteEngine {
+ public:
+  RemoteEngine();
+  ~RemoteEngine();
+
+  // Connects to host:port. On failure, returns false and sets *error.
+  bool Connect(const std::string& host, int port, std::string* error);
+  // Sets up the position on the remote board and makes the remote
+  // engine search it for player's move for thinking_time_ms
+  // milliseconds. Does not wait for the search to end, but sets
+  // the deadline for all the answers read by GetRootMoves().
+  bool StartSearch(const Position& position, Player player,
+                   int thinking_time_ms);
+  // Waits for the search started by StartSearch() and appends
+  // the statistics of the moves from the root to moves, skipping
+  // the moves without simulations or with win ratios outside [0, 1].
+  // Returns false and appends nothing if the remote engine fails
+  // or does not answer before the deadline.
+  bool GetRootMoves(std::vector<MoveInfo>* moves);
+  // Returns host:port.
+  const std::string& name() const { return name_; }
+
+ private:
+  bool Send(const std::string& commands);
+  // Reads a line without the line terminator. Returns false on failure
+  // or if the line is not complete before deadline_ms_.
+  bool ReadLine(std::string* line);
+  // Reads an answer and appends its lines without the status
+  // indicator to lines. Returns false on failure or error.
+  bool ReadAnswer(std::vector<std::string>* lines);
+
+  int socket_;
+  // The bytes received past the last line read.
+  std::string unread_input_;
+  // The monotonic time by which GetRootMoves() must be done.
+  long long deadline_ms_;
+  // The answers to commands sent by StartSearch() before rootmoves.
+  int num_pending_answers_;
+  std::string name_;
+
+  RemoteEngine(const RemoteEngine&);
+  void operator=(const RemoteEngine&);
+};
+
+}  // namespace lajkonik
+
+#endif  // CLUSTER_H_
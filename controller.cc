@@ -26,17 +26,28 @@
 #include "controller.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <algorithm>
 
+#include "cluster.h"
 #include "mcts.h"
-#include "wfhashmap.h"
 
 namespace lajkonik {
 
 static const char kLogFileName[] = "lajkonik.log";
+// How often SuggestMove() checks whether to end the search.
+static const int kPollingIntervalMs = 10;
+// Do not plan for fewer moves to the end of the game than this.
+static const int kMinMovesToGo = 10;
+// Never think shorter than this, even if the clock is nearly out.
+static const int kMinThinkingTimeMs = 10;
+// Measure the speed of the search at least this long before trusting it.
+static const int kMinSpeedMeasurementMs = 100;
 
 Controller::Controller(const ControllerOptions& options,
                        const std::vector<MctsEngine*>& engines)
@@ -48,48 +59,197 @@ Controller::Controller(const ControllerOptions& options,
     evaluation_(0.0f),
     highest_win_ratio_(0.0f) {
   assert(!engines.empty());
-  threads_.resize(engines.size());
+  tree_storage_ = new TreeStorage(engines[0]->mcts_options()->tt_size_mb);
+  pipeline_ = new PlayoutPipeline(engines.size());
+  endgame_solver_ = new EndgameSolver(engines[0]->mcts_options());
+  endgame_solver_->set_tree_storage(tree_storage_);
+  for (int i = 0, size = engines.size(); i < size; ++i) {
+    engines[i]->set_tree_storage(tree_storage_);
+  }
   current_position_.InitToStartPosition();
-  if (pthread_mutex_init(&thread_num_mutex_, NULL) != 0) {
+  if (pthread_mutex_init(&pool_mutex_, NULL) != 0) {
     fprintf(stderr, "Cannot create a mutex\n");
     exit(EXIT_FAILURE);
   }
+  // SuggestMove() waits for search_finished_ until a deadline
+  // on the monotonic clock.
+  pthread_condattr_t monotonic_clock;
+  if (pthread_condattr_init(&monotonic_clock) != 0 ||
+      pthread_condattr_setclock(&monotonic_clock, CLOCK_MONOTONIC) != 0 ||
+      pthread_cond_init(&search_started_, NULL) != 0 ||
+      pthread_cond_init(&search_finished_, &monotonic_clock) != 0) {
+    fprintf(stderr, "Cannot create a condition variable\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_condattr_destroy(&monotonic_clock);
+  thread_num_ = 0;
+  search_number_ = 0;
+  num_active_workers_ = 0;
+  num_searching_workers_ = 0;
+  num_selecting_workers_ = 0;
+  solver_is_searching_ = false;
+  shutting_down_ = false;
+  is_pondering_ = false;
+  SetTimeSettings(0, 0, 0);
+  threads_.resize(engines.size());
+  for (int i = 0, size = threads_.size(); i < size; ++i) {
+    if (pthread_create(&threads_[i], NULL,
+                       Controller::RunWorkerForPthreads, this) != 0) {
+      fprintf(stderr, "Cannot start background thread no. %d.\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (pthread_create(&solver_thread_, NULL,
+                     Controller::RunSolverForPthreads, this) != 0) {
+    fprintf(stderr, "Cannot start the solver thread.\n");
+    exit(EXIT_FAILURE);
+  }
 }
 
 Controller::~Controller() {
-  pthread_mutex_destroy(&thread_num_mutex_);
+  StopPondering();
+  pthread_mutex_lock(&pool_mutex_);
+  shutting_down_ = true;
+  pthread_cond_broadcast(&search_started_);
+  pthread_mutex_unlock(&pool_mutex_);
+  void* ignored;
+  for (int i = 0, size = threads_.size(); i < size; ++i) {
+    if (pthread_join(threads_[i], &ignored) != 0) {
+      fprintf(stderr, "Cannot join background thread no %d.\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (pthread_join(solver_thread_, &ignored) != 0) {
+    fprintf(stderr, "Cannot join the solver thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_cond_destroy(&search_finished_);
+  pthread_cond_destroy(&search_started_);
+  pthread_mutex_destroy(&pool_mutex_);
+  for (int i = 0, size = remote_engines_.size(); i < size; ++i) {
+    delete remote_engines_[i];
+  }
+  delete endgame_solver_;
+  delete pipeline_;
+  delete tree_storage_;
 }
 
 void Controller::ClearTranspositionTable() {
+  StopPondering();
   engines_[0]->ClearTranspositionTable();
 }
 
-std::string Controller::SuggestMove(Player pl, int thinking_time) {
+void Controller::PrepareTranspositionTable() {
+  StopPondering();
+  if (!options_.reuse_search_tree ||
+      engines_[0]->TranspositionTableNeedsClearing()) {
+    engines_[0]->ClearTranspositionTable();
+  }
+}
+
+std::string Controller::SuggestMove(Player pl, int thinking_time_ms) {
+  StopPondering();
   if (options_.use_swap && !has_swapped_ &&
       current_position_.MoveCount() == 1)
     return "swap";
-  terminate_ = false;
-  player_ = pl;
-  fprintf(stderr, "Creating thread");
-  thread_num_ = 0;
-  for (int i = 0, size = threads_.size(); i < size; ++i) {
-    assert(engines_[i] != NULL);
-    engines_[i]->mark_as_not_running();
-    if (pthread_create(&threads_[i], NULL,
-                       Controller::StartEngineForPthreads, this) != 0) {
-      fprintf(stderr, "Cannot start background thread no. %d.\n", i);
-      exit(EXIT_FAILURE);
+  if (thinking_time_ms <= 0)
+    thinking_time_ms = AllocateTime(pl);
+  const long long start_ms = GetMonotonicMilliseconds();
+  for (int i = 0; i < static_cast<int>(remote_engines_.size()); /**/) {
+    if (remote_engines_[i]->StartSearch(current_position_, pl,
+                                        thinking_time_ms)) {
+      ++i;
+    } else {
+      DropRemoteEngine(i);
+    }
+  }
+  Search(pl, thinking_time_ms);
+  MoveInfo move_1;
+  MoveInfo move_2;
+  // The workers went on searching since the last poll.
+  engines_[0]->GetTwoBestMoves(&move_1, &move_2);
+  if (!remote_engines_.empty())
+    MergeRootMoves(&move_1);
+  UpdateClock(pl, GetMonotonicMilliseconds() - start_ms);
+  evaluation_ = move_1.win_ratio;
+  if (move_1.win_ratio > highest_win_ratio_) {
+    highest_win_ratio_ = move_1.win_ratio;
+    highest_win_move_ = current_position_.MoveCount();
+  }
+  if (ResultIsForced(move_1.num_simulations)) {
+    forced_result_ = move_1.num_simulations;
+  }
+  if (move_1.move == kInvalidMove)
+    return "pass";
+  else
+    return ToString(current_position_.MoveIndexToCell(move_1.move));
+}
+
+void Controller::SearchRootMoves(
+    Player pl, int thinking_time_ms, std::vector<MoveInfo>* moves) {
+  StopPondering();
+  if (thinking_time_ms <= 0)
+    thinking_time_ms = AllocateTime(pl);
+  Search(pl, thinking_time_ms);
+  moves->clear();
+  engines_[0]->GetRootMoves(moves);
+}
+
+bool Controller::AddRemoteEngine(
+    const std::string& host, int port, std::string* error) {
+  RemoteEngine* remote_engine = new RemoteEngine;
+  if (!remote_engine->Connect(host, port, error)) {
+    delete remote_engine;
+    return false;
+  }
+  remote_engines_.push_back(remote_engine);
+  return true;
+}
+
+void Controller::Search(Player pl, int thinking_time_ms) {
+  budget_.max_playouts = std::max(options_.playout_budget, 0);
+  budget_.max_nodes = std::max(options_.node_budget, 0);
+  budget_.num_playouts = 0;
+  budget_.initial_expansion_count = engines_[0]->expansion_count();
+  // A search with a budget ends only by itself, so that it can be
+  // repeated regardless of the load of the machine.
+  const bool has_budget = (budget_.max_playouts > 0 || budget_.max_nodes > 0);
+  if (options_.random_seed != 0) {
+    for (int i = 0, size = engines_.size(); i < size; ++i) {
+      engines_[i]->set_random_seed(options_.random_seed + i);
     }
   }
+  const int initial_expansion_failure_count =
+      engines_[0]->expansion_failure_count();
+  StartSearch(pl);
   MoveInfo move_1;
   MoveInfo move_2;
-  if (thinking_time == 0)
-    thinking_time = options_.seconds_per_move;
-  for (int sec = 1; sec <= thinking_time; ++sec) {
-    sleep(1);
-    if (options_.print_debug_info)
+  const long long start_ms = GetMonotonicMilliseconds();
+  const long long deadline_ms =
+      start_ms + (has_budget ? INT_MAX : thinking_time_ms);
+  int sec = 0;
+  // The root simulations and the time when they were first counted.
+  int first_num_simulations = -1;
+  long long first_ms = 0;
+  while (true) {
+    const long long now_ms = GetMonotonicMilliseconds();
+    if (now_ms >= deadline_ms)
+      break;
+    // Engines end their search by themselves when the root is solved
+    // or the budget is used up.
+    if (WaitForWorker(std::min(deadline_ms, now_ms + kPollingIntervalMs)))
+      break;
+    const int elapsed_ms = GetMonotonicMilliseconds() - start_ms;
+    if (options_.print_debug_info && elapsed_ms >= 1000 * (sec + 1)) {
+      sec = elapsed_ms / 1000;
       engines_[0]->PrintDebugInfo(sec);
-    if (!engines_[0]->is_running())
+    }
+    // The tree can only be pruned while nobody walks it.
+    if (engines_[0]->TranspositionTableNeedsPruning()) {
+      StopSearch();
+      StartSearch(pl);
+    }
+    if (has_budget || !engines_[0]->is_running())
       continue;
     engines_[0]->GetTwoBestMoves(&move_1, &move_2);
     if (move_1.move == kInvalidMove)
@@ -99,30 +259,154 @@ std::string Controller::SuggestMove(Player pl, int thinking_time) {
          move_1.win_ratio > options_.sole_nonlosing_move_win_ratio_threshold))
       break;
     if (options_.use_human_like_time_control &&
-        (move_1.num_simulations * move_1.win_ratio * sec >
-         move_2.num_simulations * options_.seconds_per_move))
+        (move_1.num_simulations * move_1.win_ratio * elapsed_ms >
+         static_cast<float>(move_2.num_simulations) * thinking_time_ms))
       break;
+    // A forced result in move_2 would overflow the difference of the
+    // adjusted numbers of simulations below.
+    if (options_.stop_when_decided &&
+        !ResultIsForced(move_2.num_simulations)) {
+      const int num_simulations = engines_[0]->root_simulation_count();
+      const long long current_ms = GetMonotonicMilliseconds();
+      if (first_num_simulations < 0) {
+        first_num_simulations = num_simulations;
+        first_ms = current_ms;
+      } else if (current_ms - first_ms >= kMinSpeedMeasurementMs) {
+        const float simulations_per_ms =
+            static_cast<float>(num_simulations - first_num_simulations) /
+            (current_ms - first_ms);
+        const float remaining_simulations =
+            simulations_per_ms * (deadline_ms - current_ms);
+        // Every simulation adds at most 2 to the adjusted number
+        // of simulations of a move.
+        if (move_1.num_simulations - move_2.num_simulations >
+            2.0f * remaining_simulations)
+          break;
+      }
+    }
   }
-  terminate_ = true;
-  void* ignored;
-  for (int i = 0, size = threads_.size(); i < size; ++i) {
-    if (pthread_join(threads_[i], &ignored) != 0) {
-      fprintf(stderr, "Cannot join background thread no %d.\n", i);
-      exit(EXIT_FAILURE);
+  StopSearch();
+  const int num_expansion_failures =
+      engines_[0]->expansion_failure_count() - initial_expansion_failure_count;
+  if (num_expansion_failures > 0) {
+    fprintf(stderr, "The tree had no room to expand %d positions\n",
+            num_expansion_failures);
+  }
+}
+
+void Controller::DropRemoteEngine(int i) {
+  fprintf(stderr, "Lost remote engine %s\n",
+          remote_engines_[i]->name().c_str());
+  delete remote_engines_[i];
+  remote_engines_.erase(remote_engines_.begin() + i);
+}
+
+void Controller::MergeRootMoves(MoveInfo* best_move) {
+  std::vector<MoveInfo> moves;
+  engines_[0]->GetRootMoves(&moves);
+  for (int i = 0; i < static_cast<int>(remote_engines_.size()); /**/) {
+    if (remote_engines_[i]->GetRootMoves(&moves)) {
+      ++i;
+    } else {
+      DropRemoteEngine(i);
     }
   }
-  evaluation_ = move_1.win_ratio;
-  if (move_1.win_ratio > highest_win_ratio_) {
-    highest_win_ratio_ = move_1.win_ratio;
-    highest_win_move_ = current_position_.MoveCount();
+  // Adjusted numbers of simulations add up, so a forced result
+  // outweighs any number of simulations of the other engines.
+  // The win ratios are weighted by the numbers of simulations.
+  std::vector<long long> num_simulations(kNumMovesOnBoard, 0);
+  std::vector<int> forced_results(kNumMovesOnBoard, 0);
+  std::vector<float> forced_win_ratios(kNumMovesOnBoard, 0.0f);
+  std::vector<double> win_ratio_sums(kNumMovesOnBoard, 0.0);
+  std::vector<double> weights(kNumMovesOnBoard, 0.0);
+  for (int i = 0, size = moves.size(); i < size; ++i) {
+    const MoveInfo& move = moves[i];
+    num_simulations[move.move] += move.num_simulations;
+    if (ResultIsForced(move.num_simulations)) {
+      forced_results[move.move] = move.num_simulations;
+      forced_win_ratios[move.move] = move.win_ratio;
+    } else {
+      const double weight = std::max(move.num_simulations, 1);
+      win_ratio_sums[move.move] += weight * move.win_ratio;
+      weights[move.move] += weight;
+    }
   }
-  if (ResultIsForced(move_1.num_simulations)) {
-    forced_result_ = move_1.num_simulations;
+  for (int i = 0, size = moves.size(); i < size; ++i) {
+    const MoveIndex move = moves[i].move;
+    if (best_move->move == kInvalidMove ||
+        num_simulations[move] > num_simulations[best_move->move]) {
+      best_move->move = move;
+    }
+  }
+  if (best_move->move == kInvalidMove)
+    return;
+  const MoveIndex move = best_move->move;
+  if (forced_results[move] != 0) {
+    best_move->num_simulations = forced_results[move];
+    best_move->win_ratio = forced_win_ratios[move];
+  } else {
+    best_move->num_simulations = static_cast<int>(std::min<long long>(
+        num_simulations[move], INT_MAX - 0x8000 - 1));
+    best_move->win_ratio = win_ratio_sums[move] / weights[move];
+  }
+}
+
+void Controller::SetTimeSettings(
+    int main_time_ms, int byo_yomi_time_ms, int byo_yomi_stones) {
+  main_time_ms_ = main_time_ms;
+  byo_yomi_time_ms_ = byo_yomi_time_ms;
+  byo_yomi_stones_ = byo_yomi_stones;
+  for (int i = 0; i < 2; ++i) {
+    time_left_ms_[i] = main_time_ms;
+    stones_left_[i] = 0;
+    if (main_time_ms == 0) {
+      time_left_ms_[i] = byo_yomi_time_ms;
+      stones_left_[i] = byo_yomi_stones;
+    }
+  }
+}
+
+void Controller::SetTimeLeft(
+    Player pl, int time_left_ms, int stones_left) {
+  time_left_ms_[pl] = time_left_ms;
+  stones_left_[pl] = stones_left;
+}
+
+bool Controller::HasClock() const {
+  // By GTP, byo-yomi time without byo-yomi stones means no time limit.
+  return main_time_ms_ > 0 || (byo_yomi_time_ms_ > 0 && byo_yomi_stones_ > 0);
+}
+
+int Controller::AllocateTime(Player pl) const {
+  if (!HasClock())
+    return static_cast<int>(1000.0f * options_.seconds_per_move);
+  int moves_to_go;
+  if (stones_left_[pl] > 0) {
+    moves_to_go = stones_left_[pl];
+  } else {
+    // Most games end before a half of the board is filled,
+    // and the player fills every other cell.
+    moves_to_go = std::max(
+        current_position_.NumAvailableMoves() / 4, kMinMovesToGo);
+  }
+  const int usable_time_ms =
+      time_left_ms_[pl] - moves_to_go * options_.time_safety_margin_ms;
+  return std::max(usable_time_ms / moves_to_go, kMinThinkingTimeMs);
+}
+
+void Controller::UpdateClock(Player pl, int elapsed_ms) {
+  if (!HasClock())
+    return;
+  time_left_ms_[pl] -= elapsed_ms;
+  if (stones_left_[pl] > 0) {
+    if (--stones_left_[pl] == 0) {
+      time_left_ms_[pl] = byo_yomi_time_ms_;
+      stones_left_[pl] = byo_yomi_stones_;
+    }
+  } else if (time_left_ms_[pl] <= 0 && byo_yomi_stones_ > 0) {
+    time_left_ms_[pl] += byo_yomi_time_ms_;
+    stones_left_[pl] = byo_yomi_stones_;
   }
-  if (move_1.move == kInvalidMove)
-    return "pass";
-  else
-    return ToString(current_position_.MoveIndexToCell(move_1.move));
 }
 
 void Controller::Reset() {
@@ -134,28 +418,171 @@ void Controller::Reset() {
 }
 
 bool Controller::Undo() {
+  StopPondering();
   return current_position_.UndoPermanentMove();
 }
 
-void* Controller::StartEngineForPthreads(void* obj) {
+void Controller::StartPondering(Player pl) {
+  StopPondering();
+  if (!options_.ponder || !options_.reuse_search_tree)
+    return;
+  budget_.max_playouts = 0;
+  budget_.max_nodes = 0;
+  StartSearch(pl);
+  is_pondering_ = true;
+}
+
+void Controller::StopPondering() {
+  if (!is_pondering_)
+    return;
+  StopSearch();
+  is_pondering_ = false;
+}
+
+void Controller::StartSearch(Player pl) {
+  engines_[0]->PrepareTranspositionTable(current_position_);
+  terminate_ = false;
+  player_ = pl;
+  pthread_mutex_lock(&pool_mutex_);
+  num_active_workers_ = threads_.size();
+  if (options_.num_threads >= 1 && options_.num_threads < num_active_workers_)
+    num_active_workers_ = options_.num_threads;
+  for (int i = 0; i < num_active_workers_; ++i) {
+    assert(engines_[i] != NULL);
+    engines_[i]->mark_as_not_running();
+  }
+  // engines_[0] always selects, since its statistics are polled.
+  num_selecting_workers_ = num_active_workers_;
+  if (options_.playout_threads > 0 && num_active_workers_ > 1) {
+    num_selecting_workers_ = std::max(
+        num_active_workers_ - options_.playout_threads, 1);
+    pipeline_->Start(num_selecting_workers_);
+  }
+  num_searching_workers_ = num_active_workers_;
+  solver_is_searching_ = (mcts_options()->solver_empty_cells > 0);
+  ++search_number_;
+  pthread_cond_broadcast(&search_started_);
+  pthread_mutex_unlock(&pool_mutex_);
+}
+
+void Controller::StopSearch() {
+  terminate_ = true;
+  pthread_mutex_lock(&pool_mutex_);
+  while (num_searching_workers_ > 0 || solver_is_searching_) {
+    pthread_cond_wait(&search_finished_, &pool_mutex_);
+  }
+  pthread_mutex_unlock(&pool_mutex_);
+}
+
+void* Controller::RunSolverForPthreads(void* obj) {
+  Controller* controller = reinterpret_cast<Controller*>(obj);
+  controller->RunSolver();
+  return NULL;
+}
+
+void* Controller::RunWorkerForPthreads(void* obj) {
   Controller* controller = reinterpret_cast<Controller*>(obj);
 
-  pthread_mutex_lock(&controller->thread_num_mutex_);
+  pthread_mutex_lock(&controller->pool_mutex_);
   const int thread_num = controller->thread_num_;
-  AtomicIncrement(&controller->thread_num_, 1);
-  pthread_mutex_unlock(&controller->thread_num_mutex_);
+  ++controller->thread_num_;
+  pthread_mutex_unlock(&controller->pool_mutex_);
 
   assert(controller->engines_[thread_num] != NULL);
-  fprintf(stderr, " %d", thread_num + 1);
-  controller->engines_[thread_num]->SearchForMove(
-      controller->player_,
-      controller->current_position_,
-      &controller->terminate_);
+  controller->RunWorker(thread_num);
   return NULL;
 }
 
+void Controller::RunWorker(int thread_num) {
+  int first_core = -1;
+  int last_search_number = 0;
+  pthread_mutex_lock(&pool_mutex_);
+  while (true) {
+    while (!shutting_down_ && search_number_ == last_search_number) {
+      pthread_cond_wait(&search_started_, &pool_mutex_);
+    }
+    if (shutting_down_)
+      break;
+    last_search_number = search_number_;
+    if (thread_num >= num_active_workers_)
+      continue;
+    const bool uses_pipeline = (num_selecting_workers_ < num_active_workers_);
+    const bool only_plays_out = (thread_num >= num_selecting_workers_);
+    pthread_mutex_unlock(&pool_mutex_);
+    if (options_.first_core != first_core) {
+      first_core = options_.first_core;
+      PinWorker(thread_num, first_core);
+    }
+    if (only_plays_out) {
+      engines_[thread_num]->RunPlayouts(current_position_, pipeline_);
+    } else {
+      engines_[thread_num]->SearchForMove(
+          player_, current_position_, &budget_,
+          uses_pipeline ? pipeline_ : NULL, &terminate_);
+    }
+    pthread_mutex_lock(&pool_mutex_);
+    --num_searching_workers_;
+    pthread_cond_signal(&search_finished_);
+  }
+  pthread_mutex_unlock(&pool_mutex_);
+}
+
+void Controller::RunSolver() {
+  int last_search_number = 0;
+  pthread_mutex_lock(&pool_mutex_);
+  while (true) {
+    while (!shutting_down_ && search_number_ == last_search_number) {
+      pthread_cond_wait(&search_started_, &pool_mutex_);
+    }
+    if (shutting_down_)
+      break;
+    last_search_number = search_number_;
+    if (!solver_is_searching_)
+      continue;
+    pthread_mutex_unlock(&pool_mutex_);
+    endgame_solver_->Run(player_, current_position_, &terminate_);
+    pthread_mutex_lock(&pool_mutex_);
+    solver_is_searching_ = false;
+    pthread_cond_broadcast(&search_finished_);
+  }
+  pthread_mutex_unlock(&pool_mutex_);
+}
+
+bool Controller::WaitForWorker(long long until_ms) {
+  timespec until;
+  until.tv_sec = until_ms / 1000;
+  until.tv_nsec = until_ms % 1000 * 1000000L;
+  pthread_mutex_lock(&pool_mutex_);
+  while (num_searching_workers_ == num_active_workers_ &&
+         pthread_cond_timedwait(
+             &search_finished_, &pool_mutex_, &until) == 0) {
+    continue;
+  }
+  const bool has_finished = (num_searching_workers_ < num_active_workers_);
+  pthread_mutex_unlock(&pool_mutex_);
+  return has_finished;
+}
+
+void Controller::PinWorker(int thread_num, int first_core) {
+  const int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cores <= 0)
+    return;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (first_core >= 0) {
+    CPU_SET((first_core + thread_num) % num_cores, &cpu_set);
+  } else {
+    for (int i = 0; i < num_cores; ++i) {
+      CPU_SET(i, &cpu_set);
+    }
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof cpu_set, &cpu_set) != 0)
+    fprintf(stderr, "Cannot pin background thread no. %d.\n", thread_num);
+}
+
 bool Controller::MakeMove(
     Player pl, const std::string& move_string, int* result) {
+  StopPondering();
   if (move_string == "pass") {
     *result = kNoneWon;
     return true;
@@ -235,6 +662,7 @@ void Controller::GetSgf(int threshold, std::string* sgf) const {
 }
 
 void Controller::LogDebugInfo(Player pl) {
+  StopPondering();
   if (highest_win_ratio_ < options_.win_ratio_threshold)
     return;
   std::string options_string = options_.ToString() +
@@ -263,6 +691,14 @@ int Controller::node_count() const {
   return engines_[0]->node_count();
 }
 
+int Controller::eviction_count() const {
+  return engines_[0]->eviction_count();
+}
+
+int Controller::expansion_failure_count() const {
+  return engines_[0]->expansion_failure_count();
+}
+
 MctsOptions* Controller::mcts_options() {
   return engines_[0]->mcts_options();
 }
@@ -31,11 +31,14 @@
 #include <vector>
 
 #include "havannah.h"
+#include "mcts.h"
 #include "options.h"
 
 namespace lajkonik {
 
+class EndgameSolver;
 class MctsEngine;
+class RemoteEngine;
 struct MctsOptions;
 struct PlayoutOptions;
 
@@ -49,16 +52,44 @@ enum {
 
 class Controller {
  public:
-  // Does not take the ownership of engine.
+  // Does not take the ownership of engines. Gives them a tree
+  // of engines[0]->mcts_options()->tt_size_mb megabytes and starts
+  // a worker thread for each of them.
   Controller(const ControllerOptions& options,
              const std::vector<MctsEngine*>& engines);
   ~Controller();
 
   void ClearTranspositionTable();
-  std::string SuggestMove(Player player, int thinking_time);
+  // Clears the transposition table unless options_.reuse_search_tree
+  // is set and its size has not changed. A table that is too full
+  // gets pruned when a search starts instead.
+  void PrepareTranspositionTable();
+  // Searches for thinking_time_ms milliseconds or, if it is not
+  // positive, for the time allotted by AllocateTime().
+  // Merges the statistics of remote engines added by AddRemoteEngine().
+  std::string SuggestMove(Player player, int thinking_time_ms);
+  // Searches as SuggestMove() but returns the statistics of all moves
+  // from the root instead of choosing one. A process started with
+  // --listen answers the root_moves command of a coordinator with it.
+  void SearchRootMoves(
+      Player player, int thinking_time_ms, std::vector<MoveInfo>* moves);
+  // Makes the process listening on host:port search every position
+  // that SuggestMove() searches. On failure, returns false and sets
+  // *error. The Controller owns the connection until it is destroyed.
+  bool AddRemoteEngine(const std::string& host, int port, std::string* error);
+  // Sets the clocks of both players as the GTP time_settings command.
+  void SetTimeSettings(
+      int main_time_ms, int byo_yomi_time_ms, int byo_yomi_stones);
+  // Sets the clock of a player as the GTP time_left command.
+  void SetTimeLeft(Player player, int time_left_ms, int stones_left);
   bool MakeMove(Player player, const std::string& move_string, int* result);
   void Reset();
   bool Undo();
+  // Searches the current position with the player to move until the
+  // next call of a method that changes the position or the tree, if
+  // options_.ponder and options_.reuse_search_tree are set. The tree
+  // of the move actually played is then reused.
+  void StartPondering(Player player);
   std::string GetBoardString() const;
   bool DumpGameTree(
       int depth, const std::string& filename, std::string* error) const;
@@ -71,6 +102,8 @@ class Controller {
   void LogDebugInfo(Player player);
 
   int node_count() const;
+  int eviction_count() const;
+  int expansion_failure_count() const;
   const Position& position() const { return current_position_; }
   Player player() const { return player_; }
   ControllerOptions* controller_options() { return &options_; }
@@ -78,15 +111,82 @@ class Controller {
   PlayoutOptions* playout_options();
 
  private:
-  static void* StartEngineForPthreads(void* obj);
+  bool HasClock() const;
+  // Returns the milliseconds to think about the next move: a share of
+  // the time left on the player's clock or options_.seconds_per_move
+  // if the game has no clock.
+  int AllocateTime(Player player) const;
+  // Charges the player's clock with the time of a move.
+  void UpdateClock(Player player, int elapsed_ms);
+  // Waits until a worker ends its search or the monotonic clock
+  // reaches until_ms. Returns true if a worker has ended its search.
+  bool WaitForWorker(long long until_ms);
+  // Searches for thinking_time_ms milliseconds or until the search
+  // ends by itself or should end according to options_.
+  void Search(Player player, int thinking_time_ms);
+  // Replaces best_move with the move that has the highest sum of
+  // adjusted numbers of simulations from engines_[0] and
+  // remote_engines_. Drops the remote engines that do not answer.
+  void MergeRootMoves(MoveInfo* best_move);
+  // Disconnects from remote_engines_[i] and removes it.
+  void DropRemoteEngine(int i);
+  // Prunes the tree if needed and wakes the workers to search
+  // for player's move.
+  void StartSearch(Player player);
+  // Makes the workers end their search and waits for them.
+  void StopSearch();
+  void StopPondering();
+  static void* RunWorkerForPthreads(void* obj);
+  static void* RunSolverForPthreads(void* obj);
+  // Waits for searches and runs engines_[thread_num] in them
+  // until the Controller is destroyed.
+  void RunWorker(int thread_num);
+  // Waits for searches and runs endgame_solver_ in those that use it
+  // until the Controller is destroyed.
+  void RunSolver();
+  // Binds the calling thread to a core or, if first_core is negative,
+  // to all cores.
+  void PinWorker(int thread_num, int first_core);
 
   Position current_position_;
   ControllerOptions options_;
 
   const std::vector<MctsEngine*>& engines_;
+  // The tree in which engines_ search.
+  TreeStorage* tree_storage_;
+  // Other processes that search the same positions with their own trees.
+  std::vector<RemoteEngine*> remote_engines_;
+  // Passes leaves from the selecting to the playing engines
+  // if options_.playout_threads is positive.
+  PlayoutPipeline* pipeline_;
+  // Proves results near the end of the game in solver_thread_ during
+  // searches if mcts_options()->solver_empty_cells is positive.
+  EndgameSolver* endgame_solver_;
+  // Bounds the current search if options_.playout_budget
+  // or options_.node_budget is set.
+  SearchBudget budget_;
+  // The workers stay alive between moves, parked on search_started_,
+  // and so does solver_thread_.
   std::vector<pthread_t> threads_;
+  pthread_t solver_thread_;
   int thread_num_;
-  pthread_mutex_t thread_num_mutex_;
+  // Guards the members below.
+  pthread_mutex_t pool_mutex_;
+  pthread_cond_t search_started_;
+  pthread_cond_t search_finished_;
+  // Incremented whenever a search starts.
+  int search_number_;
+  // The number of workers that take part in the current search.
+  int num_active_workers_;
+  // The number of workers that have not finished the current search.
+  int num_searching_workers_;
+  // The workers from this number on only run playouts, unless it is
+  // equal to num_active_workers_.
+  int num_selecting_workers_;
+  // True until solver_thread_ finishes the current search.
+  bool solver_is_searching_;
+  bool shutting_down_;
+  bool is_pondering_;
 
   Player player_;
   int suggested_move_;
@@ -97,6 +197,15 @@ class Controller {
   float highest_win_ratio_;
   int highest_win_move_;
 
+  // The clock as in GTP: main time, then periods of byo_yomi_time_ms_
+  // for byo_yomi_stones_ moves each.
+  int main_time_ms_;
+  int byo_yomi_time_ms_;
+  int byo_yomi_stones_;
+  int time_left_ms_[2];
+  // Zero in main time.
+  int stones_left_[2];
+
   Controller(const Controller&);
   void operator=(const Controller&);
 };
@@ -0,0 +1,204 @@
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Definition of the ProofNumberSearch class. The game is a directed
+// acyclic graph, since stones are never removed, so the plain df-pn
+// algorithm of Nagai applies. The table keeps the proof and disproof
+// numbers of the statement that target_ wins.
+
+#include "dfpn.h"
+
+#include <assert.h>
+#include <algorithm>
+
+namespace lajkonik {
+
+namespace {
+
+const unsigned kInfinity = 100000000;
+
+unsigned AddProofNumbers(unsigned a, unsigned b) {
+  return std::min(a + b, kInfinity);
+}
+
+}  // namespace
+
+ProofNumberSearch::ProofNumberSearch(int log2_table_size)
+    : mementos_(kNumMovesOnBoard + 1),
+      moves_(kNumMovesOnBoard + 1),
+      generation_(0),
+      target_(kWhite),
+      num_nodes_(0),
+      max_nodes_(0),
+      terminate_(NULL) {
+  for (int i = 0, size = mementos_.size(); i < size; ++i) {
+    mementos_[i] = new Memento;
+  }
+  Entry empty_entry;
+  empty_entry.hash = 0;
+  empty_entry.proof = 1;
+  empty_entry.disproof = 1;
+  empty_entry.plies = 0;
+  empty_entry.generation = 0;
+  table_.resize(1 << log2_table_size, empty_entry);
+}
+
+ProofNumberSearch::~ProofNumberSearch() {
+  for (int i = 0, size = mementos_.size(); i < size; ++i) {
+    delete mementos_[i];
+  }
+}
+
+ProofNumberSearch::Result ProofNumberSearch::Solve(
+    const Position& position,
+    Player player,
+    Player target,
+    int max_nodes,
+    volatile bool* terminate,
+    int* plies) {
+  position_.CopyFrom(position);
+  target_ = target;
+  num_nodes_ = 0;
+  max_nodes_ = max_nodes;
+  terminate_ = terminate;
+  ++generation_;
+  Mid(player, kInfinity, kInfinity, 0);
+  const Entry* root = Find(position_.hash());
+  if (root == NULL)
+    return kUnknown;
+  *plies = root->plies;
+  if (root->proof == 0)
+    return kProven;
+  else if (root->disproof == 0)
+    return kDisproven;
+  else
+    return kUnknown;
+}
+
+void ProofNumberSearch::Mid(Player player,
+                            unsigned proof_threshold,
+                            unsigned disproof_threshold,
+                            int depth) {
+  const Hash hash = position_.hash();
+  const bool target_to_move = (player == target_);
+  std::vector<Cell>& moves = moves_[depth];
+  position_.GetFreeCells(&moves);
+  if (moves.empty()) {
+    // A draw, so target_ does not win.
+    Store(hash, kInfinity, 0, 0);
+    return;
+  }
+  ++num_nodes_;
+  Memento* memento = mementos_[depth];
+  for (int i = 0, size = moves.size(); i < size; ++i) {
+    const bool wins =
+        (position_.MakeMoveReversibly(player, moves[i], memento) != 0);
+    memento->UndoAll();
+    if (wins) {
+      if (target_to_move)
+        Store(hash, 0, kInfinity, 1);
+      else
+        Store(hash, kInfinity, 0, 1);
+      return;
+    }
+  }
+  while (true) {
+    // The numbers that the player to move minimizes and sums are
+    // the proof numbers if target_ is to move, the disproof numbers
+    // otherwise.
+    unsigned min_number = kInfinity;
+    unsigned second_min_number = kInfinity;
+    unsigned sum_number = 0;
+    int best_move = 0;
+    int min_plies = 0;
+    int max_plies = 0;
+    for (int i = 0, size = moves.size(); i < size; ++i) {
+      const Entry* kid = Find(Position::ModifyZobristHash(
+          hash, player, Position::CellToMoveIndex(moves[i])));
+      unsigned number = 1;
+      unsigned other_number = 1;
+      if (kid != NULL) {
+        number = target_to_move ? kid->proof : kid->disproof;
+        other_number = target_to_move ? kid->disproof : kid->proof;
+        max_plies = std::max(max_plies, kid->plies);
+      }
+      sum_number = AddProofNumbers(sum_number, other_number);
+      if (number < min_number) {
+        second_min_number = min_number;
+        min_number = number;
+        best_move = i;
+        min_plies = (kid != NULL) ? kid->plies : 0;
+      } else if (number < second_min_number) {
+        second_min_number = number;
+      }
+    }
+    const unsigned proof = target_to_move ? min_number : sum_number;
+    const unsigned disproof = target_to_move ? sum_number : min_number;
+    // The player to move wins as fast as possible and loses
+    // as slowly as possible.
+    const int plies = 1 + ((min_number == 0) ? min_plies : max_plies);
+    if (proof >= proof_threshold || disproof >= disproof_threshold ||
+        ShouldStop()) {
+      Store(hash, proof, disproof, plies);
+      return;
+    }
+    const Entry* kid = Find(Position::ModifyZobristHash(
+        hash, player, Position::CellToMoveIndex(moves[best_move])));
+    const unsigned kid_proof = (kid != NULL) ? kid->proof : 1;
+    const unsigned kid_disproof = (kid != NULL) ? kid->disproof : 1;
+    unsigned kid_proof_threshold;
+    unsigned kid_disproof_threshold;
+    if (target_to_move) {
+      kid_proof_threshold =
+          std::min(proof_threshold, AddProofNumbers(second_min_number, 1));
+      kid_disproof_threshold = disproof_threshold - disproof + kid_disproof;
+    } else {
+      kid_proof_threshold = proof_threshold - proof + kid_proof;
+      kid_disproof_threshold =
+          std::min(disproof_threshold, AddProofNumbers(second_min_number, 1));
+    }
+    position_.MakeMoveReversibly(player, moves[best_move], memento);
+    Mid(Opponent(player), kid_proof_threshold, kid_disproof_threshold,
+        depth + 1);
+    memento->UndoAll();
+  }
+}
+
+const ProofNumberSearch::Entry* ProofNumberSearch::Find(Hash hash) const {
+  const Entry& entry = table_[hash & (table_.size() - 1)];
+  if (entry.hash == hash && entry.generation == generation_)
+    return &entry;
+  return NULL;
+}
+
+void ProofNumberSearch::Store(
+    Hash hash, unsigned proof, unsigned disproof, int plies) {
+  Entry* entry = &table_[hash & (table_.size() - 1)];
+  entry->hash = hash;
+  entry->proof = proof;
+  entry->disproof = disproof;
+  entry->plies = plies;
+  entry->generation = generation_;
+}
+
+}  // namespace lajkonik
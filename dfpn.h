@@ -0,0 +1,100 @@
+#ifndef DFPN_H_
+#define DFPN_H_
+
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Declaration of the ProofNumberSearch class, a depth-first
+// proof-number (df-pn) solver for positions with few empty cells.
+
+#include <vector>
+
+#include "havannah.h"
+
+namespace lajkonik {
+
+class ProofNumberSearch {
+ public:
+  enum Result {
+    kUnknown,
+    kProven,
+    kDisproven
+  };
+
+  // The table holds 2**log2_table_size positions.
+  explicit ProofNumberSearch(int log2_table_size);
+  ~ProofNumberSearch();
+
+  // Finds out whether target wins from position with player to move.
+  // Gives up and returns kUnknown after expanding max_nodes positions
+  // or when *terminate becomes true. Unless the result is kUnknown,
+  // sets *plies to the length of the game in the proof.
+  Result Solve(const Position& position,
+               Player player,
+               Player target,
+               int max_nodes,
+               volatile bool* terminate,
+               int* plies);
+
+ private:
+  struct Entry {
+    Hash hash;
+    unsigned proof;
+    unsigned disproof;
+    int plies;
+    // Entries of other calls of Solve() are invalid.
+    unsigned generation;
+  };
+
+  // Searches position_ until its proof number reaches proof_threshold
+  // or its disproof number reaches disproof_threshold.
+  void Mid(Player player,
+           unsigned proof_threshold,
+           unsigned disproof_threshold,
+           int depth);
+  // Returns the entry of the position with the given hash or NULL.
+  const Entry* Find(Hash hash) const;
+  void Store(Hash hash, unsigned proof, unsigned disproof, int plies);
+  bool ShouldStop() const {
+    return num_nodes_ >= max_nodes_ || *terminate_;
+  }
+
+  Position position_;
+  // The moves made at each depth are undone separately.
+  std::vector<Memento*> mementos_;
+  // The empty cells at each depth.
+  std::vector<std::vector<Cell> > moves_;
+  std::vector<Entry> table_;
+  unsigned generation_;
+  Player target_;
+  int num_nodes_;
+  int max_nodes_;
+  volatile bool* terminate_;
+
+  ProofNumberSearch(const ProofNumberSearch&);
+  void operator=(const ProofNumberSearch&);
+};
+
+}  // namespace lajkonik
+
+#endif  // DFPN_H_
@@ -34,8 +34,11 @@
 namespace lajkonik {
 
 const Frontend::Command Frontend::kCommands[] = {
+  { "addremoteengine", &Frontend::AddRemoteEngine },
   { "boardsize", &Frontend::Boardsize },
   { "clearboard", &Frontend::ClearBoard },
+  { "countevictions", &Frontend::CountEvictions },
+  { "countfailedexpansions", &Frontend::CountFailedExpansions },
   { "countnodes", &Frontend::CountNodes },
   { "dumptree", &Frontend::DumpTree },
   { "genmove", &Frontend::Genmove },
@@ -51,9 +54,12 @@ const Frontend::Command Frontend::kCommands[] = {
   { "play", &Frontend::Play },
   { "playgame", &Frontend::PlayGame },
   { "protocolversion", &Frontend::ProtocolVersion },
+  { "rootmoves", &Frontend::RootMoves },
   { "setoption", &Frontend::SetOption },
   { "showboard", &Frontend::Showboard },
   { "showoption", &Frontend::ShowOption },
+  { "timeleft", &Frontend::TimeLeft },
+  { "timesettings", &Frontend::TimeSettings },
   { "quit", &Frontend::Quit },
   { "undo", &Frontend::Undo },
   { "version", &Frontend::Version },
@@ -92,11 +98,15 @@ Frontend::Frontend(
   ADD_OPTION(float_options_, mcts_options, tricky_epsilon);
   ADD_OPTION(float_options_, mcts_options, locality_bias);
   ADD_OPTION(float_options_, mcts_options, chain_size_bias_factor);
+  ADD_OPTION(float_options_, mcts_options, widening_factor);
   ADD_OPTION(float_options_, controller_options,
              sole_nonlosing_move_win_ratio_threshold);
   ADD_OPTION(float_options_, controller_options, win_ratio_threshold);
+  ADD_OPTION(float_options_, controller_options, seconds_per_move);
 
   ADD_OPTION(int_options_, playout_options, retries_of_isolated_moves);
+  ADD_OPTION(int_options_, playout_options, moves_before_filling_board);
+  ADD_OPTION(int_options_, mcts_options, widening_base);
   ADD_OPTION(int_options_, mcts_options, expand_after_n_playouts);
   ADD_OPTION(int_options_, mcts_options, play_n_playouts_at_once);
   ADD_OPTION(int_options_, mcts_options, exploration_strategy);
@@ -105,7 +115,16 @@ Frontend::Frontend(
   ADD_OPTION(int_options_, mcts_options, prior_num_simulations_range);
   ADD_OPTION(int_options_, mcts_options, prior_reward_halfrange);
   ADD_OPTION(int_options_, mcts_options, neighborhood_size);
-  ADD_OPTION(int_options_, controller_options, seconds_per_move);
+  ADD_OPTION(int_options_, mcts_options, tt_size_mb);
+  ADD_OPTION(int_options_, mcts_options, solver_empty_cells);
+  ADD_OPTION(int_options_, mcts_options, solver_node_limit);
+  ADD_OPTION(int_options_, controller_options, time_safety_margin_ms);
+  ADD_OPTION(int_options_, controller_options, playout_budget);
+  ADD_OPTION(int_options_, controller_options, node_budget);
+  ADD_OPTION(int_options_, controller_options, random_seed);
+  ADD_OPTION(int_options_, controller_options, num_threads);
+  ADD_OPTION(int_options_, controller_options, first_core);
+  ADD_OPTION(int_options_, controller_options, playout_threads);
 
   bool_options_.push_back(
       std::make_pair("use_lg_coordinates", &g_use_lg_coordinates));
@@ -122,6 +141,9 @@ Frontend::Frontend(
   ADD_OPTION(bool_options_, controller_options, print_debug_info);
   ADD_OPTION(bool_options_, controller_options, use_human_like_time_control);
   ADD_OPTION(bool_options_, controller_options, use_swap);
+  ADD_OPTION(bool_options_, controller_options, reuse_search_tree);
+  ADD_OPTION(bool_options_, controller_options, stop_when_decided);
+  ADD_OPTION(bool_options_, controller_options, ponder);
 #undef ADD_OPTION
 }
 
@@ -211,12 +233,33 @@ void Frontend::Boardsize(const std::vector<char*>& args) {
     Answer(kFailure, "unacceptable size %s", args[0]);
 }
 
+void Frontend::AddRemoteEngine(const std::vector<char*>& args) {
+  int port;
+  if (args.size() != 2) {
+    Answer(kFailure, "expected two arguments to add_remote_engine");
+  } else if (StrToInt(args[1], &port)) {
+    std::string error;
+    if (controller_->AddRemoteEngine(args[0], port, &error))
+      Answer(kSuccess, "");
+    else
+      Answer(kFailure, "%s", error.c_str());
+  }
+}
+
 void Frontend::ClearBoard(const std::vector<char*>& /*args*/) {
   controller_->Reset();
   *result_ = kNoneWon;
   Answer(kSuccess, "");
 }
 
+void Frontend::CountEvictions(const std::vector<char*>& /*args*/) {
+  Answer(kSuccess, "%d", controller_->eviction_count());
+}
+
+void Frontend::CountFailedExpansions(const std::vector<char*>& /*args*/) {
+  Answer(kSuccess, "%d", controller_->expansion_failure_count());
+}
+
 void Frontend::CountNodes(const std::vector<char*>& /*args*/) {
   Answer(kSuccess, "%d", controller_->node_count());
 }
@@ -241,9 +284,9 @@ void Frontend::Genmove(const std::vector<char*>& args) {
   if (!args.empty() && GetColor(args[0], &player))
     thinking_time_index = 1;
   const int last_arg_index = args.size() - 1;
-  int thinking_time;
+  float thinking_time;
   if (thinking_time_index == last_arg_index) {
-    if (!StrToInt(args[thinking_time_index], &thinking_time)) {
+    if (!StrToFloat(args[thinking_time_index], &thinking_time)) {
       Answer(kFailure, "invalid arguments to genmove");
       return;
     }
@@ -257,17 +300,20 @@ void Frontend::Genmove(const std::vector<char*>& args) {
   if (*result_ == kNoneWon) {
     *is_thinking_ = true;
     if (!controller_->controller_options()->clear_tt_after_move)
-      controller_->ClearTranspositionTable();
-    const std::string move = controller_->SuggestMove(player, thinking_time);
+      controller_->PrepareTranspositionTable();
+    const std::string move = controller_->SuggestMove(
+        player, static_cast<int>(1000.0f * thinking_time));
     if (!controller_->MakeMove(player, move, result_)) {
       fprintf(stderr, "Unexpected move %s", move.c_str());
       exit(EXIT_FAILURE);
     }
     Answer(kSuccess, "%s", move.c_str());
     if (controller_->controller_options()->clear_tt_after_move)
-      controller_->ClearTranspositionTable();
+      controller_->PrepareTranspositionTable();
     *player_ = Opponent(player);
     *is_thinking_ = false;
+    if (*result_ == kNoneWon)
+      controller_->StartPondering(*player_);
   } else {
     Answer(kSuccess, "none");
   }
@@ -409,6 +455,32 @@ void Frontend::Quit(const std::vector<char*>& /*args*/) {
   exit(EXIT_SUCCESS);
 }
 
+void Frontend::RootMoves(const std::vector<char*>& args) {
+  Player player;
+  float thinking_time;
+  if (args.size() != 2) {
+    Answer(kFailure, "expected two arguments to root_moves");
+  } else if (!GetColor(args[0], &player)) {
+    Answer(kFailure, "invalid color %s", args[0]);
+  } else if (StrToFloat(args[1], &thinking_time)) {
+    *is_thinking_ = true;
+    controller_->PrepareTranspositionTable();
+    std::vector<MoveInfo> moves;
+    controller_->SearchRootMoves(
+        player, static_cast<int>(1000.0f * thinking_time), &moves);
+    *is_thinking_ = false;
+    StartAnswer(kSuccess);
+    Printf("\n");
+    for (int i = 0, size = moves.size(); i < size; ++i) {
+      Printf("%s %d %.6f\n",
+             ToString(Position::MoveIndexToCell(moves[i].move)).c_str(),
+             moves[i].num_simulations, moves[i].win_ratio);
+    }
+    Printf("\n");
+    Flush();
+  }
+}
+
 void Frontend::SetOption(const std::vector<char*>& args) {
   if (args.size() != 2) {
     Answer(kFailure, "expected two arguments to set_option");
@@ -470,6 +542,38 @@ void Frontend::ShowOption(const std::vector<char*>& args) {
   }
 }
 
+void Frontend::TimeLeft(const std::vector<char*>& args) {
+  Player player;
+  float time_left;
+  int stones_left;
+  if (args.size() != 3) {
+    Answer(kFailure, "expected three arguments to time_left");
+  } else if (!GetColor(args[0], &player)) {
+    Answer(kFailure, "invalid color %s", args[0]);
+  } else if (StrToFloat(args[1], &time_left) &&
+             StrToInt(args[2], &stones_left)) {
+    controller_->SetTimeLeft(
+        player, static_cast<int>(1000.0f * time_left), stones_left);
+    Answer(kSuccess, "");
+  }
+}
+
+void Frontend::TimeSettings(const std::vector<char*>& args) {
+  float main_time;
+  float byo_yomi_time;
+  int byo_yomi_stones;
+  if (args.size() != 3) {
+    Answer(kFailure, "expected three arguments to time_settings");
+  } else if (StrToFloat(args[0], &main_time) &&
+             StrToFloat(args[1], &byo_yomi_time) &&
+             StrToInt(args[2], &byo_yomi_stones)) {
+    controller_->SetTimeSettings(static_cast<int>(1000.0f * main_time),
+                                 static_cast<int>(1000.0f * byo_yomi_time),
+                                 byo_yomi_stones);
+    Answer(kSuccess, "");
+  }
+}
+
 void Frontend::Undo(const std::vector<char*>& /*args*/) {
   if (controller_->Undo()) {
     Answer(kSuccess, "");
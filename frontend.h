@@ -69,8 +69,11 @@ class Frontend {
   bool StrToInt(const char* str, int* v);
   bool StrToBool(const char* str, bool* v);
 
+  void AddRemoteEngine(const std::vector<char*>& args);
   void Boardsize(const std::vector<char*>& args);
   void ClearBoard(const std::vector<char*>& args);
+  void CountEvictions(const std::vector<char*>& args);
+  void CountFailedExpansions(const std::vector<char*>& args);
   void CountNodes(const std::vector<char*>& args);
   void DumpTree(const std::vector<char*>& args);
   void Genmove(const std::vector<char*>& args);
@@ -86,9 +89,12 @@ class Frontend {
   void Play(const std::vector<char*>& args);
   void PlayGame(const std::vector<char*>& args);
   void ProtocolVersion(const std::vector<char*>& args);
+  void RootMoves(const std::vector<char*>& args);
   void SetOption(const std::vector<char*>& args);
   void Showboard(const std::vector<char*>& args);
   void ShowOption(const std::vector<char*>& args);
+  void TimeLeft(const std::vector<char*>& args);
+  void TimeSettings(const std::vector<char*>& args);
   void Quit(const std::vector<char*>& args);
   void Undo(const std::vector<char*>& args);
   void Version(const std::vector<char*>& args);
@@ -271,23 +271,251 @@ std::string PrintableBoard::MakeLittleGolemString(Cell marked_cell) const {
   return result;
 }
 
-//-- BoardBitmask -----------------------------------------------------
-unsigned BoardBitmask::Get6Neighbors(XCoord x, YCoord y) const {
+//---------------------------------------------------------------------
+// Helpers that work on rows of stones. BoardBitmask and Chain keep them
+// in BoardBitmasks, and PlayoutBoard in plain arrays.
+namespace {
+
+unsigned Get6NeighborsInRows(const RowBitmask rows[], XCoord x, YCoord y) {
   // For a board fragment
   //    ab
   //   cde
   //   fg
   // the six neighbors of d correspond to the bit pattern baecgf.
   unsigned neighborhood;
-  neighborhood = (Row(PrevY(y)) >> x) & 3;
-  const RowBitmask curr_line = Row(y);
+  neighborhood = (rows[PrevY(y)] >> x) & 3;
+  const RowBitmask curr_line = rows[y];
   neighborhood = (neighborhood << 1) | ((curr_line >> (x + 1)) & 1);
   neighborhood = (neighborhood << 1) | ((curr_line >> (x - 1)) & 1);
   neighborhood = (neighborhood << 2) |
-                 ((Row(NextY(y)) >> (x - 1)) & 3);
+                 ((rows[NextY(y)] >> (x - 1)) & 3);
   return neighborhood;
 }
 
+unsigned Get18NeighborsInRows(const RowBitmask rows[], XCoord x, YCoord y) {
+  // For a board fragment
+  //    abc
+  //   defg
+  //  hijkl
+  //  mnop
+  //  qrs
+  // the 18 neighbors of j correspond to the bit pattern cbagfedlkihponmsrq.
+  unsigned neighborhood;
+  neighborhood = (rows[PrevY(PrevY(y))] >> x) & 7;
+  neighborhood = (neighborhood << 4) | ((rows[PrevY(y)] >> (x - 1)) & 15);
+  const RowBitmask curr_line = rows[y];
+  neighborhood = (neighborhood << 2) | ((curr_line >> (x + 1)) & 3);
+  neighborhood = (neighborhood << 2) | ((curr_line >> (x - 2)) & 3);
+  neighborhood = (neighborhood << 4) | ((rows[NextY(y)] >> (x - 2)) & 15);
+  neighborhood = (neighborhood << 3) |
+                 ((rows[NextY(NextY(y))] >> (x - 2)) & 7);
+  return neighborhood;
+}
+
+// The lines are the rows y - 2...y + 2 of a chain, shifted right by
+// x - 2, where (x, y) is an empty cell. Returns 0 if putting a stone
+// in the cell cannot close any ring of the chain, 64 if it closes
+// a ring, and a mask of tests for PassesRingTests() otherwise.
+// Reads only the six neighbors of the cell in lines[1...3].
+unsigned char GetRingTests(const int lines[5]) {
+  const int prev_line = lines[1];
+  const int this_line = lines[2];
+  const int next_line = lines[3];
+  // For a board fragment
+  //    ab
+  //   cde
+  //   fg
+  // the neighborhood of d is the bit pattern baedcgf.
+  int neighborhood;
+  neighborhood = (prev_line >> 2) & 3;
+  neighborhood = (neighborhood << 3) | ((this_line >> 1) & 5);
+  neighborhood = (neighborhood << 2) | ((next_line >> 1) & 3);
+  // Putting a stone in a cell closes a ring if among the six cells around
+  // the stone we find at least two nonadjacent stones from the same chain
+  // or else three adjacent stones from the same chain and three stones
+  // behind them. The first case is encoded as 64; the second case as a
+  // six-bit (1-63) mask indicating the need for more tests; failing to close
+  // a ring is encoded as 0. If both cases are true (111010), 64 is enough.
+  static const unsigned char kClosesRing[128] = {
+     0,  0,  0,  0,  0,  0, 64,  4,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 64,  0,  8, 64, 64, 64, 12,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 64, 64, 64,  0,  2, 64,  6,  0,  0,  0,  0,  0,  0,  0,  0,
+    64, 64, 64, 64, 64, 64, 64, 14,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 64, 64, 64, 64, 64, 64, 64,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 64, 16, 24, 64, 64, 64, 28,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 64, 64, 64,  1,  3, 64,  7,  0,  0,  0,  0,  0,  0,  0,  0,
+    32, 64, 48, 56, 33, 35, 49,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  };
+  assert(neighborhood >= 0);
+  assert(neighborhood < 128);
+  return kClosesRing[neighborhood];
+}
+
+// Returns (1 << 12) if the lines pass any of the tests from the mask
+// returned by GetRingTests(), 0 otherwise.
+unsigned PassesRingTests(unsigned char mask, const int lines[5]) {
+  const unsigned kPositiveResult = (1 << 12);
+  const int prev2_line = lines[0];
+  const int prev_line = lines[1];
+  const int this_line = lines[2];
+  const int next_line = lines[3];
+  const int next2_line = lines[4];
+  if ((mask & 1) && ((prev2_line & 12) == 12) && (prev_line & 2))
+    return kPositiveResult;
+  if ((mask & 2) && (prev_line & 2) && (this_line & next_line & 1))
+    return kPositiveResult;
+  if ((mask & 4) && (next_line & 1) && (next2_line & 3) == 3)
+    return kPositiveResult;
+  if ((mask & 8) && (next_line & 8) && ((next2_line & 6) == 6))
+    return kPositiveResult;
+  if ((mask & 16) && (prev_line & this_line & 16) && (next_line & 8))
+    return kPositiveResult;
+  if ((mask & 32) && (prev_line & 16) && ((prev2_line & 24) == 24))
+    return kPositiveResult;
+  return 0;
+}
+
+// Returns (1 << 12) if putting a stone in the cell described by lines
+// as above closes any ring of the chain, 0 otherwise.
+unsigned ClosesAnyRingInLines(const int lines[5]) {
+  const unsigned char mask = GetRingTests(lines);
+  if (mask == 0)
+    return 0;
+  if (mask == 64)
+    return (1 << 12);
+  return PassesRingTests(mask, lines);
+}
+
+// Returns (1 << 13) if putting a stone in the cell described by lines
+// as above closes a benzene ring, 0 otherwise.
+unsigned ClosesBenzeneRingInLines(const int lines[5]) {
+  const unsigned kPositiveResult = (1 << 13);
+  const int prev2_line = lines[0];
+  const int prev_line = lines[1];
+  const int this_line = lines[2];
+  const int next_line = lines[3];
+  const int next2_line = lines[4];
+  if (this_line & 2) {
+    if (((prev_line & 10) == 10) && ((prev2_line & 12) == 12))
+      return kPositiveResult;
+    if (((next_line & 5) == 5) && ((next2_line & 3) == 3))
+      return kPositiveResult;
+  }
+  if (this_line & 8) {
+    if (((prev_line & 20) == 20) && ((prev2_line & 24) == 24))
+      return kPositiveResult;
+    if (((next_line & 10) == 10) && ((next2_line & 6) == 6))
+      return kPositiveResult;
+  }
+  if (((prev_line & 6) == 6) && (this_line & 1) && ((next_line & 3) == 3))
+    return kPositiveResult;
+  if (((prev_line & 24) == 24) && (this_line & 16) && ((next_line & 12) == 12))
+    return kPositiveResult;
+  return 0;
+}
+
+// Adds to region[y] the cells of mask[y] adjacent to the region
+// and the cells connected to them within the row. Returns true
+// if the region has grown.
+bool GrowRegionInRow(const RowBitmask mask[], YCoord y, RowBitmask region[]) {
+  const RowBitmask prev = region[PrevY(y)];
+  const RowBitmask next = region[NextY(y)];
+  RowBitmask grown =
+      (region[y] | prev | (prev >> 1) | next | (next << 1)) & mask[y];
+  RowBitmask row;
+  do {
+    row = grown;
+    grown = (row | (row << 1) | (row >> 1)) & mask[y];
+  } while (grown != row);
+  if (row == region[y])
+    return false;
+  region[y] = row;
+  return true;
+}
+
+// Extends region[] to all the cells of mask[] connected to it.
+// The region must lie within the mask and the rows outside the board
+// must be empty.
+void FloodFillInRows(const RowBitmask mask[], RowBitmask region[]) {
+  bool has_grown;
+  do {
+    has_grown = false;
+    for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+      has_grown |= GrowRegionInRow(mask, y, region);
+    }
+    for (YCoord y = PrevY(kPastRows); y >= kGapAround; y = PrevY(y)) {
+      has_grown |= GrowRegionInRow(mask, y, region);
+    }
+  } while (has_grown);
+}
+
+// Returns the winning conditions that the stones fulfill, not telling
+// benzene rings from other rings. The border holds the edges and corners
+// of the board.
+WinningCondition GetWinningConditionInRows(
+    const RowBitmask stones[], const RowBitmask border[]) {
+  const BoardBitmask& board = Position::GetBoardBitmask();
+  int victory = kNoWinningCondition;
+  // The stones form a ring if some cell other than the border
+  // neither belongs to nor neighbors the region that the cells free
+  // from the stones connect to the border. Taking the cells
+  // of the stones into account catches rings filled with stones.
+  RowBitmask free_cells[kBoardHeight];
+  RowBitmask outside[kBoardHeight];
+  for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
+    free_cells[y] = board.Row(y) & ~stones[y];
+    outside[y] = free_cells[y] & border[y];
+  }
+  FloodFillInRows(free_cells, outside);
+  for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+    const RowBitmask prev = outside[PrevY(y)];
+    const RowBitmask curr = outside[y];
+    const RowBitmask next = outside[NextY(y)];
+    const RowBitmask near_outside =
+        curr | (curr << 1) | (curr >> 1) | prev | (prev >> 1) |
+        next | (next << 1);
+    if (board.Row(y) & ~border[y] & ~near_outside) {
+      victory |= kRing;
+      break;
+    }
+  }
+  // Only the chains that touch the border can form forks and bridges.
+  RowBitmask seeds[kBoardHeight];
+  for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
+    seeds[y] = stones[y] & border[y];
+  }
+  for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+    while (seeds[y] != 0) {
+      RowBitmask chain[kBoardHeight];
+      memset(chain, 0, sizeof chain);
+      chain[y] = seeds[y] & -seeds[y];
+      FloodFillInRows(stones, chain);
+      unsigned edges_corners = 0;
+      for (YCoord yy = y; yy < kPastRows; yy = NextY(yy)) {
+        RowBitmask touched = chain[yy] & seeds[yy];
+        seeds[yy] &= ~touched;
+        while (touched != 0) {
+          const XCoord x = static_cast<XCoord>(CountTrailingZeroes(touched));
+          edges_corners |= Position::GetMaskOfEdgesAndCorners(XYToCell(x, yy));
+          touched &= touched - 1;
+        }
+      }
+      if (CountSetBits(edges_corners) >= 3)
+        victory |= kFork;
+      if (CountSetBits(edges_corners >> 6) >= 2)
+        victory |= kBridge;
+    }
+  }
+  return static_cast<WinningCondition>(victory);
+}
+
+}  // namespace
+
+//-- BoardBitmask -----------------------------------------------------
+unsigned BoardBitmask::Get6Neighbors(XCoord x, YCoord y) const {
+  return Get6NeighborsInRows(rows_, x, y);
+}
+
 //-- Chain ------------------------------------------------------------
 void Chain::AddStoneReversibly(XCoord x, YCoord y, Memento* memento) {
   assert(LiesOnBoard(x, y));
@@ -313,25 +541,38 @@ void Chain::AddStoneFast(XCoord x, YCoord y) {
   ++num_stones_;
 }
 
-void Chain::ComputeUnion(
-    XCoord x, YCoord y, const Chain& other, Chain* result) const {
+void Chain::AbsorbReversibly(
+    XCoord x, YCoord y, const Chain& other, Memento* memento) {
   assert(LiesOnBoard(x, y));
-  assert(stone_mask_.get(x, y));
-  assert(!other.stone_mask_.get(x, y));
-  result->stone_mask_.FillWithOr(stone_mask_, other.stone_mask_);
-  result->num_stones_ = num_stones() + other.num_stones();
-  // Since this Chain contains the stone at (x, y), the ring bit of
-  // edges_corners_ring_ reflects the ring status of this Chain.
-  // But we need to update the ring bit of result->edges_corners_ring_
+  assert(stone_mask_.get(x, y) != other.stone_mask_.get(x, y));
+  // The ring bit of the Chain that contains the stone at (x, y) reflects
+  // its ring status. But we need to update the ring bit of the union
   // when X joins Chains A and B, closing the ring in Chain B like here:
   //   .A
   //   BX.
   //    .B
-  result->edges_corners_ring_ =
-      edges_corners_ring_ |
-      other.edges_corners_ring_ |
-      other.GetRingMask(x, y);
-  result->newer_version_ = 0;
+  const unsigned mask = other.edges_corners_ring_ |
+      (stone_mask_.get(x, y) ? other : *this).GetRingMask(x, y);
+  memento->Remember(&edges_corners_ring_);
+  edges_corners_ring_ |= mask;
+  for (YCoord yy = kGapAround; yy < kPastRows; yy = NextY(yy)) {
+    const RowBitmask row = other.NthRow(yy);
+    if (row != 0) {
+      memento->Remember(&NthRow(yy));
+      NthRow(yy) |= row;
+    }
+  }
+  memento->Remember(&num_stones_);
+  num_stones_ += other.num_stones_;
+}
+
+void Chain::AbsorbFast(XCoord x, YCoord y, const Chain& other) {
+  assert(LiesOnBoard(x, y));
+  assert(stone_mask_.get(x, y) != other.stone_mask_.get(x, y));
+  edges_corners_ring_ |= other.edges_corners_ring_ |
+      (stone_mask_.get(x, y) ? other : *this).GetRingMask(x, y);
+  stone_mask_.FillWithOr(stone_mask_, other.stone_mask_);
+  num_stones_ += other.num_stones_;
 }
 
 void Chain::InitWithStone(XCoord x, YCoord y) {
@@ -367,92 +608,30 @@ void Chain::SetNewerVersionReversibly(ChainNum nv, Memento* memento) {
 
 unsigned Chain::ClosesAnyRing(XCoord x, YCoord y) const {
   assert(!stone_mask_.get(x, y));
-  // For a board fragment
-  //    ab
-  //   cde
-  //   fg
-  // the neighborhood of d is the bit pattern baedcgf.
-  int neighborhood;
-  neighborhood = (NthRow(PrevY(y)) >> x) & 3;
-  neighborhood = (neighborhood << 3) | ((NthRow(y) >> (x - 1)) & 5);
-  neighborhood = (neighborhood << 2) |
-                 ((NthRow(NextY(y)) >> (x - 1)) & 3);
-  // Putting a stone in a cell closes a ring if among the six cells around
-  // the stone we find at least two nonadjacent stones from the same chain
-  // or else three adjacent stones from the same chain and three stones
-  // behind them. The first case is encoded as 64; the second case as a
-  // six-bit (1-63) mask indicating the need for more tests; failing to close
-  // a ring is encoded as 0. If both cases are true (111010), 64 is enough.
-  static const unsigned char kClosesRing[128] = {
-     0,  0,  0,  0,  0,  0, 64,  4,  0,  0,  0,  0,  0,  0,  0,  0,
-     0, 64,  0,  8, 64, 64, 64, 12,  0,  0,  0,  0,  0,  0,  0,  0,
-     0, 64, 64, 64,  0,  2, 64,  6,  0,  0,  0,  0,  0,  0,  0,  0,
-    64, 64, 64, 64, 64, 64, 64, 14,  0,  0,  0,  0,  0,  0,  0,  0,
-     0, 64, 64, 64, 64, 64, 64, 64,  0,  0,  0,  0,  0,  0,  0,  0,
-     0, 64, 16, 24, 64, 64, 64, 28,  0,  0,  0,  0,  0,  0,  0,  0,
-     0, 64, 64, 64,  1,  3, 64,  7,  0,  0,  0,  0,  0,  0,  0,  0,
-    32, 64, 48, 56, 33, 35, 49,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-  };
-  assert(neighborhood >= 0);
-  assert(neighborhood < 128);
-  unsigned char mask = kClosesRing[neighborhood];
-  const unsigned kPositiveResult = (1 << 12);
-  if (mask == 0)
-    return 0;
-  if (mask == 64)
-    return kPositiveResult;
-  const int xx = x - 2;
-  const int prev2_line = NthRow(PrevY(PrevY(y))) >> xx;
-  const int prev_line = NthRow(PrevY(y)) >> xx;
-  const int this_line = NthRow(y) >> xx;
-  const int next_line = NthRow(NextY(y)) >> xx;
-  const int next2_line = NthRow(NextY(NextY(y))) >> xx;
-  if ((mask & 1) && ((prev2_line & 12) == 12) && (prev_line & 2))
-    return kPositiveResult;
-  if ((mask & 2) && (prev_line & 2) && (this_line & next_line & 1))
-    return kPositiveResult;
-  if ((mask & 4) && (next_line & 1) && (next2_line & 3) == 3)
-    return kPositiveResult;
-  if ((mask & 8) && (next_line & 8) && ((next2_line & 6) == 6))
-    return kPositiveResult;
-  if ((mask & 16) && (prev_line & this_line & 16) && (next_line & 8))
-    return kPositiveResult;
-  if ((mask & 32) && (prev_line & 16) && ((prev2_line & 24) == 24))
-    return kPositiveResult;
-  return 0;
+  int lines[5];
+  GetLines(x, y, lines);
+  return ClosesAnyRingInLines(lines);
 }
 
 unsigned Chain::ClosesBenzeneRing(XCoord x, YCoord y) const {
-  const unsigned kPositiveResult = (1 << 13);
+  int lines[5];
+  GetLines(x, y, lines);
+  return ClosesBenzeneRingInLines(lines);
+}
+
+void Chain::GetLines(XCoord x, YCoord y, int lines[5]) const {
   const int xx = x - 2;
-  const int prev2_line = NthRow(PrevY(PrevY(y))) >> xx;
-  const int prev_line = NthRow(PrevY(y)) >> xx;
-  const int this_line = NthRow(y) >> xx;
-  const int next_line = NthRow(NextY(y)) >> xx;
-  const int next2_line = NthRow(NextY(NextY(y))) >> xx;
-  if (this_line & 2) {
-    if (((prev_line & 10) == 10) && ((prev2_line & 12) == 12))
-      return kPositiveResult;
-    if (((next_line & 5) == 5) && ((next2_line & 3) == 3))
-      return kPositiveResult;
+  for (int i = 0; i < 5; ++i) {
+    lines[i] = NthRow(static_cast<YCoord>(y - 2 + i)) >> xx;
   }
-  if (this_line & 8) {
-    if (((prev_line & 20) == 20) && ((prev2_line & 24) == 24))
-      return kPositiveResult;
-    if (((next_line & 10) == 10) && ((next2_line & 6) == 6))
-      return kPositiveResult;
-  }
-  if (((prev_line & 6) == 6) && (this_line & 1) && ((next_line & 3) == 3))
-    return kPositiveResult;
-  if (((prev_line & 24) == 24) && (this_line & 16) && ((next_line & 12) == 12))
-    return kPositiveResult;
-  return 0;
 }
 
 unsigned Chain::GetRingMask(XCoord x, YCoord y) const {
-  unsigned result = ClosesAnyRing(x, y);
+  int lines[5];
+  GetLines(x, y, lines);
+  unsigned result = ClosesAnyRingInLines(lines);
   if (result != 0)
-    result |= ClosesBenzeneRing(x, y);
+    result |= ClosesBenzeneRingInLines(lines);
   return result;
 }
 
@@ -474,16 +653,11 @@ ChainNum ChainSet::MergeChainsReversibly(
   assert(chain2 == NewestVersion(chain2));
   if (chain1 == chain2)
     return chain2;
-  Chain* chain1_p = chains_[chain1];
-  Chain* chain2_p = chains_[chain2];
-  int last_chain = chains_.size();
-  assert(last_chain < kChainNumLimit);
-  Chain* result = allocator_.MakeChain();
-  chains_.push_back(result);
-  chain1_p->ComputeUnion(x, y, *chain2_p, result);
-  chain1_p->SetNewerVersionReversibly(last_chain, memento);
-  chain2_p->SetNewerVersionReversibly(last_chain, memento);
-  return last_chain;
+  if (chains_[chain1]->num_stones() < chains_[chain2]->num_stones())
+    std::swap(chain1, chain2);
+  chains_[chain1]->AbsorbReversibly(x, y, *chains_[chain2], memento);
+  chains_[chain2]->SetNewerVersionReversibly(chain1, memento);
+  return chain1;
 }
 
 ChainNum ChainSet::MergeChainsFast(
@@ -492,16 +666,11 @@ ChainNum ChainSet::MergeChainsFast(
   assert(chain2 == NewestVersion(chain2));
   if (chain1 == chain2)
     return chain2;
-  Chain* chain1_p = chains_[chain1];
-  Chain* chain2_p = chains_[chain2];
-  int last_chain = chains_.size();
-  assert(last_chain < kChainNumLimit);
-  Chain* result = allocator_.MakeChain();
-  chains_.push_back(result);
-  chain1_p->ComputeUnion(x, y, *chain2_p, result);
-  chain1_p->SetNewerVersionFast(last_chain);
-  chain2_p->SetNewerVersionFast(last_chain);
-  return last_chain;
+  if (chains_[chain1]->num_stones() < chains_[chain2]->num_stones())
+    std::swap(chain1, chain2);
+  chains_[chain1]->AbsorbFast(x, y, *chains_[chain2]);
+  chains_[chain2]->SetNewerVersionFast(chain1);
+  return chain1;
 }
 
 ChainNum ChainSet::MakeOneStoneChain(XCoord x, YCoord y) {
@@ -572,12 +741,14 @@ WinningCondition PlayerPosition::MakeMoveReversibly(
     if (current_chain == 0)
       continue;
     if (previous_chain != 0) {
-      previous_chain = chain_set_.NewestVersion(previous_chain);
       current_chain = chain_set_.NewestVersion(current_chain);
-      ring_db_.MergeChainEdgesReversibly(
-          previous_chain, current_chain, chain_set_, memento);
-      previous_chain = chain_set_.MergeChainsReversibly(
+      const ChainNum merged_chain = chain_set_.MergeChainsReversibly(
           x, y, previous_chain, current_chain, memento);
+      ring_db_.MergeChainEdgesReversibly(
+          merged_chain,
+          (merged_chain == previous_chain) ? current_chain : previous_chain,
+          memento);
+      previous_chain = merged_chain;
     } else {
       previous_chain = current_chain = chain_set_.NewestVersion(current_chain);
       chain_set_.AddStoneToChainReversibly(x, y, current_chain, memento);
@@ -605,12 +776,13 @@ WinningCondition PlayerPosition::MakeMoveFast(Cell cell) {
     if (current_chain == 0)
       continue;
     if (previous_chain != 0) {
-      previous_chain = chain_set_.NewestVersion(previous_chain);
       current_chain = chain_set_.NewestVersion(current_chain);
-      ring_db_.MergeChainEdgesFast(
-          previous_chain, current_chain, chain_set_);
-      previous_chain = chain_set_.MergeChainsFast(
+      const ChainNum merged_chain = chain_set_.MergeChainsFast(
           x, y, previous_chain, current_chain);
+      ring_db_.MergeChainEdgesFast(
+          merged_chain,
+          (merged_chain == previous_chain) ? current_chain : previous_chain);
+      previous_chain = merged_chain;
     } else {
       previous_chain = current_chain = chain_set_.NewestVersion(current_chain);
       chain_set_.AddStoneToChainFast(x, y, current_chain);
@@ -805,27 +977,8 @@ void PlayerPosition::RemoveTwoBridgesBeforeOurMoveOrAfterFoeMoveFast(
 }
 
 unsigned PlayerPosition::Get18Neighbors(Cell cell) const {
-  const XCoord x = CellToX(cell);
-  const YCoord y = CellToY(cell);
-  // For a board fragment
-  //    abc
-  //   defg
-  //  hijkl
-  //  mnop
-  //  qrs
-  // the 18 neighbors of j correspond to the bit pattern cbagfedlkihponmsrq.
-  unsigned neighborhood;
-  neighborhood = (stone_mask_.Row(PrevY(PrevY(y))) >> x) & 7;
-  neighborhood = (neighborhood << 4) |
-                 ((stone_mask_.Row(PrevY(y)) >> (x - 1)) & 15);
-  const RowBitmask curr_line = stone_mask_.Row(y);
-  neighborhood = (neighborhood << 2) | ((curr_line >> (x + 1)) & 3);
-  neighborhood = (neighborhood << 2) | ((curr_line >> (x - 2)) & 3);
-  neighborhood = (neighborhood << 4) |
-                 ((stone_mask_.Row(NextY(y)) >> (x - 2)) & 15);
-  neighborhood = (neighborhood << 3) |
-                 ((stone_mask_.Row(NextY(NextY(y))) >> (x - 2)) & 7);
-  return neighborhood;
+  return Get18NeighborsInRows(
+      &stone_mask_.Row(kZeroY), CellToX(cell), CellToY(cell));
 }
 
 bool PlayerPosition::MoveWouldCloseForkOrBridge(
@@ -904,20 +1057,6 @@ int PlayerPosition::GetSizeOfNeighborChains(
   return size_of_neighbor_chains;
 }
 
-void PlayerPosition::UpdateChainsToNewestVersionsReversibly(Memento* memento) {
-  for (Cell cell = kZerothCell; cell < ARRAYSIZE(chains_for_cells_);
-       cell = NextCell(cell)) {
-    ChainNum chain = chain_for_cell(cell);
-    if (chain != 0) {
-      int newest_version = chain_set_.NewestVersion(chain);
-      if (newest_version != chain) {
-        memento->Remember(&chains_for_cells_[cell]);
-        chains_for_cells_[cell] = newest_version;
-      }
-    }
-  }
-}
-
 void PlayerPosition::CopyFrom(const PlayerPosition& other) {
   const int end = other.chain_set_.size();
   chain_set_.ShrinkTo(1);
@@ -964,6 +1103,7 @@ Cell Position::kMoveIndexToCell[kNumMovesOnBoard];
 MoveIndex Position::kConstCellToMoveIndex[kNumCellsWithSentinels];
 MoveIndex Position::kCellToMoveIndex[kNumCellsWithSentinels];
 Cell Position::kCornerToCell[6];
+Hash Position::kConstZobristHash[kNumMovesOnBoard][2];
 Hash Position::kZobristHash[kNumMovesOnBoard][2];
 BoardBitmask Position::kIsCellOnBoardBitmask;
 Chain Position::kEdgeCornerChains[12];
@@ -1086,14 +1226,15 @@ void Position::InitStaticFields() {
   }
 
   srand48(time(NULL));
-  for (MoveIndex mv = kZerothMove; mv < ARRAYSIZE(kZobristHash);
+  for (MoveIndex mv = kZerothMove; mv < ARRAYSIZE(kConstZobristHash);
        mv = NextMove(mv)) {
     // Two consecutive XorShifts would not be linearly independent enough.
     // They cause hash collisions, manifesting in Lajkonik trying to move
     // into already occupied cells.
-    kZobristHash[mv][kWhite] = (1ULL << 32) * mrand48() + mrand48();
-    kZobristHash[mv][kBlack] = (1ULL << 32) * mrand48() + mrand48();
+    kConstZobristHash[mv][kWhite] = (1ULL << 32) * mrand48() + mrand48();
+    kConstZobristHash[mv][kBlack] = (1ULL << 32) * mrand48() + mrand48();
   }
+  memcpy(kZobristHash, kConstZobristHash, sizeof kZobristHash);
 }
 
 Position::~Position() {
@@ -1104,6 +1245,7 @@ Position::~Position() {
 
 void Position::InitToStartPosition() {
   num_available_moves_ = kNumMovesOnBoard;
+  hash_ = 0;
   for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
     for (XCoord x = kZeroX; x < kThirtyTwoX; x = NextX(x)) {
       Cell cell = XYToCell(x, y);
@@ -1114,6 +1256,8 @@ void Position::InitToStartPosition() {
   memcpy(kMoveIndexToCell, kConstMoveIndexToCell, sizeof kMoveIndexToCell);
   assert(sizeof kCellToMoveIndex == sizeof kConstCellToMoveIndex);
   memcpy(kCellToMoveIndex, kConstCellToMoveIndex, sizeof kCellToMoveIndex);
+  assert(sizeof kZobristHash == sizeof kConstZobristHash);
+  memcpy(kZobristHash, kConstZobristHash, sizeof kZobristHash);
   is_initialized_ = true;
 }
 
@@ -1123,6 +1267,7 @@ void Position::CopyFrom(const Position& other) {
   player_positions_[kBlack].CopyFrom(other.player_positions_[kBlack]);
   memcpy(cells_, other.cells_, sizeof cells_);
   num_available_moves_ = other.num_available_moves_;
+  hash_ = other.hash_;
   is_initialized_ = true;
 }
 
@@ -1131,10 +1276,14 @@ void Position::SwapPlayers() {
   tmp_player_position.CopyFrom(player_positions_[kWhite]);
   player_positions_[kWhite].CopyFrom(player_positions_[kBlack]);
   player_positions_[kBlack].CopyFrom(tmp_player_position);
+  hash_ = 0;
   for (Cell cell = kZerothCell; cell < ARRAYSIZE(cells_);
        cell = NextCell(cell)) {
     if (!CellIsEmpty(cell) && (cells_[cell] & 3) != 3) {
       cells_[cell] = 3 - cells_[cell];
+      hash_ = ModifyZobristHash(
+          hash_, static_cast<Player>(cells_[cell] - 1),
+          CellToMoveIndex(cell));
     }
   }
 }
@@ -1155,6 +1304,8 @@ WinningCondition Position::MakeMoveReversibly(
   assert(CellIsEmpty(cell));
   memento->Remember(&cells_[cell]);
   cells_[cell] = player + 1;
+  memento->Remember(&hash_);
+  hash_ = ModifyZobristHash(hash_, player, CellToMoveIndex(cell));
   PlayerPosition& our = player_positions_[player];
   PlayerPosition& foe = player_positions_[Opponent(player)];
   our.RemoveTwoBridgesBeforeOurMoveOrAfterFoeMoveReversibly(cell, memento);
@@ -1169,6 +1320,7 @@ WinningCondition Position::MakeMoveFast(Player player, Cell cell) {
   assert(is_initialized_);
   assert(CellIsEmpty(cell));
   cells_[cell] = player + 1;
+  hash_ = ModifyZobristHash(hash_, player, CellToMoveIndex(cell));
   PlayerPosition& our = player_positions_[player];
   const WinningCondition result = our.MakeMoveFast(cell);
   return result;
@@ -1180,13 +1332,14 @@ WinningCondition Position::MakePermanentMove(Player player, Cell cell) {
   Memento* memento = new Memento;
   memento->Remember(&cells_[cell]);
   cells_[cell] = player + 1;
+  memento->Remember(&hash_);
+  hash_ = ModifyZobristHash(hash_, player, CellToMoveIndex(cell));
   PlayerPosition& our = player_positions_[player];
   PlayerPosition& foe = player_positions_[Opponent(player)];
   our.RemoveTwoBridgesBeforeOurMoveOrAfterFoeMoveReversibly(cell, memento);
   const WinningCondition result = our.MakeMoveReversibly(cell, memento);
   our.CreateTwoBridgesAfterOurMoveReversibly(cell, foe, memento);
   our.FindNewRingFramesReversibly(memento);
-  our.UpdateChainsToNewestVersionsReversibly(memento);
   foe.RemoveTwoBridgesBeforeOurMoveOrAfterFoeMoveReversibly(cell, memento);
   mementoes_.push_back(memento);
   past_moves_.resize(move_count_);
@@ -1196,6 +1349,9 @@ WinningCondition Position::MakePermanentMove(Player player, Cell cell) {
   const MoveIndex move = kCellToMoveIndex[cell];
   std::swap(kCellToMoveIndex[cell], kCellToMoveIndex[swapped_cell]);
   std::swap(kMoveIndexToCell[move], kMoveIndexToCell[num_available_moves_]);
+  for (int i = 0; i < 2; ++i) {
+    std::swap(kZobristHash[move][i], kZobristHash[num_available_moves_][i]);
+  }
   ++move_count_;
   return result;
 }
@@ -1301,6 +1457,292 @@ int Position::GetDistance(Cell cell1, Cell cell2) {
   return (abs(x1 - x2) + abs(y1 - y2) + abs(z1 - z2)) / 2;
 }
 
+//-- PlayoutBoard -----------------------------------------------------
+void PlayoutBoard::InitFromPosition(const Position& position) {
+  assert(position.is_initialized_);
+  // The cells that stand for the chains of each player.
+  short roots[2][kChainNumLimit];
+  memset(roots, 0, sizeof roots);
+  for (int i = 0; i < kNumCellsWithSentinels; ++i) {
+    const Cell cell = static_cast<Cell>(i);
+    cells_[cell] = position.cells_[cell] & 3;
+    parents_[cell] = cell;
+    next_stones_[cell] = cell;
+    num_stones_[cell] = 0;
+    edges_corners_[cell] = 0;
+    if (cells_[cell] != 1 && cells_[cell] != 2)
+      continue;
+    const Player player = static_cast<Player>(cells_[cell] - 1);
+    const PlayerPosition& pp = position.player_position(player);
+    const ChainNum chain = pp.NewestChainForCell(cell);
+    assert(chain != 0);
+    const Cell root = static_cast<Cell>(roots[player][chain]);
+    if (root == 0) {
+      roots[player][chain] = cell;
+      num_stones_[cell] = pp.NthChain(chain)->num_stones();
+      edges_corners_[cell] = pp.EdgesCornersRingForCell(cell) & 0xfff;
+    } else {
+      parents_[cell] = root;
+      next_stones_[cell] = next_stones_[root];
+      next_stones_[root] = cell;
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    const BoardBitmask& stone_mask =
+        position.player_position(static_cast<Player>(i)).stone_mask();
+    for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
+      stone_rows_[i][y] = stone_mask.Row(y);
+    }
+  }
+}
+
+WinningCondition PlayoutBoard::MakeMove(Player player, Cell cell) {
+  assert(cells_[cell] == 0);
+  const XCoord x = CellToX(cell);
+  const YCoord y = CellToY(cell);
+  Cell chains[6];
+  int neighbors[6];
+  const int num_chains = GetNeighborChains(player, cell, chains, neighbors);
+  unsigned edges_corners = Position::GetMaskOfEdgesAndCorners(cell);
+  Cell root = cell;
+  int num_stones = 1;
+  for (int i = 0; i < num_chains; ++i) {
+    const Cell chain = chains[i];
+    const unsigned ring = ClosesAnyRing(chain, x, y, neighbors[i]);
+    if (ring != 0) {
+      int lines[5];
+      GetChainLines(chain, x, y, lines);
+      edges_corners |= ring | ClosesBenzeneRingInLines(lines);
+    }
+    edges_corners |= edges_corners_[chain];
+    num_stones += num_stones_[chain];
+    if (num_stones_[chain] > num_stones_[root])
+      root = chain;
+  }
+  cells_[cell] = player + 1;
+  stone_rows_[player][y] |= (1U << x);
+  // Relabels the stones of the smaller chains and splices the lists.
+  for (int i = 0; i < num_chains; ++i) {
+    const Cell chain = chains[i];
+    if (chain == root)
+      continue;
+    Cell stone = chain;
+    do {
+      parents_[stone] = root;
+      stone = static_cast<Cell>(next_stones_[stone]);
+    } while (stone != chain);
+    std::swap(next_stones_[root], next_stones_[chain]);
+  }
+  parents_[cell] = root;
+  if (root != cell) {
+    next_stones_[cell] = next_stones_[root];
+    next_stones_[root] = cell;
+  }
+  num_stones_[root] = num_stones;
+  edges_corners_[root] = edges_corners & 0xfff;
+  return static_cast<WinningCondition>(
+      kFork * (CountSetBits(edges_corners) >= 3) +
+      kBridge * (CountSetBits(edges_corners >> 6) >= 2) +
+      ((edges_corners >> 12) & 3));
+}
+
+unsigned PlayoutBoard::Get6Neighbors(Player player, Cell cell) const {
+  return Get6NeighborsInRows(stone_rows_[player], CellToX(cell), CellToY(cell));
+}
+
+unsigned long long PlayoutBoard::Get18Neighbors(
+    Player player, Cell cell) const {
+  const XCoord x = CellToX(cell);
+  const YCoord y = CellToY(cell);
+  return (Position::kEdgesCornersNeighbors[cell] >> 28) |
+         (static_cast<unsigned long long>(Get18NeighborsInRows(
+             stone_rows_[Opponent(player)], x, y)) << 18) |
+         Get18NeighborsInRows(stone_rows_[player], x, y);
+}
+
+bool PlayoutBoard::MoveIsWinning(Player player, Cell cell, int neighborhood,
+                                 Cell injected_chain) const {
+  assert(cells_[cell] == 0);
+  unsigned edges_corners = Position::GetMaskOfEdgesAndCorners(cell);
+  const int neighbor_groups =
+      Position::CountNeighborGroupsWithPossibleBenzeneRings(neighborhood);
+  if (neighbor_groups < 2 && (neighbor_groups == 0 || edges_corners == 0))
+    return false;
+  if (injected_chain != 0)
+    edges_corners |= EdgesCornersForCell(injected_chain);
+  Cell chains[6];
+  int neighbors[6];
+  const int num_chains = GetNeighborChains(player, cell, chains, neighbors);
+  for (int i = 0; i < num_chains; ++i) {
+    if (neighbor_groups >= 2 &&
+        ClosesAnyRing(chains[i], CellToX(cell), CellToY(cell), neighbors[i])) {
+      return true;
+    }
+    edges_corners |= edges_corners_[chains[i]];
+  }
+  return CountSetBits(edges_corners) >= 3 ||
+         CountSetBits(edges_corners >> 6) >= 2;
+}
+
+int PlayoutBoard::GetSizeOfNeighborChains(
+    Player player, Cell cell, int num_neighbors) const {
+  assert(num_neighbors % 6 == 0);
+  assert(num_neighbors >= 0);
+  assert(num_neighbors <= 18);
+  int num_neighbor_chains = 0;
+  Cell chain_set[18];
+  int size_of_neighbor_chains = 0;
+  for (int i = 0; i < num_neighbors; ++i) {
+    const Cell neighbor = NthNeighbor(cell, i);
+    if (cells_[neighbor] != player + 1)
+      continue;
+    const Cell chain = ChainForCell(neighbor);
+    int j = 0;
+    while (j < num_neighbor_chains && chain_set[j] != chain) {
+      ++j;
+    }
+    if (j == num_neighbor_chains) {
+      chain_set[num_neighbor_chains++] = chain;
+      size_of_neighbor_chains += num_stones_[chain];
+    }
+  }
+  return size_of_neighbor_chains;
+}
+
+void PlayoutBoard::GetChainRows(
+    Cell chain, RowBitmask chain_rows[kBoardHeight]) const {
+  assert(parents_[chain] == chain);
+  for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
+    chain_rows[y] = 0;
+  }
+  Cell stone = chain;
+  do {
+    chain_rows[CellToY(stone)] |= (1U << CellToX(stone));
+    stone = static_cast<Cell>(next_stones_[stone]);
+  } while (stone != chain);
+}
+
+int PlayoutBoard::FindFirstWinningMove(
+    Player player, const Cell moves[], int num_moves,
+    WinningCondition* victory) const {
+  const BoardBitmask& board = Position::GetBoardBitmask();
+  RowBitmask border[kBoardHeight];
+  for (YCoord y = kZeroY; y < kBoardHeight; y = NextY(y)) {
+    border[y] = 0;
+  }
+  for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+    const RowBitmask prev = board.Row(PrevY(y));
+    const RowBitmask curr = board.Row(y);
+    const RowBitmask next = board.Row(NextY(y));
+    border[y] = curr & ~((curr << 1) & (curr >> 1) & prev & (prev >> 1) &
+                         next & (next << 1));
+  }
+  // The stones after the first lower moves, which win for nobody.
+  // The first upper moves win for somebody, unless upper > num_moves.
+  RowBitmask lower_rows[2][kBoardHeight];
+  RowBitmask rows[2][kBoardHeight];
+  memcpy(lower_rows, stone_rows_, sizeof lower_rows);
+  WinningCondition conditions[2] = {
+    kNoWinningCondition, kNoWinningCondition
+  };
+  int lower = 0;
+  int upper = num_moves + 1;
+  while (upper - lower > 1) {
+    const int middle = lower + (upper - lower) / 2;
+    memcpy(rows, lower_rows, sizeof rows);
+    for (int i = lower; i < middle; ++i) {
+      const Player mover = (i % 2 == 0) ? player : Opponent(player);
+      assert(cells_[moves[i]] == 0);
+      rows[mover][CellToY(moves[i])] |= (1U << CellToX(moves[i]));
+    }
+    const WinningCondition white_victory =
+        GetWinningConditionInRows(rows[kWhite], border);
+    const WinningCondition black_victory =
+        GetWinningConditionInRows(rows[kBlack], border);
+    if (white_victory != kNoWinningCondition ||
+        black_victory != kNoWinningCondition) {
+      conditions[kWhite] = white_victory;
+      conditions[kBlack] = black_victory;
+      upper = middle;
+    } else {
+      memcpy(lower_rows, rows, sizeof lower_rows);
+      lower = middle;
+    }
+  }
+  if (upper > num_moves) {
+    *victory = kNoWinningCondition;
+    return num_moves;
+  }
+  // Nobody won before the last move, so its maker is the winner.
+  const int winning_move = upper - 1;
+  *victory = conditions[
+      (winning_move % 2 == 0) ? player : Opponent(player)];
+  assert(*victory != kNoWinningCondition);
+  return winning_move;
+}
+
+unsigned PlayoutBoard::ClosesAnyRing(
+    Cell chain, XCoord x, YCoord y, int neighbors) const {
+  // The lines and bits of the NthNeighbor() cells in GetChainLines().
+  static const int kLine[6] = { 2, 1, 1, 2, 3, 3 };
+  static const int kBit[6] = { 1, 2, 3, 3, 2, 1 };
+  // One stone of the chain next to the cell cannot close a ring.
+  if ((neighbors & (neighbors - 1)) == 0)
+    return 0;
+  int lines[5] = { 0, 0, 0, 0, 0 };
+  for (int i = 0; i < 6; ++i) {
+    if (neighbors & (1 << i))
+      lines[kLine[i]] |= (1 << kBit[i]);
+  }
+  const unsigned char mask = GetRingTests(lines);
+  if (mask == 0)
+    return 0;
+  if (mask == 64)
+    return (1 << 12);
+  GetChainLines(chain, x, y, lines);
+  return PassesRingTests(mask, lines);
+}
+
+void PlayoutBoard::GetChainLines(
+    Cell chain, XCoord x, YCoord y, int lines[5]) const {
+  // The cells of the 5x5 square that lie at most two cells
+  // away from (x, y) on the hexagonal board.
+  static const int kFirstBit[5] = { 2, 1, 0, 0, 0 };
+  static const int kPastBit[5] = { 5, 5, 5, 4, 3 };
+  const unsigned char color = cells_[chain];
+  for (int i = 0; i < 5; ++i) {
+    lines[i] = 0;
+    const YCoord yy = static_cast<YCoord>(y - 2 + i);
+    for (int b = kFirstBit[i]; b < kPastBit[i]; ++b) {
+      const Cell cell = XYToCell(static_cast<XCoord>(x - 2 + b), yy);
+      if (cells_[cell] == color && ChainForCell(cell) == chain)
+        lines[i] |= (1 << b);
+    }
+  }
+}
+
+int PlayoutBoard::GetNeighborChains(
+    Player player, Cell cell, Cell chains[6], int neighbors[6]) const {
+  int num_chains = 0;
+  for (int i = 0; i < 6; ++i) {
+    const Cell neighbor = NthNeighbor(cell, i);
+    if (cells_[neighbor] != player + 1)
+      continue;
+    const Cell chain = ChainForCell(neighbor);
+    int j = 0;
+    while (j < num_chains && chains[j] != chain) {
+      ++j;
+    }
+    if (j == num_chains) {
+      chains[num_chains] = chain;
+      neighbors[num_chains] = 0;
+      ++num_chains;
+    }
+    neighbors[j] |= (1 << i);
+  }
+  return num_chains;
+}
+
 //-- Memento ----------------------------------------------------------
 void Memento::UndoAll() {
   for (std::vector<std::pair<unsigned*, unsigned> >::reverse_iterator rit =
@@ -1509,39 +1951,24 @@ void RingDB::RemoveOneWayTwoBridgesFast(
 }
 
 void RingDB::MergeChainEdgesReversibly(
-    ChainNum chain0, ChainNum chain1, const ChainSet& chain_set,
-    Memento* memento) {
-  assert(chain0 == chain_set.NewestVersion(chain0));
-  assert(chain1 == chain_set.NewestVersion(chain1));
+    ChainNum chain0, ChainNum chain1, Memento* memento) {
   if (chain0 == chain1)
     return;
   seen_two_bridges_.clear();
-  ChainNum new_chain = chain_set.size();
-  // List[new_chain] = List[chain0]
-  const unsigned first = chain_graph_ + new_chain;
   unsigned prev = chain_graph_ + chain0;
   unsigned curr = arena_.get(prev);
-  if (curr != 0) {
-    memento->Remember(&arena_.get(first));
-    arena_.set(first, curr);
-    do {
-      const unsigned ch = arena_.get(curr + kCgChain);
-      const unsigned c0 = arena_.get(curr + kCgCell0);
-      const unsigned c1 = arena_.get(curr + kCgCell1);
-      const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
-      seen_two_bridges_.insert(two_bridge);
-      if (ch == chain0 || ch == chain1) {
-        memento->Remember(&arena_.get(curr + kCgChain));
-        arena_.set(curr + kCgChain, new_chain);
-      }
-      // List[curr.chain].replace(chain0, new_chain)
-      ReplaceChainInGraphReversibly(
-          ch, chain0, new_chain, memento);
-      prev = curr;
-      curr = arena_.get(prev);
-    } while (curr != 0);
-  } else {
-    prev = first;
+  while (curr != 0) {
+    const unsigned ch = arena_.get(curr + kCgChain);
+    const unsigned c0 = arena_.get(curr + kCgCell0);
+    const unsigned c1 = arena_.get(curr + kCgCell1);
+    const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
+    seen_two_bridges_.insert(two_bridge);
+    if (ch == chain1) {
+      memento->Remember(&arena_.get(curr + kCgChain));
+      arena_.set(curr + kCgChain, chain0);
+    }
+    prev = curr;
+    curr = arena_.get(prev);
   }
   // List[chain0] += List[chain1]
   memento->Remember(&arena_.get(prev));
@@ -1553,13 +1980,12 @@ void RingDB::MergeChainEdgesReversibly(
     const unsigned c1 = arena_.get(curr + kCgCell1);
     const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
     if (seen_two_bridges_.find(two_bridge) == seen_two_bridges_.end()) {
-      if (ch == chain0 || ch == chain1) {
+      if (ch == chain1) {
         memento->Remember(&arena_.get(curr + kCgChain));
-        arena_.set(curr + kCgChain, new_chain);
+        arena_.set(curr + kCgChain, chain0);
       }
-      // List[curr.chain].replace(chain1, new_chain)
-      ReplaceChainInGraphReversibly(
-          ch, chain1, new_chain, memento);
+      // List[curr.chain].replace(chain1, chain0)
+      ReplaceChainInGraphReversibly(ch, chain1, chain0, memento);
       prev = curr;
       curr = arena_.get(prev);
     } else {
@@ -1571,36 +1997,23 @@ void RingDB::MergeChainEdgesReversibly(
   changed_ = true;
 }
 
-void RingDB::MergeChainEdgesFast(
-    ChainNum chain0, ChainNum chain1, const ChainSet& chain_set) {
-  assert(chain0 == chain_set.NewestVersion(chain0));
-  assert(chain1 == chain_set.NewestVersion(chain1));
+void RingDB::MergeChainEdgesFast(ChainNum chain0, ChainNum chain1) {
   if (chain0 == chain1)
     return;
   seen_two_bridges_.clear();
-  ChainNum new_chain = chain_set.size();
-  // List[new_chain] = List[chain0]
-  const unsigned first = chain_graph_ + new_chain;
   unsigned prev = chain_graph_ + chain0;
   unsigned curr = arena_.get(prev);
-  if (curr != 0) {
-    arena_.set(first, curr);
-    do {
-      const unsigned ch = arena_.get(curr + kCgChain);
-      const unsigned c0 = arena_.get(curr + kCgCell0);
-      const unsigned c1 = arena_.get(curr + kCgCell1);
-      const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
-      seen_two_bridges_.insert(two_bridge);
-      if (ch == chain0 || ch == chain1) {
-        arena_.set(curr + kCgChain, new_chain);
-      }
-      // List[curr.chain].replace(chain0, new_chain)
-      ReplaceChainInGraphFast(ch, chain0, new_chain);
-      prev = curr;
-      curr = arena_.get(prev);
-    } while (curr != 0);
-  } else {
-    prev = first;
+  while (curr != 0) {
+    const unsigned ch = arena_.get(curr + kCgChain);
+    const unsigned c0 = arena_.get(curr + kCgCell0);
+    const unsigned c1 = arena_.get(curr + kCgCell1);
+    const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
+    seen_two_bridges_.insert(two_bridge);
+    if (ch == chain1) {
+      arena_.set(curr + kCgChain, chain0);
+    }
+    prev = curr;
+    curr = arena_.get(prev);
   }
   // List[chain0] += List[chain1]
   curr = arena_.get(chain_graph_ + chain1);
@@ -1611,11 +2024,11 @@ void RingDB::MergeChainEdgesFast(
     const unsigned c1 = arena_.get(curr + kCgCell1);
     const std::pair<unsigned, unsigned> two_bridge = std::make_pair(c0, c1);
     if (seen_two_bridges_.find(two_bridge) == seen_two_bridges_.end()) {
-      if (ch == chain0 || ch == chain1) {
-        arena_.set(curr + kCgChain, new_chain);
+      if (ch == chain1) {
+        arena_.set(curr + kCgChain, chain0);
       }
-      // List[curr.chain].replace(chain1, new_chain)
-      ReplaceChainInGraphFast(ch, chain1, new_chain);
+      // List[curr.chain].replace(chain1, chain0)
+      ReplaceChainInGraphFast(ch, chain1, chain0);
       prev = curr;
       curr = arena_.get(prev);
     } else {
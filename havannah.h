@@ -329,11 +329,12 @@ class Chain : public PrintableBoard {
   // Adds a stone in the cell at coordinates (x, y) to this Chain.
   void AddStoneReversibly(XCoord x, YCoord y, Memento* memento);
   void AddStoneFast(XCoord x, YCoord y);
-  // Initializes the fields of result to the cellwise union of this Chain with
-  // the other Chain. Assumes that the stone in the cell at coordinates (x, y)
-  // has been added to this Chain and is not present in the other Chain.
-  void ComputeUnion(
-      XCoord x, YCoord y, const Chain& other, Chain* result) const;
+  // Adds the stones of the other Chain to this Chain. Assumes that
+  // the stone in the cell at coordinates (x, y) has been added to
+  // exactly one of the two Chains.
+  void AbsorbReversibly(
+      XCoord x, YCoord y, const Chain& other, Memento* memento);
+  void AbsorbFast(XCoord x, YCoord y, const Chain& other);
   // Initializes the fields of this Chain to store a single stone in the cell
   // at coordinates (x, y).
   void InitWithStone(XCoord x, YCoord y);
@@ -370,6 +371,8 @@ class Chain : public PrintableBoard {
   // Returns the ring bits for a stone put in the cell at coordinates (x, y).
   // They are (1 << 12) for any ring and (1 << 13) for a benzene ring.
   unsigned GetRingMask(XCoord x, YCoord y) const;
+  // Sets lines[i] to NthRow(y - 2 + i) shifted right by x - 2.
+  void GetLines(XCoord x, YCoord y, int lines[5]) const;
   // Returns 'x' if this Chain contains a stone in the cell at coordinates
   // (x, y) or '.' if it does not.
   virtual char GetCharForCell(XCoord x, YCoord y) const {
@@ -388,10 +391,10 @@ class Chain : public PrintableBoard {
   // it tells if this Chain contains a benzene ring. The 16th bit and above
   // are garbage.
   unsigned edges_corners_ring_;
-  // The index of the Chain that supersedes this Chain or zero if none does.
-  // Such a linked list of chains where only one head is updated on a union
-  // operation seems faster than a full-blown disjoint set with reversible
-  // unions from
+  // The index of the Chain that absorbed this Chain or zero if none did.
+  // Together they form a disjoint set forest with union by size and
+  // without path compression, so that Memento can undo each union by
+  // restoring a handful of words. See also
   // S. Conchon, J.-C. Filliâtre: A Persistent Union-Find Structure,
   // http://www.lri.fr/~filliatr/publis/puf-wml07.ps
   ChainNum newer_version_;
@@ -436,14 +439,16 @@ class ChainSet {
       XCoord x, YCoord y, ChainNum chain, Memento* memento);
   void AddStoneToChainFast(XCoord x, YCoord y, ChainNum chain);
   // Merges chain1 with chain2, provided that a stone at coordinates (x, y)
-  // has been added to chain1. Returns the index of the resulting Chain.
+  // has been added to chain1. The Chain with more stones absorbs the other
+  // one in place. Returns the index of the absorbing Chain.
   ChainNum MergeChainsReversibly(
       XCoord x, YCoord y, ChainNum chain1, ChainNum chain2, Memento* memento);
   ChainNum MergeChainsFast(XCoord x, YCoord y, ChainNum chain1, ChainNum chain2);
   // Appends to chains_[] a new Chain consisting of one stone
   // in the cell at coordinates (x, y). Returns the index of the new Chain.
   ChainNum MakeOneStoneChain(XCoord x, YCoord y);
-  // Returns the index of the Chain that supersedes chains_[ch].
+  // Returns the index of the root of the tree that contains chains_[ch].
+  // Union by size keeps the path to the root O(log(number of stones)) long.
   ChainNum NewestVersion(ChainNum ch) const;
   //
   int CountChains() const;
@@ -568,13 +573,12 @@ class RingDB {
   void RemoveHalfBridgeFast(
     Cell cell, ChainNum chain0, ChainNum chain1);
 
-  // Merges the edges of chain0 and chain1 into new_chain.
+  // Merges the edges of chain1 into the edges of chain0, provided that
+  // chain0 is the newest version of both chains in the ChainSet.
   // Time complexity: O(N**2).
   void MergeChainEdgesReversibly(
-      ChainNum chain0, ChainNum chain1, const ChainSet& chain_set,
-      Memento* memento);
-  void MergeChainEdgesFast(
-      ChainNum chain0, ChainNum chain1, const ChainSet& chain_set);
+      ChainNum chain0, ChainNum chain1, Memento* memento);
+  void MergeChainEdgesFast(ChainNum chain0, ChainNum chain1);
 
   // Finds new cycles in the graph.
   // Time complexity: O((v + e)*(c + 1)) for v vertices, e edges, c cycles.
@@ -647,7 +651,7 @@ class RingDB {
   unsigned ring_frames_top_;
   // For each MoveIndex, a list of (next, ring_frame_index).
   unsigned ring_frames_through_cells_;
-  // Do we have to find cycles passing through the largest ChainNum?
+  // Do we have to find cycles passing through the modified chain?
   bool changed_;
 
   // Used in MergeChainEdges...().
@@ -728,10 +732,6 @@ class PlayerPosition : public PrintableBoard {
                                       ChainNum injected_chain) const;
   // TODO.                       
   int GetSizeOfNeighborChains(Cell cell, int num_neighbors) const;
-  // Replaces Chains in chain_set_ with their newest versions.
-  // This accelerates future calls to MakeMove...().
-  // Should be called if the move just made is permanent.
-  void UpdateChainsToNewestVersionsReversibly(Memento* memento);
   // Clones the other PlayerPosition to this PlayerPosition.
   void CopyFrom(const PlayerPosition& other);
   // TODO(mciura): Refactor the methods below.
@@ -847,6 +847,8 @@ class Position : public PrintableBoard {
   unsigned char GetCell(Cell cell) const { return cells_[cell]; }
   // Getter for num_available_moves_.
   MoveIndex NumAvailableMoves() const { return num_available_moves_; }
+  // Getter for hash_.
+  Hash hash() const { return hash_; }
   // Returns the move counter.
   int MoveCount() const { return kNumMovesOnBoard - NumAvailableMoves(); }
   // Returns true if the cell is empty.
@@ -946,6 +948,9 @@ class Position : public PrintableBoard {
   int move_count_;
   // Divides move_index_to_cell_ into random and historical parts.
   MoveIndex num_available_moves_;
+  // The Zobrist hash of all stones on the board. It does not depend
+  // on the order of moves, so it identifies positions across searches.
+  Hash hash_;
   // True if the Position has been properly initialized.
   bool is_initialized_;
 
@@ -976,6 +981,9 @@ class Position : public PrintableBoard {
   // Maps corner indices to their cell indices.
   static Cell kCornerToCell[6];
   // Random 64-bit numbers, used for computing fingerprints of positions.
+  // The rows of kZobristHash are permuted together with kMoveIndexToCell,
+  // so that the fingerprint of a stone depends only on its cell.
+  static Hash kConstZobristHash[kNumMovesOnBoard][2];
   static Hash kZobristHash[kNumMovesOnBoard][2];
   // The xth bit of kIsCellOnBoardBitmask.Row(y) is set if cell (x, y)
   // lies on the board.
@@ -989,10 +997,104 @@ class Position : public PrintableBoard {
   // Chains that mask six edges and six corners of the board.
   static Chain kEdgeCornerChains[12];
 
+  friend class PlayoutBoard;
+
   Position(const Position&);
   void operator=(const Position&);
 };
 
+// The board of playouts. Unlike Position, it cannot undo moves and does
+// not keep two-bridges and ring frames, but all its state lies in plain
+// arrays, so that CopyFrom() is a single memcpy(). The chains form
+// a disjoint-set forest over cells. Each stone points directly to the
+// root of its chain, which holds the size, edges, and corners of the
+// chain; merging chains relabels the stones of the smaller ones.
+class PlayoutBoard {
+ public:
+  PlayoutBoard() {}
+  ~PlayoutBoard() {}
+
+  // Sets this to the stones of position.
+  void InitFromPosition(const Position& position);
+  // Copies other to this PlayoutBoard.
+  void CopyFrom(const PlayoutBoard& other) {
+    memcpy(this, &other, sizeof *this);
+  }
+  // Puts player's stone in the cell. Returns the same WinningCondition
+  // as Position::MakeMoveFast() would.
+  WinningCondition MakeMove(Player player, Cell cell);
+  // The counterparts of the Position methods with the same names.
+  // Chains are identified by the cells of their roots.
+  bool CellIsEmpty(Cell cell) const { return cells_[cell] == 0; }
+  unsigned char GetCell(Cell cell) const { return cells_[cell]; }
+  unsigned Get6Neighbors(Player player, Cell cell) const;
+  unsigned long long Get18Neighbors(Player player, Cell cell) const;
+  bool MoveIsWinning(Player player, Cell cell, int neighborhood,
+                     Cell injected_chain) const;
+  int GetSizeOfNeighborChains(
+      Player player, Cell cell, int num_neighbors) const;
+  // Returns the root of the chain of the stone in the cell.
+  Cell ChainForCell(Cell cell) const {
+    assert(cells_[cell] == 1 || cells_[cell] == 2);
+    assert(parents_[parents_[cell]] == parents_[cell]);
+    return static_cast<Cell>(parents_[cell]);
+  }
+  // Returns the mask of edges and corners of the chain of the stone
+  // in the cell.
+  unsigned EdgesCornersForCell(Cell cell) const {
+    return edges_corners_[ChainForCell(cell)];
+  }
+  // Sets chain_rows[y] to the stones of the chain in row y.
+  void GetChainRows(Cell chain, RowBitmask chain_rows[kBoardHeight]) const;
+  // Returns the index of the first of the moves that wins if player
+  // and the opponent make them in turns, starting from this board,
+  // on which nobody may have won yet. Sets *victory to its winning
+  // condition, without telling benzene rings from other rings.
+  // Returns num_moves and sets *victory to kNoWinningCondition if no
+  // move wins. Does not make any moves: it searches in halves for the
+  // shortest winning prefix of the moves, filling the regions
+  // of bitmask rows to find the rings and the chains that touch
+  // the edges and corners.
+  int FindFirstWinningMove(Player player, const Cell moves[], int num_moves,
+                           WinningCondition* victory) const;
+  // Returns the rows of player's stones.
+  const RowBitmask* stone_rows(Player player) const {
+    return stone_rows_[player];
+  }
+
+ private:
+  // Returns (1 << 12) if a stone put at (x, y) closes a ring of the chain,
+  // 0 otherwise. The ith bit of neighbors is set if NthNeighbor(cell, i)
+  // belongs to the chain. Visits the farther cells only when needed.
+  unsigned ClosesAnyRing(
+      Cell chain, XCoord x, YCoord y, int neighbors) const;
+  // Returns the bit pattern of the stones of the chain in the 5x5 square
+  // centered at (x, y), with row y - 2 in lines[0].
+  void GetChainLines(Cell chain, XCoord x, YCoord y, int lines[5]) const;
+  // Returns the number of distinct chains of player that neighbor
+  // the cell. Sets chains[] to them and neighbors[] to the masks
+  // of the NthNeighbor() cells that belong to each of them.
+  int GetNeighborChains(Player player, Cell cell,
+                        Cell chains[6], int neighbors[6]) const;
+
+  // As in Position: 0 when the cell is empty, 1 or 2 when it is
+  // occupied by a white or black stone, 3 when it lies outside the board.
+  unsigned char cells_[kNumCellsWithSentinels];
+  // The root of the chain of each stone.
+  short parents_[kNumCellsWithSentinels];
+  // The next stone of the same chain in a circular list.
+  short next_stones_[kNumCellsWithSentinels];
+  // Valid only for the roots.
+  short num_stones_[kNumCellsWithSentinels];
+  unsigned short edges_corners_[kNumCellsWithSentinels];
+  // The xth bit of stone_rows_[player][y] is set if player has a stone
+  // in the cell at coordinates (x, y).
+  RowBitmask stone_rows_[2][kBoardHeight];
+
+  PlayoutBoard(const PlayoutBoard&);
+  void operator=(const PlayoutBoard&);
+};
+
 // IV. AUXILIARIES
 
 // Classes ChainAllocator, Arena, and RingDB should also belong here.
@@ -1019,6 +1121,11 @@ class Memento {
       Remember(reinterpret_cast<unsigned*>(tmp));
     }
   }
+  void Remember(Hash* pointer) {
+    unsigned* words = reinterpret_cast<unsigned*>(pointer);
+    Remember(&words[0]);
+    Remember(&words[1]);
+  }
   // Remembers the size of a ChainSet.
   void RememberSize(ChainSet* chain_set) {
     sizes_.push_back(std::make_pair(chain_set, chain_set->size()));
@@ -1041,25 +1148,33 @@ class Memento {
 // We use a macro instead of a template because functors are unwieldy.
 #define RepeatForCellsAdjacentToChain(\
     position, player, current_chain, function) \
+  RepeatForCellsAdjacentToRows(\
+      &(position).player_position(player).\
+          ChainMaskForChain(current_chain).Row(kZeroY),\
+      &(position).player_position(Opponent(player)).stone_mask().Row(kZeroY),\
+      player, current_chain, function)
+
+// The same for a chain whose stones are given by chain_rows[y]
+// and opponent's stones by opponent_rows[y].
+#define RepeatForCellsAdjacentToRows(\
+    chain_rows, opponent_rows, player, current_chain, function) \
 do {\
   assert(current_chain != 0);\
-  const BoardBitmask& chain_mask =\
-      (position).player_position(player).ChainMaskForChain(current_chain);\
-  const BoardBitmask& opponent_stones =\
-      (position).player_position(Opponent(player)).stone_mask();\
+  const RowBitmask* chain_mask = (chain_rows);\
+  const RowBitmask* opponent_stones = (opponent_rows);\
   RowBitmask prev = 0;\
-  RowBitmask curr = chain_mask.Row(kGapAround);\
-  RowBitmask next = chain_mask.Row(NextY(kGapAround));\
+  RowBitmask curr = chain_mask[kGapAround];\
+  RowBitmask next = chain_mask[NextY(kGapAround)];\
   RowBitmask mask[kBoardHeight];\
   for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {\
     RowBitmask current_mask =\
         prev | next | ((prev | curr) >> 1) | ((curr | next) << 1);\
-    current_mask &= ~(curr | (opponent_stones).Row(y));\
+    current_mask &= ~(curr | opponent_stones[y]);\
     current_mask &= Position::GetBoardBitmask().Row(y);\
     mask[y] = current_mask;\
     prev = curr;\
     curr = next;\
-    next = chain_mask.Row(NextY(NextY(y)));\
+    next = chain_mask[NextY(NextY(y))];\
   }\
   for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {\
     RowBitmask tmp_mask = mask[y];\
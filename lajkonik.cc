@@ -26,7 +26,10 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -34,6 +37,7 @@
 #include "readline/readline.h"
 
 #include "base.h"
+#include "cluster.h"
 #include "controller.h"
 #include "define-playout-patterns.h"
 #include "frontend.h"
@@ -245,7 +249,23 @@ char* GetLine() {
 
 }  // namespace
 
-int main() {
+int main(int argc, char** argv) {
+  // With --listen PORT, serves GTP to a coordinator that connects
+  // to the port instead of to stdin and stdout.
+  if (argc == 3 && strcmp(argv[1], "--listen") == 0) {
+    const int connection = lajkonik::AcceptCoordinator(atoi(argv[2]));
+    if (connection < 0 ||
+        dup2(connection, STDIN_FILENO) < 0 ||
+        dup2(connection, STDOUT_FILENO) < 0) {
+      fprintf(stderr, "Cannot talk to a coordinator\n");
+      exit(EXIT_FAILURE);
+    }
+    close(connection);
+  } else if (argc != 1) {
+    fprintf(stderr, "Usage: %s [--listen PORT]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
   lajkonik::PlayoutOptions playout_options;
 
   playout_options.initial_chance_of_ring_notice = 150.0;
@@ -255,6 +275,7 @@ int main() {
   playout_options.chance_of_connection_defense_intercept = 42.0;
   playout_options.chance_of_connection_defense_slope = -28.0;
   playout_options.retries_of_isolated_moves = 1;
+  playout_options.moves_before_filling_board = -1;
   playout_options.use_havannah_mate = true;
   playout_options.use_havannah_antimate = true;
   playout_options.use_ring_detection = true;
@@ -277,6 +298,8 @@ int main() {
   mcts_options.tricky_epsilon = 0.02;
   mcts_options.locality_bias = 1.0;
   mcts_options.chain_size_bias_factor = 0.0;
+  mcts_options.widening_factor = 4.0;
+  mcts_options.widening_base = 0;
   mcts_options.rave_update_depth = 1000;
   mcts_options.expand_after_n_playouts = 160;
   mcts_options.play_n_playouts_at_once = 1;
@@ -284,6 +307,11 @@ int main() {
   mcts_options.prior_num_simulations_range = 7;
   mcts_options.prior_reward_halfrange = 5;
   mcts_options.neighborhood_size = 2;
+  // Half of the physical memory but no more than 2 GB.
+  mcts_options.tt_size_mb =
+      std::min(2048, lajkonik::GetPhysicalMemoryInMegabytes() / 2);
+  mcts_options.solver_empty_cells = 16;
+  mcts_options.solver_node_limit = 10000;
   mcts_options.exploration_strategy = lajkonik::kSilverWithProgressiveBias;
   mcts_options.use_rave_randomization = false;
   mcts_options.use_mate_in_tree = true;
@@ -301,6 +329,13 @@ int main() {
 
   lajkonik::ControllerOptions controller_options;
   controller_options.seconds_per_move = 30;  // 40 * lajkonik::SIDE_LENGTH;
+  controller_options.time_safety_margin_ms = 100;
+  controller_options.playout_budget = 0;
+  controller_options.node_budget = 0;
+  controller_options.random_seed = 0;
+  controller_options.num_threads = NUM_THREADS;
+  controller_options.first_core = -1;
+  controller_options.playout_threads = 0;
   controller_options.sole_nonlosing_move_win_ratio_threshold = 0.2;
   controller_options.win_ratio_threshold = 0.6;
   controller_options.use_swap = false;
@@ -308,6 +343,9 @@ int main() {
   controller_options.end_games_quickly = false;
   controller_options.print_debug_info = true;
   controller_options.clear_tt_after_move = false;  // TODO: change.
+  controller_options.reuse_search_tree = true;
+  controller_options.stop_when_decided = true;
+  controller_options.ponder = false;
   lajkonik::Controller controller(controller_options, mcts_engines);
 
   lajkonik::Player player = lajkonik::kWhite;
@@ -0,0 +1,125 @@
+#ifndef LFQUEUE_H_
+#define LFQUEUE_H_
+
+// Copyright (c) 2010-2012 Marcin Ciura, Piotr Wieczorek
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Definition of the LockFreeQueue class: a bounded multi-producer
+// multi-consumer queue after Dmitry Vyukov. Every slot carries
+// a sequence number that tells pushers and poppers whose turn it is,
+// so that they contend only on the two positions.
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "wfhashmap.h"
+
+namespace lajkonik {
+
+template<typename T>
+class LockFreeQueue {
+ public:
+  // The capacity must be a power of two.
+  explicit LockFreeQueue(int capacity)
+      : slots_(new Slot[capacity]),
+        mask_(capacity - 1),
+        push_position_(0),
+        pop_position_(0) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    for (int i = 0; i < capacity; ++i) {
+      slots_[i].sequence = i;
+    }
+  }
+  ~LockFreeQueue() { delete[] slots_; }
+
+  // Returns false if the queue is full.
+  bool Push(const T& value) {
+    unsigned position = push_position_;
+    while (true) {
+      Slot* slot = &slots_[position & mask_];
+      const int difference = static_cast<int>(slot->sequence - position);
+      if (difference == 0) {
+        const unsigned old_position =
+            AtomicCompareAndSwap(const_cast<unsigned*>(&push_position_),
+                                 position, position + 1);
+        if (old_position == position) {
+          slot->value = value;
+          __sync_synchronize();
+          slot->sequence = position + 1;
+          return true;
+        }
+        position = old_position;
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = push_position_;
+      }
+    }
+  }
+
+  // Returns false if the queue is empty.
+  bool Pop(T* value) {
+    unsigned position = pop_position_;
+    while (true) {
+      Slot* slot = &slots_[position & mask_];
+      const int difference =
+          static_cast<int>(slot->sequence - (position + 1));
+      if (difference == 0) {
+        const unsigned old_position =
+            AtomicCompareAndSwap(const_cast<unsigned*>(&pop_position_),
+                                 position, position + 1);
+        if (old_position == position) {
+          *value = slot->value;
+          __sync_synchronize();
+          slot->sequence = position + mask_ + 1;
+          return true;
+        }
+        position = old_position;
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = pop_position_;
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    volatile unsigned sequence;
+    T value;
+  };
+
+  Slot* slots_;
+  const unsigned mask_;
+  // Pushers and poppers touch different cache lines.
+  volatile unsigned push_position_;
+  char padding_[64];
+  volatile unsigned pop_position_;
+
+  LockFreeQueue(const LockFreeQueue&);
+  void operator=(const LockFreeQueue&);
+};
+
+}  // namespace lajkonik
+
+#endif  // LFQUEUE_H_
@@ -30,9 +30,16 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sched.h>
+#include <time.h>
 #include <algorithm>
 #include <set>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif  // defined(__AVX__) || defined(__SSE2__)
 
+#include "dfpn.h"
+#include "lfqueue.h"
 #include "playout.h"
 #include "rng.h"
 #include "wfhashmap.h"
@@ -40,8 +47,6 @@
 namespace lajkonik {
 namespace {
 
-const Hash kRootHash = 0;
-
 // TODO(mciura)
 int WonInNPlies(int n) { return -0x100 * n + INT_MAX - 0x80; }
 int LostInNPlies(int n) { return 0x100 * n - INT_MAX + 0x80; }
@@ -50,83 +55,363 @@ int LostInNPlies(int n) { return 0x100 * n - INT_MAX + 0x80; }
 int VictoryToPlies(int result) { return (INT_MAX - result) / 0x100; }
 int DefeatToPlies(int result) { return (INT_MAX + result) / 0x100; }
 
+// Translates the reward of a kid into the reward of its parent.
+// A forced defeat of the kid counts as an ordinary win, since the
+// parent may have better moves.
+int NegateKidReward(int reward) {
+  if (DefeatIsForced(reward))
+    return +1;
+  else if (DrawIsForced(reward))
+    return 0;
+  else if (VictoryIsForced(reward))
+    return LostInNPlies(VictoryToPlies(reward) + 1);
+  return -reward;
+}
+
+// The number of leaves that a selecting engine may have waiting
+// for playouts at once. More of them spread the search wider
+// because of their virtual losses.
+const int kMaxPlayoutsInFlight = 8;
+
 bool IsZero(int number) { return number == 0; }
 
 }  // namespace
 
 //-- MctsNode ---------------------------------------------------------
+// The statistics of a move. Both the UCB and the RAVE statistics pack
+// a reward into the high half and a number of simulations into the low
+// half of a 64-bit word, so that a single atomic operation updates them
+// and readers never see one without the other.
 class MctsNode {
  public:
   MctsNode() {}
   ~MctsNode() {}
 
   void Init() {
-    memset(this, 0, sizeof *this);
+    ucb_ = 0;
+    rave_ = 0;
   }
 
   int UpdateUcbNumSimulations(int ucb_num_simulations_increment) {
-    return AtomicIncrement(&ucb_num_simulations_,
-                           ucb_num_simulations_increment);
+    return NumSimulationsOf(AtomicIncrement(
+        &ucb_, Pack(0, ucb_num_simulations_increment)));
   }
 
   void UpdateUcbReward(int ucb_reward_increment) {
     if (ResultIsForced(ucb_reward_increment)) {
-      ucb_reward_ = ucb_reward_increment;
+      while (true) {
+        const unsigned long long old_ucb = ucb_;
+        const unsigned long long new_ucb =
+            Pack(ucb_reward_increment, NumSimulationsOf(old_ucb));
+        if (AtomicCompareAndSwap(&ucb_, old_ucb, new_ucb) == old_ucb)
+          break;
+      }
     } else {
       AtomicIncrementIfFalse(
-          &ucb_reward_, ucb_reward_increment, ResultIsForced);
+          &ucb_, Pack(ucb_reward_increment, 0), RewardIsForced);
+    }
+  }
+
+  // Equivalent to UpdateUcbNumSimulations() followed by UpdateUcbReward().
+  void UpdateUcb(int ucb_reward_increment, int ucb_num_simulations_increment) {
+    if (ResultIsForced(ucb_reward_increment) ||
+        !AtomicIncrementIfFalse(
+            &ucb_, Pack(ucb_reward_increment, ucb_num_simulations_increment),
+            RewardIsForced)) {
+      UpdateUcbNumSimulations(ucb_num_simulations_increment);
+      UpdateUcbReward(ucb_reward_increment);
     }
   }
 
   void UpdateRave(int rave_reward_increment,
                   int rave_num_simulations_increment) {
     assert(!ResultIsForced(rave_reward_increment));
-    AtomicIncrement(&rave_reward_, rave_reward_increment);
-    assert(rave_reward_ != INT_MIN);
-    assert(rave_reward_ != INT_MAX);
-    AtomicIncrement(&rave_num_simulations_, rave_num_simulations_increment);
-    assert(rave_num_simulations_ > 0);
+    AtomicIncrement(&rave_, Pack(rave_reward_increment,
+                                 rave_num_simulations_increment));
+    assert(rave_num_simulations() > 0);
   }
 
-  int ucb_reward() const { return ucb_reward_; }
-  int ucb_num_simulations() const { return ucb_num_simulations_; }
-  int rave_reward() const { return rave_reward_; }
-  int rave_num_simulations() const { return rave_num_simulations_; }
-  void set_visits_to_go(int n) { visits_to_go_ = n; }
-  bool decrement_visits_to_go_if_nonzero() {
-    return AtomicIncrementIfFalse(&visits_to_go_, -1, IsZero);
-  }
-  MoveIndex kid_to_visit() const {
-    return static_cast<MoveIndex>(kid_to_visit_);
-  }
-  void set_kid_to_visit(MoveIndex move) { kid_to_visit_ = move; }
-  float bias() const { return bias_ * (1.0f / 256.0f); }
-  void set_bias(float n) { bias_ = n * 256.0f; }
+  int ucb_reward() const { return RewardOf(ucb_); }
+  int ucb_num_simulations() const { return NumSimulationsOf(ucb_); }
+  int rave_reward() const { return RewardOf(rave_); }
+  int rave_num_simulations() const { return NumSimulationsOf(rave_); }
 
-  int HasForcedVictory() const { return VictoryIsForced(ucb_reward_); }
-  int HasForcedDraw() const { return DrawIsForced(ucb_reward_); }
-  int HasForcedDefeat() const { return DefeatIsForced(ucb_reward_); }
-  int HasForcedResult() const { return ResultIsForced(ucb_reward_); }
+  int HasForcedVictory() const { return VictoryIsForced(ucb_reward()); }
+  int HasForcedDraw() const { return DrawIsForced(ucb_reward()); }
+  int HasForcedDefeat() const { return DefeatIsForced(ucb_reward()); }
+  int HasForcedResult() const { return ResultIsForced(ucb_reward()); }
 
   std::string ForcedResultToString() const {
     if (HasForcedVictory())
-      return StringPrintf("defeat in %d", VictoryToPlies(ucb_reward_));
+      return StringPrintf("defeat in %d", VictoryToPlies(ucb_reward()));
     else if (HasForcedDraw())
       return "inevitable draw";
     else if (HasForcedDefeat())
-      return StringPrintf("victory in %d", DefeatToPlies(ucb_reward_));
+      return StringPrintf("victory in %d", DefeatToPlies(ucb_reward()));
     assert(false);
     return "";
   }
 
  private:
-  int ucb_reward_;
-  int ucb_num_simulations_;
-  int rave_reward_;
-  int rave_num_simulations_;
+  // Negative numbers of simulations borrow from the reward, which
+  // cancels out as long as the sum of the increments stays positive.
+  static unsigned long long Pack(int reward, int num_simulations) {
+    return (static_cast<unsigned long long>(reward) << 32) +
+           static_cast<unsigned long long>(num_simulations);
+  }
+  static int RewardOf(unsigned long long word) {
+    return static_cast<int>(word >> 32);
+  }
+  static int NumSimulationsOf(unsigned long long word) {
+    return static_cast<int>(static_cast<unsigned>(word));
+  }
+  static bool RewardIsForced(unsigned long long word) {
+    return ResultIsForced(RewardOf(word));
+  }
+
+  unsigned long long ucb_;
+  unsigned long long rave_;
+};
+
+//-- KidBlock ---------------------------------------------------------
+// The kids of an expanded position. Their statistics lie next to each
+// other in a KidArena, and so do the cells that lead to them and their
+// biases. Copies of a KidBlock refer to the same kids.
+class KidBlock {
+ public:
+  KidBlock() : nodes_(NULL), cells_(NULL), biases_(NULL), size_(0) {}
+  KidBlock(MctsNode* nodes, short* cells, short* biases, int size)
+      : nodes_(nodes), cells_(cells), biases_(biases), size_(size) {}
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  MctsNode* node(int i) const { return &nodes_[i]; }
+  // The move is remembered as a cell rather than as a MoveIndex because
+  // the latter changes after permanent moves and nodes can be reused.
+  Cell cell(int i) const { return static_cast<Cell>(cells_[i]); }
+  void set_cell(int i, Cell cell) const { cells_[i] = cell; }
+  float bias(int i) const { return biases_[i] * (1.0f / 256.0f); }
+  void set_bias(int i, float bias) const { biases_[i] = bias * 256.0f; }
+  void Swap(int i, int j) const {
+    std::swap(nodes_[i], nodes_[j]);
+    std::swap(cells_[i], cells_[j]);
+    std::swap(biases_[i], biases_[j]);
+  }
+  // The first num_kids kids.
+  KidBlock Prefix(int num_kids) const {
+    return KidBlock(nodes_, cells_, biases_, num_kids);
+  }
+
+ private:
+  MctsNode* nodes_;
+  short* cells_;
+  short* biases_;
+  int size_;
+};
+
+//-- TableEntry -------------------------------------------------------
+// The value that the transposition table keeps for a position. Until
+// the position gets expanded, node() gathers the RAVE statistics that
+// become the prior of the move to it; it also holds the statistics
+// of the root. After the expansion, the entry points to the kids.
+class TableEntry {
+ public:
+  TableEntry() {}
+  ~TableEntry() {}
+
+  void Init() {
+    node_.Init();
+    visits_to_go_ = 0;
+    first_kid_ = kNoKids;
+    num_kids_ = 0;
+    kid_to_visit_ = 0;
+    num_moves_ = 0;
+    is_pinned_ = false;
+    is_unveiling_ = false;
+  }
+
+  // Expanded positions are never evicted, since the engines and the
+  // solver keep pointers to them and to their kids while they search.
+  // Neither is the pinned root. TreeStorage::Prune() forgets the kids
+  // of expanded positions between searches to make them evictable.
+  int weight() const {
+    if (first_kid_ != kNoKids || is_pinned_ || node_.HasForcedResult())
+      return INT_MAX;
+    return node_.rave_num_simulations();
+  }
+
+  // Returns true if the calling thread should expand the position.
+  bool StartExpanding() {
+    return AtomicCompareAndSwap(&first_kid_, kNoKids, kExpanding) == kNoKids;
+  }
+  // The kids are the first num_kids of the num_moves moves from the
+  // position in the order in which progressive widening unveils them.
+  void FinishExpanding(int first_kid, int num_kids, int num_moves) {
+    num_kids_ = num_kids;
+    num_moves_ = num_moves;
+    AtomicCompareAndSwap(&first_kid_, kExpanding, first_kid);
+  }
+  void AbortExpanding() {
+    AtomicCompareAndSwap(&first_kid_, kExpanding, kNoKids);
+  }
+  // Returns true if the calling thread should unveil more kids.
+  bool StartUnveiling() {
+    return !AtomicCompareAndSwap(&is_unveiling_, false, true);
+  }
+  // Replaces the kids with a larger block that begins with copies
+  // of them. Readers load num_kids_ before first_kid_, so that they
+  // never see the new size with the old offset.
+  void FinishUnveiling(int first_kid, int num_kids) {
+    // The swap also makes the copies visible before the new offset.
+    AtomicCompareAndSwap(&first_kid_, first_kid_, first_kid);
+    *static_cast<volatile short*>(&num_kids_) = num_kids;
+    is_unveiling_ = false;
+  }
+  void AbortUnveiling() { is_unveiling_ = false; }
+  // The two methods below must not be called during a search.
+  void ForgetKids() {
+    first_kid_ = kNoKids;
+    num_kids_ = 0;
+    num_moves_ = 0;
+    visits_to_go_ = 0;
+    kid_to_visit_ = 0;
+  }
+  void MoveKids(int first_kid) { first_kid_ = first_kid; }
+
+  bool has_kids() const {
+    return *static_cast<const volatile int*>(&first_kid_) > kNoKids;
+  }
+  int first_kid() const {
+    return *static_cast<const volatile int*>(&first_kid_);
+  }
+  int num_kids() const {
+    return *static_cast<const volatile short*>(&num_kids_);
+  }
+  int num_moves() const { return num_moves_; }
+  MctsNode* node() { return &node_; }
+  const MctsNode* node() const { return &node_; }
+  void set_visits_to_go(int n) { visits_to_go_ = n; }
+  bool decrement_visits_to_go_if_nonzero() {
+    return AtomicIncrementIfFalse(&visits_to_go_, -1, IsZero);
+  }
+  int kid_to_visit() const { return kid_to_visit_; }
+  void set_kid_to_visit(int n) { kid_to_visit_ = n; }
+  bool is_pinned() const { return is_pinned_; }
+  void set_is_pinned(bool is_pinned) { is_pinned_ = is_pinned; }
+
+ private:
+  static const int kNoKids = 0;
+  static const int kExpanding = -1;
+
+  MctsNode node_;
   int visits_to_go_;
+  int first_kid_;
+  short num_kids_;
   short kid_to_visit_;
-  short bias_;
+  short num_moves_;
+  bool is_pinned_;
+  bool is_unveiling_;
+};
+
+//-- KidArena ---------------------------------------------------------
+// Hands out KidBlocks. Blocks are never freed during a search, since
+// expanded positions are never evicted from the table then. Between
+// searches, TreeStorage::Prune() reclaims the blocks of the positions
+// whose kids it forgets, and the blocks that progressive widening
+// outgrew, by sliding the other blocks down. Clear() frees all blocks
+// at once.
+class KidArena {
+ public:
+  explicit KidArena(int megabytes) : megabytes_(megabytes) {
+    mapped_size_ = static_cast<size_t>(megabytes) << 20;
+    capacity_ = static_cast<int>(std::min(
+        mapped_size_ / (sizeof(MctsNode) + 2 * sizeof(short)),
+        static_cast<size_t>(INT_MAX / 2)));
+    void* memory = AllocateHugePages(mapped_size_);
+    if (memory == NULL) {
+      fprintf(stderr, "Cannot allocate %d MB for kids\n", megabytes);
+      exit(EXIT_FAILURE);
+    }
+    nodes_ = static_cast<MctsNode*>(memory);
+    cells_ = reinterpret_cast<short*>(nodes_ + capacity_);
+    biases_ = cells_ + capacity_;
+    Clear();
+  }
+
+  ~KidArena() {
+    FreeHugePages(nodes_, mapped_size_);
+  }
+
+  void Clear() {
+    // Offset 0 is never handed out, so that it can mean "no kids".
+    size_ = 1;
+    num_blocks_ = 0;
+  }
+
+  // Returns the offset of num_kids uninitialized kids
+  // or -1 if the arena is exhausted.
+  int Allocate(int num_kids) {
+    while (true) {
+      const int begin = *static_cast<volatile int*>(&size_);
+      if (begin + num_kids > capacity_)
+        return -1;
+      if (AtomicCompareAndSwap(&size_, begin, begin + num_kids) == begin) {
+        AtomicIncrement(&num_blocks_, 1);
+        return begin;
+      }
+    }
+  }
+
+  // Copies num_kids kids from offset from to the unshared block at
+  // offset to. Updates made to the originals meanwhile are lost.
+  void CopyBlock(int from, int to, int num_kids) {
+    assert(to >= from + num_kids);
+    std::copy(nodes_ + from, nodes_ + from + num_kids, nodes_ + to);
+    std::copy(cells_ + from, cells_ + from + num_kids, cells_ + to);
+    std::copy(biases_ + from, biases_ + from + num_kids, biases_ + to);
+  }
+  // Moves num_kids kids from offset from down to offset to.
+  // Must not be called during a search.
+  void MoveBlock(int from, int to, int num_kids) {
+    assert(to <= from);
+    if (to == from)
+      return;
+    // Copying forward is safe when the blocks overlap.
+    std::copy(nodes_ + from, nodes_ + from + num_kids, nodes_ + to);
+    std::copy(cells_ + from, cells_ + from + num_kids, cells_ + to);
+    std::copy(biases_ + from, biases_ + from + num_kids, biases_ + to);
+  }
+  // Frees all kids from offset end on, leaving num_blocks blocks.
+  // Must not be called during a search.
+  void Truncate(int end, int num_blocks) {
+    assert(end >= 1 && end <= size_);
+    size_ = end;
+    num_blocks_ = num_blocks;
+  }
+
+  KidBlock at(int offset, int num_kids) const {
+    return KidBlock(
+        &nodes_[offset], &cells_[offset], &biases_[offset], num_kids);
+  }
+  bool IsHalfFull() const { return size_ >= capacity_ / 2; }
+  int size() const { return size_ - 1; }
+  int capacity() const { return capacity_; }
+  int num_blocks() const { return num_blocks_; }
+  int megabytes() const { return megabytes_; }
+
+ private:
+  MctsNode* nodes_;
+  short* cells_;
+  short* biases_;
+  int capacity_;
+  int size_;
+  // The number of blocks allocated and not freed.
+  int num_blocks_;
+  size_t mapped_size_;
+  int megabytes_;
+
+  KidArena(const KidArena&);
+  void operator=(const KidArena&);
 };
 
 namespace {
@@ -158,41 +443,44 @@ inline float FastSqrtf(float x) {
 }
 
 inline float ResultForNoVisits(
-    const MctsNode* node, float first_play_urgency) {
+    const MctsNode* node, float bias, float first_play_urgency) {
   const int nr = node->rave_num_simulations();
   if (nr > 0)
     first_play_urgency += static_cast<float>(node->rave_reward()) / nr;
-  return node->bias() + first_play_urgency;
+  return bias + first_play_urgency;
 }
 
 inline float UtcHoeffding(const MctsNode* node,
+                          float bias,
                           float log_parent_simulations,
                           float /*rave_bias*/,
                           float first_play_urgency) {
   const float n = node->ucb_num_simulations();
   if (n <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   return node->ucb_reward() / n + FastSqrtf(log_parent_simulations / n);
 }
 
 inline float UtcHoeffdingSlow(const MctsNode* node,
+                              float bias,
                               float log_parent_simulations,
                               float /*rave_bias*/,
                               float first_play_urgency) {
   const float n = node->ucb_num_simulations();
   if (n <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   return node->ucb_reward() / n + sqrtf(log_parent_simulations / n);
 }
 
 inline float RaveGelly(const MctsNode* node,
+                       float bias,
                        float log_parent_simulations,
                        float rave_bias,
                        float first_play_urgency) {
   // Equivalence parameter == 3 * rave_bias.
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float nr = node->rave_num_simulations();
   assert(nr != 0);
   const float beta = FastSqrtf(rave_bias / (nu + rave_bias));
@@ -202,13 +490,14 @@ inline float RaveGelly(const MctsNode* node,
 }
 
 inline float RaveTeytaud(const MctsNode* node,
+                         float bias,
                          float log_parent_simulations,
                          float rave_bias,
                          float first_play_urgency) {
   // Equivalence parameter == rave_bias.
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float nr = node->rave_num_simulations();
   assert(nr != 0);
   const float beta = rave_bias / (nu + rave_bias);
@@ -218,6 +507,7 @@ inline float RaveTeytaud(const MctsNode* node,
 }
 
 inline float RaveSilver(const MctsNode* node,
+                        float bias,
                         float log_parent_simulations,
                         float rave_bias,
                         float first_play_urgency) {
@@ -226,7 +516,7 @@ inline float RaveSilver(const MctsNode* node,
     return reward;
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float nr = node->rave_num_simulations();
   const float beta_by_nr = 1.0f / (nu + nr + rave_bias * nu * nr);
   return (1.0f - beta_by_nr * nr) * (reward / nu) +
@@ -235,6 +525,7 @@ inline float RaveSilver(const MctsNode* node,
 }
 
 inline float RaveSilverWithProgressiveBias(const MctsNode* node,
+                                           float bias,
                                            float log_parent_simulations,
                                            float rave_bias,
                                            float first_play_urgency) {
@@ -243,22 +534,23 @@ inline float RaveSilverWithProgressiveBias(const MctsNode* node,
     return reward;
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float nr = node->rave_num_simulations();
   const float beta_by_nr = 1.0f / (nu + nr + rave_bias * nu * nr);
   return (1.0f - beta_by_nr * nr) * (reward / nu) +
          beta_by_nr * node->rave_reward() +
          FastSqrtf(log_parent_simulations / nu) +
-         node->bias() / FastSqrtf(nu);
+         bias / FastSqrtf(nu);
 }
 
 inline float RaveSilverUnsimplified(const MctsNode* node,
+                                    float bias,
                                     float log_parent_simulations,
                                     float rave_bias,
                                     float first_play_urgency) {
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float mu = node->ucb_reward() / nu;
   const float nr = node->rave_num_simulations();
   // TODO(mciura): Fix mu to the (0, 1) range.
@@ -271,12 +563,13 @@ inline float RaveSilverUnsimplified(const MctsNode* node,
 
 // Enhancements for Multi-Player Monte-Carlo Tree Search.
 inline float ProgressiveHistoryNijssenWinands(const MctsNode* node,
+                                              float bias,
                                               float log_parent_simulations,
                                               float rave_bias,
                                               float first_play_urgency) {
   const float nu = node->ucb_num_simulations();
   if (nu <= 0)
-    return ResultForNoVisits(node, first_play_urgency);
+    return ResultForNoVisits(node, bias, first_play_urgency);
   const float nr = node->rave_num_simulations();
   assert(nr != 0);
   assert(nu - node->ucb_reward() != 0);
@@ -309,28 +602,484 @@ std::string GetNodeInfo(int num_simulations, float win_ratio, bool negate) {
   return StringPrintf("%.2f(%d)", 100.0f * win_ratio, num_simulations);
 }
 
+// Orders the indices of kids by their biases, greatest first.
+class ByDescendingBias {
+ public:
+  explicit ByDescendingBias(const float* biases) : biases_(biases) {}
+  bool operator()(int i, int j) const { return biases_[i] > biases_[j]; }
+
+ private:
+  const float* biases_;
+};
+
+typedef float (*GetScore)(const MctsNode*, float, float, float, float);
+
+// Returns the index of the first of kids[begin...kids.size() - 1] whose
+// score exceeds *best_value or -1 if there is none. Updates *best_value.
+template<GetScore get_score>
+int FindBestKid(const KidBlock& kids,
+                int begin,
+                float log_parent_simulations,
+                float rave_bias,
+                float first_play_urgency,
+                float* best_value) {
+  int best_kid = -1;
+  for (int i = begin, size = kids.size(); i < size; ++i) {
+    const float value = get_score(
+        kids.node(i), kids.bias(i), log_parent_simulations, rave_bias,
+        first_play_urgency);
+    if (value > *best_value) {
+      *best_value = value;
+      best_kid = i;
+    }
+  }
+  return best_kid;
+}
+
+//---------------------------------------------------------------------
+// Vectorized versions of the scoring functions. They repeat the scalar
+// arithmetic operation by operation, so both versions choose the same
+// kids. The Makefile builds this file with -ffp-contract=off, so that
+// GCC fuses no multiply-add in only one of the versions. GCC compiles
+// the vector types to AVX or SSE instructions.
+#if defined(__AVX__) || defined(__SSE2__)
+#define USE_VECTORIZED_SCORES
+
+#ifdef __AVX__
+const int kNumLanes = 8;
+#else
+const int kNumLanes = 4;
+#endif  // __AVX__
+
+typedef float FloatVector __attribute__((vector_size(4 * kNumLanes)));
+typedef int IntVector __attribute__((vector_size(4 * kNumLanes)));
+
+// The statistics of kNumLanes consecutive kids.
+struct KidVectors {
+  FloatVector ucb_reward;
+  FloatVector ucb_num_simulations;
+  FloatVector rave_reward;
+  FloatVector rave_num_simulations;
+  FloatVector bias;
+  IntVector has_forced_result;
+};
+
+inline FloatVector Broadcast(float x) {
+  FloatVector v;
+  for (int i = 0; i < kNumLanes; ++i) {
+    v[i] = x;
+  }
+  return v;
+}
+
+inline IntVector BroadcastInt(int x) {
+  IntVector v;
+  for (int i = 0; i < kNumLanes; ++i) {
+    v[i] = x;
+  }
+  return v;
+}
+
+// Returns the lanes of a where mask is set and the lanes of b elsewhere.
+inline FloatVector Select(IntVector mask, FloatVector a, FloatVector b) {
+  return reinterpret_cast<FloatVector>(
+      (mask & reinterpret_cast<IntVector>(a)) |
+      (~mask & reinterpret_cast<IntVector>(b)));
+}
+
+// Loads kids[begin...begin + kNumLanes - 1].
+inline void LoadKidVectors(const KidBlock& kids, int begin, KidVectors* k) {
+  for (int i = 0; i < kNumLanes; ++i) {
+    const MctsNode* kid = kids.node(begin + i);
+    k->ucb_reward[i] = kid->ucb_reward();
+    k->ucb_num_simulations[i] = kid->ucb_num_simulations();
+    k->rave_reward[i] = kid->rave_reward();
+    k->rave_num_simulations[i] = kid->rave_num_simulations();
+    k->bias[i] = kids.bias(begin + i);
+  }
+  // Rewards that are not forced results never come close to these bounds,
+  // so rounding them to floats does not matter.
+  k->has_forced_result =
+      (k->ucb_reward >= Broadcast(static_cast<float>(INT_MAX - 0x8000))) |
+      (k->ucb_reward <= Broadcast(static_cast<float>(kBoardFilledDraw)));
+}
+
+inline FloatVector FastSqrtfVector(FloatVector x) {
+  IntVector i = reinterpret_cast<IntVector>(x);
+  i = (i >> 1) + BroadcastInt((1 << 29) - (1 << 22));
+  return reinterpret_cast<FloatVector>(i);
+}
+
+inline FloatVector SqrtfVector(FloatVector x) {
+#ifdef __AVX__
+  return _mm256_sqrt_ps(x);
+#else
+  return _mm_sqrt_ps(x);
+#endif  // __AVX__
+}
+
+inline FloatVector ResultForNoVisitsVector(
+    const KidVectors& k, FloatVector first_play_urgency) {
+  const IntVector has_rave = k.rave_num_simulations > Broadcast(0.0f);
+  first_play_urgency = Select(
+      has_rave,
+      first_play_urgency + k.rave_reward / k.rave_num_simulations,
+      first_play_urgency);
+  return k.bias + first_play_urgency;
+}
+
+inline FloatVector UtcHoeffdingVector(const KidVectors& k,
+                                      FloatVector log_parent_simulations,
+                                      FloatVector /*rave_bias*/,
+                                      FloatVector first_play_urgency) {
+  const FloatVector n = k.ucb_num_simulations;
+  return Select(
+      n <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      k.ucb_reward / n + FastSqrtfVector(log_parent_simulations / n));
+}
+
+inline FloatVector UtcHoeffdingSlowVector(const KidVectors& k,
+                                          FloatVector log_parent_simulations,
+                                          FloatVector /*rave_bias*/,
+                                          FloatVector first_play_urgency) {
+  const FloatVector n = k.ucb_num_simulations;
+  return Select(
+      n <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      k.ucb_reward / n + SqrtfVector(log_parent_simulations / n));
+}
+
+inline FloatVector RaveGellyVector(const KidVectors& k,
+                                   FloatVector log_parent_simulations,
+                                   FloatVector rave_bias,
+                                   FloatVector first_play_urgency) {
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta = FastSqrtfVector(rave_bias / (nu + rave_bias));
+  return Select(
+      nu <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      (Broadcast(1.0f) - beta) * (k.ucb_reward / nu) +
+          beta * (k.rave_reward / nr) +
+          FastSqrtfVector(log_parent_simulations / nu));
+}
+
+inline FloatVector RaveTeytaudVector(const KidVectors& k,
+                                     FloatVector log_parent_simulations,
+                                     FloatVector rave_bias,
+                                     FloatVector first_play_urgency) {
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta = rave_bias / (nu + rave_bias);
+  return Select(
+      nu <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      (Broadcast(1.0f) - beta) * (k.ucb_reward / nu) +
+          beta * (k.rave_reward / nr) +
+          FastSqrtfVector(log_parent_simulations / nu));
+}
+
+inline FloatVector RaveSilverVector(const KidVectors& k,
+                                    FloatVector log_parent_simulations,
+                                    FloatVector rave_bias,
+                                    FloatVector first_play_urgency) {
+  const FloatVector reward = k.ucb_reward;
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta_by_nr =
+      Broadcast(1.0f) / (nu + nr + rave_bias * nu * nr);
+  return Select(
+      k.has_forced_result,
+      reward,
+      Select(nu <= Broadcast(0.0f),
+             ResultForNoVisitsVector(k, first_play_urgency),
+             (Broadcast(1.0f) - beta_by_nr * nr) * (reward / nu) +
+                 beta_by_nr * k.rave_reward +
+                 FastSqrtfVector(log_parent_simulations / nu)));
+}
+
+inline FloatVector RaveSilverWithProgressiveBiasVector(
+    const KidVectors& k,
+    FloatVector log_parent_simulations,
+    FloatVector rave_bias,
+    FloatVector first_play_urgency) {
+  const FloatVector reward = k.ucb_reward;
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta_by_nr =
+      Broadcast(1.0f) / (nu + nr + rave_bias * nu * nr);
+  return Select(
+      k.has_forced_result,
+      reward,
+      Select(nu <= Broadcast(0.0f),
+             ResultForNoVisitsVector(k, first_play_urgency),
+             (Broadcast(1.0f) - beta_by_nr * nr) * (reward / nu) +
+                 beta_by_nr * k.rave_reward +
+                 FastSqrtfVector(log_parent_simulations / nu) +
+                 k.bias / FastSqrtfVector(nu)));
+}
+
+inline FloatVector RaveSilverUnsimplifiedVector(
+    const KidVectors& k,
+    FloatVector log_parent_simulations,
+    FloatVector rave_bias,
+    FloatVector first_play_urgency) {
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector mu = k.ucb_reward / nu;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta_by_nr =
+      Broadcast(1.0f) /
+      (nu + nr + rave_bias * nu * nr / (mu * (Broadcast(1.0f) - mu)));
+  return Select(
+      nu <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      (Broadcast(1.0f) - beta_by_nr * nr) * mu +
+          beta_by_nr * k.rave_reward +
+          FastSqrtfVector(log_parent_simulations / nu));
+}
+
+inline FloatVector ProgressiveHistoryNijssenWinandsVector(
+    const KidVectors& k,
+    FloatVector log_parent_simulations,
+    FloatVector rave_bias,
+    FloatVector first_play_urgency) {
+  const FloatVector nu = k.ucb_num_simulations;
+  const FloatVector nr = k.rave_num_simulations;
+  const FloatVector beta = rave_bias / (nu - k.ucb_reward);
+  return Select(
+      nu <= Broadcast(0.0f),
+      ResultForNoVisitsVector(k, first_play_urgency),
+      (k.ucb_reward / nu) +
+          beta * (k.rave_reward / nr) + beta +
+          FastSqrtfVector(log_parent_simulations / nu));
+}
+
+typedef FloatVector (*GetScoreVector)(
+    const KidVectors&, FloatVector, FloatVector, FloatVector);
+
+// Tells whether ArgMax() should score kids with FindBestKidVectorized().
+// UtcHoeffding() does too little arithmetic per kid to pay for loading
+// the lanes field by field, and loses to the scalar loop.
+template<GetScore get_score>
+struct ScoresFasterVectorized {
+  static const bool value = true;
+};
+
+template<>
+struct ScoresFasterVectorized<UtcHoeffding> {
+  static const bool value = false;
+};
+
+// Like FindBestKid<get_score>(kids, 0, ...) but scores kNumLanes kids
+// at once.
+template<GetScore get_score, GetScoreVector get_score_vector>
+int FindBestKidVectorized(const KidBlock& kids,
+                          float log_parent_simulations,
+                          float rave_bias,
+                          float first_play_urgency,
+                          float* best_value) {
+  const FloatVector log_parent_simulations_vector =
+      Broadcast(log_parent_simulations);
+  const FloatVector rave_bias_vector = Broadcast(rave_bias);
+  const FloatVector first_play_urgency_vector = Broadcast(first_play_urgency);
+  FloatVector best_values = Broadcast(*best_value);
+  IntVector best_kids = BroadcastInt(-1);
+  IntVector indices;
+  for (int i = 0; i < kNumLanes; ++i) {
+    indices[i] = i;
+  }
+  const int num_kids = kids.size();
+  int i = 0;
+  for (/**/; i + kNumLanes <= num_kids; i += kNumLanes) {
+    KidVectors k;
+    LoadKidVectors(kids, i, &k);
+    const FloatVector values = get_score_vector(
+        k, log_parent_simulations_vector, rave_bias_vector,
+        first_play_urgency_vector);
+    const IntVector greater = values > best_values;
+    best_values = Select(greater, values, best_values);
+    best_kids = (greater & indices) | (~greater & best_kids);
+    indices += BroadcastInt(kNumLanes);
+  }
+  // Among lanes with equal values, the first kid wins, as in FindBestKid.
+  int best_kid = -1;
+  for (int lane = 0; lane < kNumLanes; ++lane) {
+    if (best_kids[lane] == -1)
+      continue;
+    if (best_values[lane] > *best_value ||
+        (best_values[lane] == *best_value && best_kids[lane] < best_kid)) {
+      *best_value = best_values[lane];
+      best_kid = best_kids[lane];
+    }
+  }
+  const int best_tail_kid = FindBestKid<get_score>(
+      kids, i, log_parent_simulations, rave_bias,
+      first_play_urgency, best_value);
+  return (best_tail_kid != -1) ? best_tail_kid : best_kid;
+}
+#endif  // defined(__AVX__) || defined(__SSE2__)
+
+}  // namespace
+
+//-- TreeStorage ------------------------------------------------------
+namespace {
+
+// An expanded position and the simulations of its kids.
+struct ExpandedEntry {
+  TableEntry* entry;
+  long long num_simulations;
+};
+
+bool IsSimulatedMore(const ExpandedEntry& a, const ExpandedEntry& b) {
+  return a.num_simulations > b.num_simulations;
+}
+
+bool HasKidsEarlierInArena(const ExpandedEntry& a, const ExpandedEntry& b) {
+  return a.entry->first_kid() < b.entry->first_kid();
+}
+
+// Unpins all entries and gathers the expanded ones for Prune().
+class ExpandedEntryCollector {
+ public:
+  ExpandedEntryCollector(const KidArena* kids,
+                         std::vector<ExpandedEntry>* entries)
+      : kids_(kids), entries_(entries) {}
+
+  void operator()(TableEntry* entry) {
+    entry->set_is_pinned(false);
+    if (!entry->has_kids())
+      return;
+    const KidBlock block = kids_->at(entry->first_kid(), entry->num_kids());
+    ExpandedEntry expanded;
+    expanded.entry = entry;
+    expanded.num_simulations = 0;
+    for (int i = 0, size = block.size(); i < size; ++i) {
+      expanded.num_simulations += block.node(i)->ucb_num_simulations();
+    }
+    entries_->push_back(expanded);
+  }
+
+ private:
+  const KidArena* kids_;
+  std::vector<ExpandedEntry>* entries_;
+};
+
 }  // namespace
 
+TreeStorage::TreeStorage(int megabytes) : num_expansions_(0) {
+  Allocate(megabytes);
+}
+
+TreeStorage::~TreeStorage() {
+  delete nodes_;
+  delete kids_;
+}
+
+void TreeStorage::Clear(int megabytes) {
+  if (megabytes != megabytes_) {
+    delete nodes_;
+    delete kids_;
+    Allocate(megabytes);
+  } else {
+    nodes_->Clear();
+    kids_->Clear();
+    num_expansion_failures_ = 0;
+  }
+}
+
+bool TreeStorage::NeedsClearing(int megabytes) const {
+  return megabytes != megabytes_;
+}
+
+// Expanded positions cannot be evicted, so their number is bounded
+// by the room in the hash map as well as by the room in the arena.
+bool TreeStorage::NeedsPruning() const {
+  return kids_->IsHalfFull() || kids_->num_blocks() >= nodes_->limit() / 2;
+}
+
+void TreeStorage::Prune(Hash root_hash) {
+  std::vector<ExpandedEntry> entries;
+  ExpandedEntryCollector collector(kids_, &entries);
+  nodes_->ForEachValue(&collector);
+  // The positions simulated most are the closest to the root,
+  // which goes first anyway.
+  std::stable_sort(entries.begin(), entries.end(), IsSimulatedMore);
+  const TableEntry* root_entry = nodes_->FindValue(root_hash);
+  for (int i = 0, size = entries.size(); i < size; ++i) {
+    if (entries[i].entry == root_entry) {
+      std::rotate(entries.begin(), entries.begin() + i,
+                  entries.begin() + i + 1);
+      break;
+    }
+  }
+  const int max_num_kids = kids_->capacity() / 4;
+  const int max_num_blocks = nodes_->limit() / 4;
+  int num_kids = 0;
+  int num_kept = 0;
+  for (int size = entries.size(); num_kept < size; ++num_kept) {
+    const int n = entries[num_kept].entry->num_kids();
+    if (num_kids + n > max_num_kids || num_kept >= max_num_blocks)
+      break;
+    num_kids += n;
+  }
+  for (int i = num_kept, size = entries.size(); i < size; ++i) {
+    entries[i].entry->ForgetKids();
+  }
+  entries.resize(num_kept);
+  std::sort(entries.begin(), entries.end(), HasKidsEarlierInArena);
+  int end = 1;
+  for (int i = 0; i < num_kept; ++i) {
+    TableEntry* entry = entries[i].entry;
+    kids_->MoveBlock(entry->first_kid(), end, entry->num_kids());
+    entry->MoveKids(end);
+    end += entry->num_kids();
+  }
+  kids_->Truncate(end, num_kept);
+}
+
+void TreeStorage::CountExpansionFailure() {
+  AtomicIncrement(&num_expansion_failures_, 1);
+}
+
+void TreeStorage::CountExpansion() {
+  AtomicIncrement(&num_expansions_, 1LL);
+}
+
+// Splits the megabytes evenly between the hash map and the arena.
+void TreeStorage::Allocate(int megabytes) {
+  const int hash_map_megabytes = megabytes / 2;
+  nodes_ = new HashMap(hash_map_megabytes);
+  kids_ = new KidArena(megabytes - hash_map_megabytes);
+  megabytes_ = megabytes;
+  num_expansion_failures_ = 0;
+}
+
 //-- TranspositionTable -----------------------------------------------
-typedef WaitFreeHashMap<Hash, MctsNode, LOG2_NUM_ENTRIES> HashMap;
 
 class TranspositionTable {
  public:
   TranspositionTable(const MctsOptions* options, Rng* rng)
-      : options_(options),
+      : storage_(NULL),
+        options_(options),
         rng_(rng) {
-    mcts_strategies_[kHoeffding] = &TranspositionTable::ArgMax<UtcHoeffding>;
-    mcts_strategies_[kHoeffdingSlow] =
-        &TranspositionTable::ArgMax<UtcHoeffdingSlow>;
-    mcts_strategies_[kGelly] = &TranspositionTable::ArgMax<RaveGelly>;
-    mcts_strategies_[kTeytaud] = &TranspositionTable::ArgMax<RaveTeytaud>;
-    mcts_strategies_[kSilver] = &TranspositionTable::ArgMax<RaveSilver>;
+#ifdef USE_VECTORIZED_SCORES
+#define ARG_MAX(get_score) \
+    &TranspositionTable::ArgMax<get_score, get_score##Vector>
+#else
+#define ARG_MAX(get_score) &TranspositionTable::ArgMax<get_score>
+#endif  // USE_VECTORIZED_SCORES
+    mcts_strategies_[kHoeffding] = ARG_MAX(UtcHoeffding);
+    mcts_strategies_[kHoeffdingSlow] = ARG_MAX(UtcHoeffdingSlow);
+    mcts_strategies_[kGelly] = ARG_MAX(RaveGelly);
+    mcts_strategies_[kTeytaud] = ARG_MAX(RaveTeytaud);
+    mcts_strategies_[kSilver] = ARG_MAX(RaveSilver);
     mcts_strategies_[kSilverWithProgressiveBias] =
-        &TranspositionTable::ArgMax<RaveSilverWithProgressiveBias>;
-    mcts_strategies_[kSilverUnsimplified] =
-        &TranspositionTable::ArgMax<RaveSilverUnsimplified>;
+        ARG_MAX(RaveSilverWithProgressiveBias);
+    mcts_strategies_[kSilverUnsimplified] = ARG_MAX(RaveSilverUnsimplified);
     mcts_strategies_[kNijssenWinands] =
-        &TranspositionTable::ArgMax<ProgressiveHistoryNijssenWinands>;
+        ARG_MAX(ProgressiveHistoryNijssenWinands);
+#undef ARG_MAX
 
     get_score_[kHoeffding] = &UtcHoeffding;
     get_score_[kHoeffdingSlow] = &UtcHoeffdingSlow;
@@ -344,77 +1093,326 @@ class TranspositionTable {
 
   ~TranspositionTable() {}
 
-  static void InitStaticFields() {
-    nodes_ = new HashMap;
+  // Empties the table. Reallocates it if options_->tt_size_mb has changed.
+  void Clear() {
+    storage_->Clear(options_->tt_size_mb);
+  }
+
+  bool NeedsClearing() const {
+    return storage_->NeedsClearing(options_->tt_size_mb);
   }
 
-  void Clear() {
-    nodes_->Clear();
+  bool NeedsPruning() const {
+    return storage_->NeedsPruning();
+  }
+
+  void Prune(Hash root_hash) {
+    storage_->Prune(root_hash);
+  }
+
+  // Does not take ownership of storage.
+  void set_storage(TreeStorage* storage) { storage_ = storage; }
+
+  void set_root_hash(Hash root_hash) { root_hash_ = root_hash; }
+
+  TableEntry* InsertKey(Hash position_hash) {
+    return nodes()->InsertKey(position_hash);
+  }
+
+  TableEntry* FindEntry(Hash position_hash) {
+    return nodes()->FindValue(position_hash);
+  }
+
+  // Returns the entry of the root, pinned so that it is never evicted,
+  // or NULL if the table has no room for it.
+  TableEntry* PinRoot(Hash root_hash) {
+    while (true) {
+      TableEntry* entry = InsertKey(root_hash);
+      if (entry == NULL)
+        return NULL;
+      entry->set_is_pinned(true);
+      // The entry might have been evicted before it got pinned.
+      if (FindEntry(root_hash) == entry)
+        return entry;
+    }
   }
 
-  MctsNode* InsertKey(Hash position_hash) {
-    return nodes_->InsertKey(position_hash);
+  // Returns the entry of an expanded position or NULL if the position
+  // has not been expanded. Unlike other entries, it is never evicted.
+  TableEntry* FindExpandedEntry(Hash position_hash) const {
+    TableEntry* entry = nodes()->FindValue(position_hash);
+    if (entry == NULL || !entry->has_kids())
+      return NULL;
+    // Another position might have taken over the entry and been
+    // expanded since FindValue() returned it.
+    return (nodes()->FindValue(position_hash) == entry) ? entry : NULL;
   }
 
-  MctsNode* FindNode(Hash position_hash) {
-    return nodes_->FindValue(position_hash);
+  // Returns the kids of an expanded position or an empty block
+  // if the position has not been expanded.
+  KidBlock GetKids(const TableEntry* entry) const {
+    if (entry == NULL || !entry->has_kids())
+      return KidBlock();
+    // See TableEntry::FinishUnveiling().
+    const int num_kids = entry->num_kids();
+    return kid_arena()->at(entry->first_kid(), num_kids);
+  }
+
+  KidBlock GetKids(Hash position_hash) const {
+    return GetKids(FindExpandedEntry(position_hash));
   }
 
   int node_count() const {
-    return nodes_->num_elements();
+    return nodes()->num_elements();
+  }
+
+  int eviction_count() const {
+    return nodes()->num_evictions();
   }
 
+  int expansion_failure_count() const {
+    return storage_->num_expansion_failures();
+  }
+
+  void CountExpansionFailure() {
+    storage_->CountExpansionFailure();
+  }
+
+  long long expansion_count() const {
+    return storage_->num_expansions();
+  }
+
+  // Puts the kids of the position that progressive widening unveils
+  // first in a block of the arena and sets their priors. Returns false
+  // if another thread is expanding the position or if the arena is
+  // exhausted.
   bool ExpandNode(Hash position_hash,
+                  MctsNode* node,
+                  TableEntry* entry,
                   Player player,
                   Position* position) {
-    const Player opponent = Opponent(player);
+    if (!entry->StartExpanding())
+      return false;
+    // The entry might have been evicted before StartExpanding()
+    // made it unevictable.
+    if (FindEntry(position_hash) != entry) {
+      entry->AbortExpanding();
+      return false;
+    }
+    Cell cells[kNumMovesOnBoard];
+    float biases[kNumMovesOnBoard];
+    bool is_winning;
+    Cell antimate_move;
+    int antimate_move_count;
+    const int num_moves = ListMoves(player, position, cells, biases,
+                                    &is_winning, &antimate_move,
+                                    &antimate_move_count);
+    const int num_kids = NumKidsToConsider(node, num_moves);
+    // An exhausted arena is counted in expansion_failure_count()
+    // and leaves the position to playouts until the tree is pruned.
+    const int first_kid = kid_arena()->Allocate(num_kids);
+    if (first_kid < 0) {
+      CountExpansionFailure();
+      entry->AbortExpanding();
+      return false;
+    }
+    const KidBlock kids = kid_arena()->at(first_kid, num_kids);
+    InitKids(position_hash, player, position, cells, biases,
+             antimate_move, antimate_move_count, kids, 0);
+    if (is_winning) {
+      kids.node(0)->UpdateUcbReward(WonInNPlies(0));
+      node->UpdateUcbReward(LostInNPlies(1));
+    } else if (antimate_move_count > 1) {
+      // Without the test for position_hash != root_hash_, player's
+      // defeat in 2 would not end the controller's search early.
+      if (position_hash != root_hash_)
+        node->UpdateUcbReward(WonInNPlies(2));
+    }
+    entry->FinishExpanding(first_kid, num_kids, num_moves);
+    storage_->CountExpansion();
+    return true;
+  }
 
-    const bool use_mate_in_tree = options_->use_mate_in_tree;
-    const bool use_antimate_in_tree = options_->use_antimate_in_tree;
-    const bool use_deeper_mate_in_tree = options_->use_deeper_mate_in_tree;
-    const int prior_num_simulations_base =
-        options_->prior_num_simulations_base;
-    const int prior_num_simulations_range =
-        options_->prior_num_simulations_range;
-    const int prior_reward_halfrange =
-        options_->prior_reward_halfrange;
+  // Replaces the kids of the expanded position with a block of the
+  // first num_kids kids that progressive widening unveils. Returns
+  // false if another thread is unveiling kids of the position or if
+  // the arena is exhausted.
+  bool UnveilKids(Hash position_hash,
+                  TableEntry* entry,
+                  Player player,
+                  Position* position,
+                  int num_kids) {
+    if (!entry->StartUnveiling())
+      return false;
+    const KidBlock old_kids = GetKids(entry);
+    Cell cells[kNumMovesOnBoard];
+    float biases[kNumMovesOnBoard];
+    bool is_winning;
+    Cell antimate_move;
+    int antimate_move_count;
+    const int num_moves = ListMoves(player, position, cells, biases,
+                                    &is_winning, &antimate_move,
+                                    &antimate_move_count);
+    num_kids = std::min(num_kids, num_moves);
+    if (num_kids <= old_kids.size()) {
+      // Another thread has just unveiled them.
+      entry->AbortUnveiling();
+      return true;
+    }
+    const int first_kid = kid_arena()->Allocate(num_kids);
+    if (first_kid < 0) {
+      CountExpansionFailure();
+      entry->AbortUnveiling();
+      return false;
+    }
+    // The new kids follow the old ones in the order of the list.
+    bool is_kid[kNumCellsWithSentinels] = { false };
+    for (int i = 0, size = old_kids.size(); i < size; ++i) {
+      is_kid[old_kids.cell(i)] = true;
+    }
+    Cell new_cells[kNumMovesOnBoard];
+    float new_biases[kNumMovesOnBoard];
+    for (int i = 0, j = old_kids.size(); j < num_kids; ++i) {
+      if (!is_kid[cells[i]]) {
+        new_cells[j] = cells[i];
+        new_biases[j] = biases[i];
+        ++j;
+      }
+    }
+    kid_arena()->CopyBlock(entry->first_kid(), first_kid, old_kids.size());
+    const KidBlock kids = kid_arena()->at(first_kid, num_kids);
+    InitKids(position_hash, player, position, new_cells, new_biases,
+             antimate_move, antimate_move_count, kids, old_kids.size());
+    entry->FinishUnveiling(first_kid, num_kids);
+    return true;
+  }
 
-    Cell antimate_move = kZerothCell;
-    int antimate_move_count = 0;
-    winning_kids_.clear();
-    position_ = position;
+  // Stores the empty cells of the position and their biases in the
+  // order in which progressive widening unveils them and returns
+  // their number. With use_mate_in_tree, a winning move is the only
+  // one stored and sets *is_winning. With use_antimate_in_tree,
+  // counts the cells that would win for the opponent in
+  // *antimate_move_count and stores one of them in *antimate_move.
+  int ListMoves(Player player,
+                const Position* position,
+                Cell* cells,
+                float* biases,
+                bool* is_winning,
+                Cell* antimate_move,
+                int* antimate_move_count) const {
     const PlayerPosition& player_position = position->player_position(player);
-
+    const Player opponent = Opponent(player);
+    Cell unordered_cells[kNumMovesOnBoard];
+    float unordered_biases[kNumMovesOnBoard];
+    int order[kNumMovesOnBoard];
+    int num_moves = 0;
+    *is_winning = false;
+    *antimate_move = kZerothCell;
+    *antimate_move_count = 0;
     for (MoveIndex move = kZerothMove, size = position->NumAvailableMoves();
          move < size; move = NextMove(move)) {
       const Cell cell = Position::MoveIndexToCell(move);
       if (!position->CellIsEmpty(cell))
         continue;
-      const Hash kid_hash =
-          Position::ModifyZobristHash(position_hash, player, move);
-      MctsNode* kid = InsertKey(kid_hash);
-      if (kid == NULL)
-        return false;
-
-      if (use_mate_in_tree) {
+      if (options_->use_mate_in_tree) {
         const int neighborhood = position->Get6Neighbors(player, cell);
         if (position->MoveIsWinning(player, cell, neighborhood, 0)) {
-          MctsNode* node = FindNode(position_hash);
-          assert(node != NULL);
-          kid->UpdateUcbReward(WonInNPlies(0));
-          node->UpdateUcbReward(LostInNPlies(1));
-          return true;
+          cells[0] = cell;
+          biases[0] = 0.0f;
+          *is_winning = true;
+          return 1;
         }
       }
-
-      if (use_antimate_in_tree) {
+      if (options_->use_antimate_in_tree) {
         const int opponent_neighborhood =
             position->Get6Neighbors(opponent, cell);
         if (position->MoveIsWinning(opponent, cell, opponent_neighborhood, 0)) {
-          antimate_move = cell;
-          ++antimate_move_count;
+          *antimate_move = cell;
+          ++*antimate_move_count;
+        }
+      }
+      float bias;
+      if (options_->chain_size_bias_factor != 0.0) {
+        bias =
+            options_->chain_size_bias_factor *
+            player_position.GetSizeOfNeighborChains(
+                cell, 6 * options_->neighborhood_size);
+      } else {
+        bias = 0.0;
+      }
+      if (options_->locality_bias != 0.0) {
+        unsigned neighbors =
+            player_position.Get18Neighbors(cell) & kAndTo12Neighbors;
+        if (neighbors != 0) {
+          bias += options_->locality_bias;
         }
       }
+      unordered_cells[num_moves] = cell;
+      unordered_biases[num_moves] = bias;
+      order[num_moves] = num_moves;
+      ++num_moves;
+    }
+    // With progressive widening, the kids go in the order of their
+    // biases, as SelectKidForExploration() unveils them in that order.
+    const bool use_widening = (options_->widening_base > 0);
+    if (use_widening) {
+      std::stable_sort(
+          order, order + num_moves, ByDescendingBias(unordered_biases));
+    }
+    for (int i = 0; i < num_moves; ++i) {
+      cells[i] = unordered_cells[order[i]];
+      biases[i] = unordered_biases[order[i]];
+    }
+    if (use_widening && *antimate_move_count == 1) {
+      // The only move that does not lose at once must be unveiled first.
+      for (int i = 0; i < num_moves; ++i) {
+        if (cells[i] == *antimate_move) {
+          std::swap(cells[0], cells[i]);
+          std::swap(biases[0], biases[i]);
+        }
+      }
+    }
+    return num_moves;
+  }
+
+  // Initializes kids[begin...kids.size() - 1] to the moves into
+  // cells[begin...kids.size() - 1] from the position.
+  void InitKids(Hash position_hash,
+                Player player,
+                Position* position,
+                const Cell* cells,
+                const float* biases,
+                Cell antimate_move,
+                int antimate_move_count,
+                const KidBlock& kids,
+                int begin) {
+    const bool use_deeper_mate_in_tree = options_->use_deeper_mate_in_tree;
+    const int prior_num_simulations_base =
+        options_->prior_num_simulations_base;
+    const int prior_num_simulations_range =
+        options_->prior_num_simulations_range;
+    const int prior_reward_halfrange =
+        options_->prior_reward_halfrange;
+
+    winning_kids_.clear();
+    position_ = position;
+
+    int i = begin;
+    while (i < kids.size()) {
+      const Cell cell = cells[i];
+      const MoveIndex move = Position::CellToMoveIndex(cell);
+      kids.set_cell(i, cell);
+      kids.set_bias(i, 0.0f);
+      MctsNode* kid = kids.node(i++);
+      kid->Init();
+      // Moves played in playouts before the expansion left their
+      // RAVE statistics in the table.
+      const TableEntry* kid_entry = FindEntry(
+          Position::ModifyZobristHash(position_hash, player, move));
+      if (kid_entry != NULL && kid_entry->node()->rave_num_simulations() > 0) {
+        kid->UpdateRave(kid_entry->node()->rave_reward(),
+                        kid_entry->node()->rave_num_simulations());
+      }
 
       if (use_deeper_mate_in_tree) {
         position->MakeMoveReversibly(player, cell, &memento_);
@@ -486,23 +1484,7 @@ class TranspositionTable {
       if (bias != 0)
         kid->set_bias(bias);
 */
-      float bias;
-      if (options_->chain_size_bias_factor != 0.0) {
-        bias =
-            options_->chain_size_bias_factor *
-            player_position.GetSizeOfNeighborChains(
-                cell, 6 * options_->neighborhood_size);
-      } else {
-        bias = 0.0;
-      }
-      if (options_->locality_bias != 0.0) {
-        unsigned neighbors =
-            player_position.Get18Neighbors(cell) & kAndTo12Neighbors;
-        if (neighbors != 0) {
-          bias += options_->locality_bias;
-        }
-      }
-      kid->set_bias(bias);
+      kids.set_bias(i - 1, biases[i - 1]);
 
       if (options_->use_rave_randomization) {
         kid->UpdateRave(
@@ -519,89 +1501,117 @@ class TranspositionTable {
             prior_num_simulations_base);
       }
     }
-    if (antimate_move_count > 1) {
-      // Without the test for position_hash != kRootHash, player's
-      // defeat in 2 would not end the controller's search early.
-      if (position_hash != kRootHash) {
-        MctsNode* node = FindNode(position_hash);
-        assert(node != NULL);
-        node->UpdateUcbReward(WonInNPlies(2));
-        return true;
-      }
-    } else if (antimate_move_count == 1) {
-      for (MoveIndex move = kZerothMove;
-           move < position->NumAvailableMoves(); move = NextMove(move)) {
-        const Cell cell = Position::MoveIndexToCell(move);
-        if (!position->CellIsEmpty(cell) || cell == antimate_move)
-          continue;
-        const Hash kid_hash =
-            Position::ModifyZobristHash(position_hash, player, move);
-        MctsNode* kid = FindNode(kid_hash);
-        assert(kid != NULL);
-        kid->UpdateUcbReward(LostInNPlies(1));
+    if (antimate_move_count == 1) {
+      for (i = begin; i < kids.size(); ++i) {
+        if (kids.cell(i) != antimate_move)
+          kids.node(i)->UpdateUcbReward(LostInNPlies(1));
       }
     }
     // TODO(mciura): Make these updates atomic.
-    for (int i = 0, size = winning_kids_.size(); i < size; ++i) {
-      if (!ResultIsForced(winning_kids_[i]->ucb_reward())) {
-        winning_kids_[i]->UpdateUcbReward(WonInNPlies(2));
+    for (int j = 0, size = winning_kids_.size(); j < size; ++j) {
+      if (!ResultIsForced(winning_kids_[j]->ucb_reward())) {
+        winning_kids_[j]->UpdateUcbReward(WonInNPlies(2));
       }
     }
-    return true;
+  }
+
+  // Returns the kid of the expanded position with the given hash that
+  // moves into cell, or NULL.
+  MctsNode* FindKid(Hash position_hash, Cell cell) const {
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      if (kids.cell(i) == cell)
+        return kids.node(i);
+    }
+    return NULL;
   }
 
   void GetTwoMostSimulatedKids(Hash position_hash,
-                               Player player,
-                               MoveIndex move_count,
                                MoveInfo* kid_1,
                                MoveInfo* kid_2) const {
     kid_1->move = kid_2->move = kInvalidMove;
     kid_1->num_simulations = kid_2->num_simulations = INT_MIN;
     kid_1->win_ratio = kid_2->win_ratio = NAN;
-    for (MoveIndex move = kZerothMove; move < move_count;
-         move = NextMove(move)) {
-      const Hash kid_position_hash =
-          Position::ModifyZobristHash(position_hash, player, move);
-      const MctsNode* kid = FindNode(kid_position_hash);
-      if (kid != NULL) {
-        const int num_simulations = GetAdjustedNumSimulations(kid);
-        assert(num_simulations > INT_MIN);
-        if (num_simulations > kid_1->num_simulations) {
-          *kid_2 = *kid_1;
-          kid_1->move = move;
-          kid_1->num_simulations = num_simulations;
-          kid_1->win_ratio = GetNodeWinRatio(kid);
-        } else if (num_simulations > kid_2->num_simulations) {
-          kid_2->move = move;
-          kid_2->num_simulations = num_simulations;
-          kid_2->win_ratio = GetNodeWinRatio(kid);
-        }
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const MctsNode* kid = kids.node(i);
+      const int num_simulations = GetAdjustedNumSimulations(kid);
+      assert(num_simulations > INT_MIN);
+      if (num_simulations > kid_1->num_simulations) {
+        *kid_2 = *kid_1;
+        kid_1->move = Position::CellToMoveIndex(kids.cell(i));
+        kid_1->num_simulations = num_simulations;
+        kid_1->win_ratio = GetNodeWinRatio(kid);
+      } else if (num_simulations > kid_2->num_simulations) {
+        kid_2->move = Position::CellToMoveIndex(kids.cell(i));
+        kid_2->num_simulations = num_simulations;
+        kid_2->win_ratio = GetNodeWinRatio(kid);
       }
     }
   }
 
-  MctsNode* SelectKidForExploration(Hash position_hash,
-                                    const MctsNode* node,
-                                    Player player,
-                                    MoveIndex move_count,
-                                    MoveIndex* kid_index,
-                                    Hash* kid_position_hash,
+  void GetKidMoves(Hash position_hash, std::vector<MoveInfo>* moves) const {
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const MctsNode* kid = kids.node(i);
+      MoveInfo move;
+      move.move = Position::CellToMoveIndex(kids.cell(i));
+      move.num_simulations = GetAdjustedNumSimulations(kid);
+      move.win_ratio = GetNodeWinRatio(kid);
+      moves->push_back(move);
+    }
+  }
+
+  // Chooses among the kids unveiled by progressive widening so far
+  // unless all of them lose or draw, which proves nothing about the
+  // position while other kids remain.
+  MctsNode* SelectKidForExploration(const MctsNode* node,
+                                    const KidBlock& kids,
+                                    int* kid_index,
                                     bool* has_forced_result) {
-    return (this->*mcts_strategies_[options_->exploration_strategy])(
-        position_hash, node, player, move_count,
-        kid_index, kid_position_hash, has_forced_result);
+    MctsNode* (TranspositionTable::*strategy)(
+        const MctsNode*, const KidBlock&, int*, bool*) =
+            mcts_strategies_[options_->exploration_strategy];
+    const int num_kids = NumKidsToConsider(node, kids.size());
+    if (num_kids < kids.size()) {
+      MctsNode* kid = (this->*strategy)(
+          node, kids.Prefix(num_kids), kid_index, has_forced_result);
+      if (kid != NULL &&
+          (!*has_forced_result || VictoryIsForced(kid->ucb_reward()))) {
+        return kid;
+      }
+      *has_forced_result = false;
+    }
+    return (this->*strategy)(node, kids, kid_index, has_forced_result);
+  }
+
+  // Returns how many kids of node progressive widening unveils:
+  // options_->widening_base plus options_->widening_factor times
+  // the logarithm of the simulations of node.
+  int NumKidsToConsider(const MctsNode* node, int num_kids) const {
+    if (options_->widening_base <= 0)
+      return num_kids;
+    const int num_simulations = std::max(node->ucb_num_simulations(), 1);
+    const int n = options_->widening_base + static_cast<int>(
+        options_->widening_factor * logf(num_simulations));
+    return std::min(n, num_kids);
   }
 
-  void PrintDebugInfo(Player player, const Position& position) {
-    Hash position_hash = kRootHash;
-    MctsNode* root = InsertKey(position_hash);
-    if (root == NULL)
-      root = nodes_->FindValue(position_hash);
-    assert(root != NULL);
+  void PrintDebugInfo(Player player) {
+    Hash position_hash = root_hash_;
+    // The root is pinned, unless the table had no room for it.
+    const TableEntry* root_entry = FindEntry(position_hash);
+    if (root_entry == NULL)
+      return;
+    const MctsNode* root = root_entry->node();
     if (root->HasForcedResult())
       fprintf(stderr, "%s\n", root->ForcedResultToString().c_str());
     std::string result = StringPrintf(
-        "%c %d ", player["xo"], nodes_->num_elements());
+        "%c %d ", player["xo"], nodes()->num_elements());
+    if (nodes()->num_evictions() != 0)
+      result += StringPrintf("(%d evicted) ", nodes()->num_evictions());
+    if (expansion_failure_count() != 0)
+      result += StringPrintf("(%d unexpanded) ", expansion_failure_count());
     result += GetNodeInfo(root->ucb_num_simulations(),
                           GetNodeWinRatio(root), true);
     result += '\n';
@@ -609,16 +1619,14 @@ class TranspositionTable {
     MoveInfo kid_1;
     MoveInfo kid_2;
     std::string appendix;
-    GetTwoMostSimulatedKids(
-        position_hash, player, position.NumAvailableMoves(), &kid_1, &kid_2);
+    GetTwoMostSimulatedKids(position_hash, &kid_1, &kid_2);
     if (kid_2.move != kInvalidMove) {
       appendix += ToString(Position::MoveIndexToCell(kid_2.move));
       appendix += ':';
       appendix += GetNodeInfo(kid_2.num_simulations, kid_2.win_ratio, 0);
     }
     for (int i = 0; /**/; ++i) {
-      GetTwoMostSimulatedKids(
-          position_hash, player, position.NumAvailableMoves(), &kid_1, &kid_2);
+      GetTwoMostSimulatedKids(position_hash, &kid_1, &kid_2);
       if (kid_1.move == kInvalidMove)
         break;
       if (kid_1.num_simulations <= 100 &&
@@ -655,19 +1663,12 @@ class TranspositionTable {
 
     int last_move = Position::MoveIndexToCell(position.NumAvailableMoves());
 
-    for (MoveIndex move = kZerothMove; move < kNumMovesOnBoard;
-         move = NextMove(move)) {
-      const Cell cell = Position::MoveIndexToCell(move);
-      if (!position.CellIsEmpty(cell) && cell != last_move)
-        continue;
-      const MoveIndex move2 = Position::CellToMoveIndex(cell);
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const MctsNode* kid = kids.node(i);
+      const MoveIndex move2 = Position::CellToMoveIndex(kids.cell(i));
       assert(move2 >= kZerothMove);
       assert(move2 < kNumMovesOnBoard);
-      const Hash kid_position_hash =
-          Position::ModifyZobristHash(position_hash, player, move2);
-      const MctsNode* kid = FindNode(kid_position_hash);
-      if (kid == NULL)
-        continue;
       const float ucb_win_ratio = 100.0f * GetNodeWinRatio(kid);
       const float rave_win_ratio =
           50.0f + 50.0f * kid->rave_reward() /
@@ -790,6 +1791,8 @@ class TranspositionTable {
   }
 
   void DumpGameTree(Hash position_hash,
+                    const MctsNode* node,
+                    float bias,
                     Player player,
                     int depth,
                     int parent_simulations,
@@ -798,9 +1801,6 @@ class TranspositionTable {
                     FILE* file) {
     if (depth < 0)
       return;
-    const MctsNode* node = FindNode(position_hash);
-    if (node == NULL)
-      return;
     fprintf(file, "%s %s\t%s\t%.7g\n",
             prefix.c_str(),
             GetNodeInfo(
@@ -813,28 +1813,27 @@ class TranspositionTable {
                 false).c_str(),
             get_score_[options_->exploration_strategy](
                 node,
+                bias,
                 options_->exploration_factor * logf(parent_simulations),
                 options_->rave_bias,
                 options_->first_play_urgency));
-    for (YCoord y = kLastRow; y >= kGapAround; y = PrevY(y)) {
-      for (XCoord x = kGapLeft; x < kPastColumns; x = NextX(x)) {
-        if (!LiesOnBoard(x, y))
-          continue;
-        const Cell cell = XYToCell(x, y);
-        const MoveIndex move = Position::CellToMoveIndex(cell);
-        assert(move >= kZerothMove);
-        assert(move < kNumMovesOnBoard);
-        const Hash kid_position_hash =
-            Position::ModifyZobristHash(position_hash, player, move);
-        std::string new_prefix = "  " + prefix + ' ' + ToString(cell);
-        if (position.CellIsEmpty(cell))
-          new_prefix += '.';
-        else
-          new_prefix += '#';
-        DumpGameTree(kid_position_hash, Opponent(player), depth - 1,
-                     node->ucb_num_simulations(),
-                     new_prefix.c_str(), position, file);
-      }
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const Cell cell = kids.cell(i);
+      const MoveIndex move = Position::CellToMoveIndex(cell);
+      assert(move >= kZerothMove);
+      assert(move < kNumMovesOnBoard);
+      const Hash kid_position_hash =
+          Position::ModifyZobristHash(position_hash, player, move);
+      std::string new_prefix = "  " + prefix + ' ' + ToString(cell);
+      if (position.CellIsEmpty(cell))
+        new_prefix += '.';
+      else
+        new_prefix += '#';
+      DumpGameTree(kid_position_hash, kids.node(i), kids.bias(i),
+                   Opponent(player), depth - 1,
+                   node->ucb_num_simulations(),
+                   new_prefix.c_str(), position, file);
     }
   }
 
@@ -842,25 +1841,19 @@ class TranspositionTable {
                  Player player,
                  const Position& start_position,
                  std::string* status) const {
-    int board_info[kNumMovesOnBoard];
+    int board_info[kNumMovesOnBoard] = { 0 };
     int max_num_simulations = 0;
-    Hash best_move_hash = kRootHash;
-    for (MoveIndex move = kZerothMove; move < kNumMovesOnBoard;
-         move = NextMove(move)) {
-      const Cell cell = Position::MoveIndexToCell(move);
-      const MoveIndex move2 = Position::CellToMoveIndex(cell);
-      assert(move2 >= kZerothMove);
-      assert(move2 < kNumMovesOnBoard);
-      const Hash kid_position_hash =
-          Position::ModifyZobristHash(position_hash, player, move2);
-      const MctsNode* kid = FindNode(kid_position_hash);
-      if (kid != NULL)
-        board_info[move2] = kid->ucb_num_simulations();
-      else
-        board_info[move2] = 0;
-      if (board_info[move2] > max_num_simulations) {
-        max_num_simulations = board_info[move2];
-        best_move_hash = kid_position_hash;
+    Hash best_move_hash = position_hash;
+    const KidBlock kids = GetKids(position_hash);
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const MoveIndex move = Position::CellToMoveIndex(kids.cell(i));
+      assert(move >= kZerothMove);
+      assert(move < kNumMovesOnBoard);
+      board_info[move] = kids.node(i)->ucb_num_simulations();
+      if (board_info[move] > max_num_simulations) {
+        max_num_simulations = board_info[move];
+        best_move_hash =
+            Position::ModifyZobristHash(position_hash, player, move);
       }
     }
     const float sqrt_max_num_simulations = sqrt(max_num_simulations);
@@ -894,43 +1887,47 @@ class TranspositionTable {
       std::vector<std::vector<Cell> >* cell_list) const {
     std::vector<Cell> cells;
     std::set<Hash> dumped;
+    const TableEntry* root_entry = FindEntry(root_hash_);
+    if (root_entry == NULL)
+      return;
     GetPositionsHelper(
-        player, position, kRootHash, lower, upper, cell_list, &cells, &dumped);
+        player, position, root_hash_, root_entry->node(),
+        lower, upper, cell_list, &cells, &dumped);
   }
 
  private:
-  //
-  typedef float (*GetScore)(const MctsNode*, float, float, float);
-
-  const MctsNode* FindNode(Hash position_hash) const {
-    return nodes_->FindValue(position_hash);
+  const TableEntry* FindEntry(Hash position_hash) const {
+    return nodes()->FindValue(position_hash);
   }
 
+  HashMap* nodes() const { return storage_->nodes(); }
+  KidArena* kid_arena() const { return storage_->kids(); }
+
   void GetPositionsHelper(
       Player player,
       const Position& position,
       Hash position_hash,
+      const MctsNode* node,
       int lower,
       int upper,
       std::vector<std::vector<Cell> >* cell_list,
       std::vector<Cell>* cells,
       std::set<Hash>* dumped) const {
-    const MctsNode* node = FindNode(position_hash);
     if (node->ucb_num_simulations() < lower) {
       return;
     } else if (node->ucb_num_simulations() > upper) {
+      const KidBlock kids = GetKids(position_hash);
+      if (kids.empty())
+        return;
       cells->push_back(kZerothCell);
-      for (MoveIndex move = kZerothMove; move < kNumMovesOnBoard;
-           move = NextMove(move)) {
-        const Hash kid_position_hash =
-            Position::ModifyZobristHash(position_hash, player, move);
-        const MctsNode* kid = FindNode(kid_position_hash);
-        if (kid != NULL) {
-          cells->back() = Position::MoveIndexToCell(move);
-          GetPositionsHelper(
-              Opponent(player), position, kid_position_hash,
-              lower, upper, cell_list, cells, dumped);
-        }
+      for (int i = 0, size = kids.size(); i < size; ++i) {
+        const Cell cell = kids.cell(i);
+        const Hash kid_position_hash = Position::ModifyZobristHash(
+            position_hash, player, Position::CellToMoveIndex(cell));
+        cells->back() = cell;
+        GetPositionsHelper(
+            Opponent(player), position, kid_position_hash, kids.node(i),
+            lower, upper, cell_list, cells, dumped);
       }
       cells->pop_back();
     } else {
@@ -942,41 +1939,39 @@ class TranspositionTable {
   }
 
   // TODO(mciura)
+#ifdef USE_VECTORIZED_SCORES
+  template<GetScore get_score, GetScoreVector get_score_vector>
+#else
   template<GetScore get_score>
-  MctsNode* ArgMax(Hash position_hash,
-                   const MctsNode* node,
-                   Player player,
-                   MoveIndex move_count,
-                   MoveIndex* kid_index,
-                   Hash* kid_position_hash,
+#endif  // USE_VECTORIZED_SCORES
+  MctsNode* ArgMax(const MctsNode* node,
+                   const KidBlock& kids,
+                   int* kid_index,
                    bool* has_forced_result) {
     assert(node != NULL);
-    const int num_simulations = node->ucb_num_simulations();
-    assert(num_simulations > 0);
+    // The root of a reused subtree may have no simulations of its own.
+    const int num_simulations = std::max(node->ucb_num_simulations(), 1);
     const float log_parent_simulations =
         options_->exploration_factor * logf(num_simulations);
-    const float rave_bias = options_->rave_bias;
-    const float first_play_urgency = options_->first_play_urgency;
     float best_value = -FLT_MAX;
-    MctsNode* best_kid = NULL;
-    for (MoveIndex move = kZerothMove; move < move_count;
-         move = NextMove(move)) {
-      const Hash ith_kid_position_hash =
-          Position::ModifyZobristHash(position_hash, player, move);
-      MctsNode* kid = FindNode(ith_kid_position_hash);
-      if (kid != NULL) {
-        float value = get_score(
-            kid, log_parent_simulations, rave_bias, first_play_urgency);
-        if (value > best_value) {
-          best_value = value;
-          best_kid = kid;
-          *kid_index = move;
-          *kid_position_hash = ith_kid_position_hash;
-          *has_forced_result = ResultIsForced(value);
-        }
-      }
-    }
-    return best_kid;
+#ifdef USE_VECTORIZED_SCORES
+    const int best_kid = ScoresFasterVectorized<get_score>::value ?
+        FindBestKidVectorized<get_score, get_score_vector>(
+            kids, log_parent_simulations, options_->rave_bias,
+            options_->first_play_urgency, &best_value) :
+        FindBestKid<get_score>(
+            kids, 0, log_parent_simulations, options_->rave_bias,
+            options_->first_play_urgency, &best_value);
+#else
+    const int best_kid = FindBestKid<get_score>(
+        kids, 0, log_parent_simulations, options_->rave_bias,
+        options_->first_play_urgency, &best_value);
+#endif  // USE_VECTORIZED_SCORES
+    if (best_kid == -1)
+      return NULL;
+    *kid_index = best_kid;
+    *has_forced_result = ResultIsForced(best_value);
+    return kids.node(best_kid);
   }
 
   void LookForMate(
@@ -992,13 +1987,13 @@ class TranspositionTable {
     }
   }
 
-  // TODO(mciura)
-  static HashMap* nodes_;
+  // The nodes shared with the other engines of the same Controller.
+  TreeStorage* storage_;
 
   MctsNode* (TranspositionTable::*mcts_strategies_[kNumStrategies])(
-      Hash, const MctsNode*, Player, MoveIndex, MoveIndex*, Hash*, bool*);
+      const MctsNode*, const KidBlock&, int*, bool*);
 
-  float (*get_score_[kNumStrategies])(const MctsNode*, float, float, float);
+  GetScore get_score_[kNumStrategies];
   
   const MctsOptions* options_;
 
@@ -1012,58 +2007,119 @@ class TranspositionTable {
 
   int winning_move_count_;
 
+  Hash root_hash_;
+
   TranspositionTable(const TranspositionTable&);
   void operator=(const TranspositionTable&);
 };
 
-HashMap* TranspositionTable::nodes_;
+//-- PlayoutPipeline --------------------------------------------------
+// A leaf reached by a selecting engine. The path and moves let it
+// backpropagate the result of the playout.
+struct PlayoutRequest {
+  PathStep path[kNumMovesOnBoard + 1];
+  int path_length;
+  Cell moves[kNumMovesOnBoard];
+  int num_moves;
+  int empty_cell_count_at_bottom;
+  // Where the engine that plays out the leaf puts it back.
+  LockFreeQueue<PlayoutRequest*>* finished_playouts;
+  // Filled in by the engine that plays out the leaf.
+  int reward;
+  RaveUpdates rave;
+};
 
 namespace {
 
-struct InitModule {
-  InitModule() { TranspositionTable::InitStaticFields(); }
-} init_module;
+int RoundUpToPowerOfTwo(int n) {
+  int power = 1;
+  while (power < n) {
+    power *= 2;
+  }
+  return power;
+}
 
 }  // namespace
 
+PlayoutPipeline::PlayoutPipeline(int max_num_selecting_engines)
+    : requests_(new LockFreeQueue<PlayoutRequest*>(RoundUpToPowerOfTwo(
+          std::max(max_num_selecting_engines, 1) * kMaxPlayoutsInFlight))),
+      num_selecting_engines_(0) {}
+
+PlayoutPipeline::~PlayoutPipeline() {
+  delete requests_;
+}
+
 //-- MctsEngine -------------------------------------------------------
 MctsEngine::MctsEngine(MctsOptions* options, Playout* playout)
     : transposition_table_(
           new TranspositionTable(options, playout->rng())),
       playout_(playout),
-      options_(options) {
+      options_(options),
+      path_length_(0),
+      use_virtual_loss_(options->use_virtual_loss),
+      playout_requests_(new PlayoutRequest[kMaxPlayoutsInFlight]),
+      finished_playouts_(
+          new LockFreeQueue<PlayoutRequest*>(kMaxPlayoutsInFlight)) {
   // So that DumpGameTree() works before any move.
   position_.InitToStartPosition();
+  root_hash_ = position_.hash();
+  transposition_table_->set_root_hash(root_hash_);
+  for (int i = 0; i < kMaxPlayoutsInFlight; ++i) {
+    playout_requests_[i].finished_playouts = finished_playouts_;
+    free_playout_requests_.push_back(&playout_requests_[i]);
+  }
 }
 
 MctsEngine::~MctsEngine() {
+  delete finished_playouts_;
+  delete[] playout_requests_;
   delete transposition_table_;
 }
 
 void MctsEngine::UpdateRaveInTree(Hash position_hash,
+                                  TableEntry* entry,
                                   Player player,
                                   int move_index,
                                   int reward,
                                   int num_simulations) {
-  for (MoveIndex move = kZerothMove, size = position_.NumAvailableMoves();
-       move < size; move = NextMove(move)) {
-    if (rave_[player][move] != 0) {
+  const KidBlock kids = transposition_table_->GetKids(entry);
+  if (!kids.empty()) {
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      const Cell cell = kids.cell(i);
+      if (position_.CellIsEmpty(cell)) {
+        const int rave = rave_.at(player, Position::CellToMoveIndex(cell));
+        if (rave != 0)
+          kids.node(i)->UpdateRave(rave, num_simulations);
+      } else {
+        // The cell was filled in the tree below this position.
+        const int n = tree_move_numbers_[cell] - move_index;
+        assert(n >= 0);
+        if (n % 2 == 0)
+          kids.node(i)->UpdateRave(-reward, num_simulations);
+      }
+    }
+    return;
+  }
+  for (int i = 0, size = rave_.size(); i < size; ++i) {
+    const int rave = rave_.reward(i);
+    if (rave_.player(i) == player && rave != 0) {
       const Hash kid_position_hash =
-          Position::ModifyZobristHash(position_hash, player, move);
-      MctsNode* kid = transposition_table_->InsertKey(kid_position_hash);
+          Position::ModifyZobristHash(position_hash, player, rave_.move(i));
+      TableEntry* kid = transposition_table_->InsertKey(kid_position_hash);
       if (kid == NULL)
         return;
-      kid->UpdateRave(rave_[player][move], num_simulations);
+      kid->node()->UpdateRave(rave, num_simulations);
     }
   }
   for (int i = move_index, end = moves_.size(); i < end; i += 2) {
     const Hash kid_position_hash =
         Position::ModifyZobristHash(
             position_hash, player, Position::CellToMoveIndex(moves_[i]));
-    MctsNode* kid = transposition_table_->InsertKey(kid_position_hash);
+    TableEntry* kid = transposition_table_->InsertKey(kid_position_hash);
     if (kid == NULL)
       return;
-    kid->UpdateRave(-reward, num_simulations);
+    kid->node()->UpdateRave(-reward, num_simulations);
   }
 }
 
@@ -1072,7 +2128,8 @@ int MctsEngine::GetPlayoutResult(
   int sum = 0;
   for (int i = options_->play_n_playouts_at_once; i > 0; --i) {
     int num_moves;
-    const int result = playout_->Play(player, last_move, rave_, &num_moves);
+    const int result =
+        playout_->Play(player, last_move, moves_, &rave_, &num_moves);
     stats_[empty_cell_count].Add(num_moves);
     if (result != 0)
       sum += 2 * ((result % 2) ^ player) - 1;
@@ -1080,132 +2137,194 @@ int MctsEngine::GetPlayoutResult(
   return sum;
 }
 
-int MctsEngine::Descend(Hash position_hash,
-                        MctsNode* node,
-                        Player player,
-                        Cell last_move,
-                        int empty_cell_count) {
-  MctsNode* kid;
-  Hash kid_position_hash;
-  MoveIndex kid_index;
-  const bool nonzero_visits_left = node->decrement_visits_to_go_if_nonzero();
-  if (nonzero_visits_left) {
-    kid_index = node->kid_to_visit();
-    kid_position_hash =
-        Position::ModifyZobristHash(position_hash, player, kid_index);
-    kid = transposition_table_->FindNode(kid_position_hash);
-    if (kid != NULL && kid->HasForcedResult())
-      node->set_visits_to_go(0);    
-  } else {
-    bool has_forced_result = false;
-    kid = transposition_table_->SelectKidForExploration(
-        position_hash,
-        node,
-        player,
-        position_.NumAvailableMoves(),
-        &kid_index,
-        &kid_position_hash,
-        &has_forced_result);
-    if (!has_forced_result) {
-      if (kid != NULL) {
-        node->set_kid_to_visit(kid_index);
-        node->set_visits_to_go(
-            options_->tricky_epsilon * kid->ucb_num_simulations() + 1);
+bool MctsEngine::SelectLeaf(
+    MctsNode* root, Cell last_move, int empty_cell_count, int* reward) {
+  path_length_ = 0;
+  Hash position_hash = root_hash_;
+  MctsNode* node = root;
+  Player player = player_;
+  while (true) {
+    const int node_reward = node->ucb_reward();
+    if (ResultIsForced(node_reward)) {
+      *reward = (path_length_ == 0) ? node_reward : NegateKidReward(node_reward);
+      return false;
+    }
+    int num_simulations;
+    if (use_virtual_loss_) {
+      num_simulations = node->UpdateUcbNumSimulations(
+          options_->play_n_playouts_at_once);
+    } else {
+      num_simulations = node->ucb_num_simulations();
+    }
+    PathStep* step = &path_[path_length_++];
+    step->position_hash = position_hash;
+    step->node = node;
+    step->player = player;
+    step->last_move = last_move;
+    step->move_index = moves_.size();
+    step->empty_cell_count = empty_cell_count;
+    // The path only keeps the entries of expanded positions,
+    // which cannot be evicted while it is in use.
+    TableEntry* entry = transposition_table_->FindExpandedEntry(position_hash);
+    step->entry = NULL;
+    if (empty_cell_count == 0) {
+      empty_cell_count_at_bottom_ = 0;
+      *reward = kBoardFilledDraw;
+      return false;
+    } else if (entry == NULL) {
+      if (num_simulations < options_->expand_after_n_playouts) {
+        empty_cell_count_at_bottom_ = empty_cell_count;
+        return true;
+      }
+      entry = transposition_table_->InsertKey(position_hash);
+      if (entry == NULL)
+        transposition_table_->CountExpansionFailure();
+      if (entry == NULL ||
+          !transposition_table_->ExpandNode(
+              position_hash, node, entry, player, &position_)) {
+        empty_cell_count_at_bottom_ = empty_cell_count;
+        return true;
+      }
+    }
+    step->entry = entry;
+    // Progressive widening unveils more kids as the position gets
+    // simulated more.
+    if (entry->num_kids() < entry->num_moves()) {
+      const int num_kids = transposition_table_->NumKidsToConsider(
+          node, entry->num_moves());
+      if (num_kids > entry->num_kids()) {
+        transposition_table_->UnveilKids(
+            position_hash, entry, player, &position_, num_kids);
       }
+    }
+    KidBlock kids = transposition_table_->GetKids(entry);
+    assert(!kids.empty());
+    MctsNode* kid;
+    int kid_index;
+    if (entry->decrement_visits_to_go_if_nonzero()) {
+      kid_index = entry->kid_to_visit();
+      assert(kid_index < kids.size());
+      kid = kids.node(kid_index);
+      if (kid->HasForcedResult())
+        entry->set_visits_to_go(0);
     } else {
-      const int reward = kid->ucb_reward();
-      if (DefeatIsForced(reward))
-        return WonInNPlies(DefeatToPlies(reward) + 1);
-      else if (DrawIsForced(reward))
-        return kBoardFilledDraw;
-      else if (VictoryIsForced(reward))
-        return LostInNPlies(VictoryToPlies(reward) + 1);
-      else
-        assert(false);
+      bool has_forced_result = false;
+      kid = transposition_table_->SelectKidForExploration(
+          node, kids, &kid_index, &has_forced_result);
+      if (has_forced_result && !VictoryIsForced(kid->ucb_reward()) &&
+          kids.size() < entry->num_moves()) {
+        // Losing or drawing in all unveiled kids proves nothing
+        // while other moves remain.
+        if (!transposition_table_->UnveilKids(
+                position_hash, entry, player, &position_,
+                entry->num_moves())) {
+          empty_cell_count_at_bottom_ = empty_cell_count;
+          return true;
+        }
+        kids = transposition_table_->GetKids(entry);
+        has_forced_result = false;
+        kid = transposition_table_->SelectKidForExploration(
+            node, kids, &kid_index, &has_forced_result);
+      }
+      if (!has_forced_result) {
+        if (kid != NULL) {
+          entry->set_kid_to_visit(kid_index);
+          entry->set_visits_to_go(
+              options_->tricky_epsilon * kid->ucb_num_simulations() + 1);
+        }
+      } else {
+        const int kid_reward = kid->ucb_reward();
+        if (DefeatIsForced(kid_reward))
+          *reward = WonInNPlies(DefeatToPlies(kid_reward) + 1);
+        else if (DrawIsForced(kid_reward))
+          *reward = kBoardFilledDraw;
+        else if (VictoryIsForced(kid_reward))
+          *reward = LostInNPlies(VictoryToPlies(kid_reward) + 1);
+        else
+          assert(false);
+        return false;
+      }
     }
-  }
-  if (kid != NULL) {
-    const Cell cell = Position::MoveIndexToCell(kid_index);
+    if (kid == NULL) {
+      empty_cell_count_at_bottom_ = empty_cell_count;
+      return true;
+    }
+    const Cell cell = kids.cell(kid_index);
     assert(position_.CellIsEmpty(cell));
-    const int result = position_.MakeMoveReversibly(player, cell, &memento_);
-    if (result != 0) {
+    if (position_.MakeMoveReversibly(player, cell, &memento_) != 0) {
       if (options_->use_solver) {
         kid->UpdateUcbReward(WonInNPlies(0));
-        return LostInNPlies(1);
+        *reward = LostInNPlies(1);
       } else {
         kid->UpdateUcbReward(+1);
-        return -1;
+        *reward = -1;
       }
-    } else {
-      moves_.push_back(cell);
-      const int reward = UpdateNodeAndGetReward(
-          kid_position_hash, kid, Opponent(player),
-          cell, empty_cell_count - 1);
-      if (DefeatIsForced(reward))
-        return +1;
-      else if (DrawIsForced(reward))
-        return 0;
-      else if (VictoryIsForced(reward))
-        return LostInNPlies(VictoryToPlies(reward) + 1);
-      return -reward;
+      return false;
     }
-  } else {
-    return GetPlayoutResult(player, last_move, empty_cell_count);
+    tree_move_numbers_[cell] = moves_.size();
+    moves_.push_back(cell);
+    position_hash = Position::ModifyZobristHash(
+        position_hash, player, Position::CellToMoveIndex(cell));
+    node = kid;
+    player = Opponent(player);
+    last_move = cell;
+    --empty_cell_count;
   }
 }
 
-int MctsEngine::UpdateNodeAndGetReward(Hash position_hash,
-                                       MctsNode* node,
-                                       Player player,
-                                       Cell last_move,
-                                       int empty_cell_count) {
-  assert(node != NULL);
-  int reward = node->ucb_reward();  
-  if (ResultIsForced(reward))
-    return reward;
-  int num_simulations;
-  if (options_->use_virtual_loss) {
-    num_simulations = node->UpdateUcbNumSimulations(
-        options_->play_n_playouts_at_once);
-  } else {
-    num_simulations = node->ucb_num_simulations();
-  }
-  const int current_move_index = moves_.size();
-  if (empty_cell_count == 0) {
-    empty_cell_count_at_bottom_ = 0;
-    reward = kBoardFilledDraw;
-  } else if (num_simulations < options_->expand_after_n_playouts) {
-    empty_cell_count_at_bottom_ = empty_cell_count;
-    reward = GetPlayoutResult(player, last_move, empty_cell_count);
-  } else if (num_simulations == options_->expand_after_n_playouts) {
-    if (transposition_table_->ExpandNode(position_hash, player, &position_)) {
-      reward = Descend(
-          position_hash, node, player, last_move, empty_cell_count);
-    } else {
-      empty_cell_count_at_bottom_ = empty_cell_count;
-      reward = GetPlayoutResult(player, last_move, empty_cell_count);
+void MctsEngine::Backpropagate(int reward) {
+  for (int i = path_length_ - 1; i >= 0; --i) {
+    const PathStep& step = path_[i];
+    if (i < path_length_ - 1)
+      reward = NegateKidReward(reward);
+    if (!ResultIsForced(reward) &&
+        step.empty_cell_count - empty_cell_count_at_bottom_ <=
+            options_->rave_update_depth) {
+      UpdateRaveInTree(step.position_hash, step.entry, step.player,
+                       step.move_index, reward,
+                       options_->play_n_playouts_at_once);
     }
-  } else {
-    reward = Descend(position_hash, node, player, last_move, empty_cell_count);
-  }
-  if (!ResultIsForced(reward) &&
-      empty_cell_count - empty_cell_count_at_bottom_ <=
-          options_->rave_update_depth) {
-    UpdateRaveInTree(position_hash, player, current_move_index, reward,
-                     options_->play_n_playouts_at_once);
+    if (use_virtual_loss_)
+      step.node->UpdateUcbReward(reward);
+    else
+      step.node->UpdateUcb(reward, options_->play_n_playouts_at_once);
   }
-  if (!options_->use_virtual_loss)
-    node->UpdateUcbNumSimulations(options_->play_n_playouts_at_once);
-  node->UpdateUcbReward(reward);
-  return reward;
+}
+
+void MctsEngine::set_tree_storage(TreeStorage* tree_storage) {
+  transposition_table_->set_storage(tree_storage);
 }
 
 void MctsEngine::ClearTranspositionTable() {
   transposition_table_->Clear();
 }
 
+bool MctsEngine::TranspositionTableNeedsClearing() const {
+  return transposition_table_->NeedsClearing();
+}
+
+bool MctsEngine::TranspositionTableNeedsPruning() const {
+  return transposition_table_->NeedsPruning();
+}
+
+void MctsEngine::PrepareTranspositionTable(const Position& start_position) {
+  const Hash root_hash = start_position.hash();
+  if (TranspositionTableNeedsPruning())
+    transposition_table_->Prune(root_hash);
+  if (transposition_table_->PinRoot(root_hash) != NULL)
+    return;
+  // Every slot where the root could go holds an expanded position.
+  transposition_table_->Prune(root_hash);
+  if (transposition_table_->PinRoot(root_hash) != NULL)
+    return;
+  transposition_table_->Clear();
+  transposition_table_->PinRoot(root_hash);
+}
+
 void MctsEngine::SearchForMove(Player player,
                                const Position& start_position,
+                               SearchBudget* budget,
+                               PlayoutPipeline* pipeline,
                                volatile bool* terminate) {
   player_ = player;
   position_.CopyFrom(start_position);
@@ -1217,16 +2336,45 @@ void MctsEngine::SearchForMove(Player player,
 #endif
   const int num_available_moves = start_position.NumAvailableMoves();
   const Cell last_move = start_position.MoveNPliesAgo(0);
-  MctsNode* root = transposition_table_->InsertKey(kRootHash);
-  assert(root != NULL);
+  root_hash_ = start_position.hash();
+  transposition_table_->set_root_hash(root_hash_);
+  TableEntry* root_entry = transposition_table_->PinRoot(root_hash_);
+  if (root_entry == NULL) {
+    // PrepareTranspositionTable() makes room for the root.
+    if (pipeline != NULL)
+      AtomicIncrement(const_cast<int*>(&pipeline->num_selecting_engines_), -1);
+    return;
+  }
+  MctsNode* root = root_entry->node();
+  const KidBlock kids = transposition_table_->GetKids(root_entry);
+  if (!kids.empty() && root->ucb_num_simulations() == 0) {
+    // The simulations of a reused subtree were counted in the edge
+    // that led to it from the previous root.
+    int num_simulations = 0;
+    for (int i = 0, size = kids.size(); i < size; ++i) {
+      num_simulations += kids.node(i)->ucb_num_simulations();
+    }
+    root->UpdateUcbNumSimulations(num_simulations);
+  }
+  use_virtual_loss_ = options_->use_virtual_loss || pipeline != NULL;
   is_running_ = true;
-  for (int i = 1; !*terminate && !root->HasForcedResult(); ++i) {
-    moves_.clear();
-    memset(rave_, 0, sizeof rave_);
-    UpdateNodeAndGetReward(
-        kRootHash, root, player, last_move,
-        num_available_moves);
-    memento_.UndoAll();
+  if (pipeline != NULL) {
+    SearchWithPipeline(
+        root, last_move, num_available_moves, budget, pipeline, terminate);
+  } else {
+    while (!*terminate && !root->HasForcedResult() &&
+           !BudgetIsExhausted(budget)) {
+      moves_.clear();
+      rave_.Clear();
+      int reward;
+      if (SelectLeaf(root, last_move, num_available_moves, &reward)) {
+        const PathStep& leaf = path_[path_length_ - 1];
+        reward = GetPlayoutResult(
+            leaf.player, leaf.last_move, leaf.empty_cell_count);
+      }
+      Backpropagate(reward);
+      memento_.UndoAll();
+    }
   }
 #if 0
   fprintf(stderr, "\n");
@@ -1240,15 +2388,143 @@ void MctsEngine::SearchForMove(Player player,
 #endif
 }
 
+void MctsEngine::SearchWithPipeline(MctsNode* root,
+                                    Cell last_move,
+                                    int empty_cell_count,
+                                    SearchBudget* budget,
+                                    PlayoutPipeline* pipeline,
+                                    volatile bool* terminate) {
+  bool is_selecting = true;
+  while (true) {
+    if (is_selecting && (*terminate || root->HasForcedResult()))
+      is_selecting = false;
+    bool has_worked = false;
+    if (is_selecting && !free_playout_requests_.empty()) {
+      if (BudgetIsExhausted(budget)) {
+        is_selecting = false;
+      } else {
+        moves_.clear();
+        rave_.Clear();
+        int reward;
+        if (SelectLeaf(root, last_move, empty_cell_count, &reward)) {
+          PlayoutRequest* request = free_playout_requests_.back();
+          free_playout_requests_.pop_back();
+          memcpy(request->path, path_, path_length_ * sizeof path_[0]);
+          request->path_length = path_length_;
+          std::copy(moves_.begin(), moves_.end(), request->moves);
+          request->num_moves = moves_.size();
+          request->empty_cell_count_at_bottom = empty_cell_count_at_bottom_;
+          // The queue holds the leaves of all selecting engines.
+          const bool pushed = pipeline->requests_->Push(request);
+          assert(pushed);
+          (void)pushed;
+        } else {
+          Backpropagate(reward);
+        }
+        memento_.UndoAll();
+        has_worked = true;
+      }
+    }
+    // Backpropagates all the results that have come.
+    PlayoutRequest* request;
+    while (finished_playouts_->Pop(&request)) {
+      moves_.clear();
+      Player player = player_;
+      for (int i = 0; i < request->num_moves; ++i) {
+        const Cell cell = request->moves[i];
+        position_.MakeMoveReversibly(player, cell, &memento_);
+        tree_move_numbers_[cell] = i;
+        moves_.push_back(cell);
+        player = Opponent(player);
+      }
+      memcpy(path_, request->path, request->path_length * sizeof path_[0]);
+      path_length_ = request->path_length;
+      empty_cell_count_at_bottom_ = request->empty_cell_count_at_bottom;
+      rave_.CopyFrom(request->rave);
+      Backpropagate(request->reward);
+      memento_.UndoAll();
+      free_playout_requests_.push_back(request);
+      has_worked = true;
+    }
+    if (!is_selecting &&
+        static_cast<int>(free_playout_requests_.size()) ==
+            kMaxPlayoutsInFlight)
+      break;
+    // Rather than wait, helps the engines that only play out leaves.
+    if (!has_worked && !PlayRequestedPlayout(pipeline))
+      sched_yield();
+  }
+  AtomicIncrement(const_cast<int*>(&pipeline->num_selecting_engines_), -1);
+}
+
+void MctsEngine::RunPlayouts(
+    const Position& start_position, PlayoutPipeline* pipeline) {
+  position_.CopyFrom(start_position);
+  playout_->PrepareForPlayingFromPosition(&position_);
+  while (true) {
+    if (!PlayRequestedPlayout(pipeline)) {
+      // Selecting engines finish only when all their leaves are back.
+      if (pipeline->num_selecting_engines_ == 0)
+        break;
+      sched_yield();
+    }
+  }
+}
+
+bool MctsEngine::PlayRequestedPlayout(PlayoutPipeline* pipeline) {
+  PlayoutRequest* request;
+  if (!pipeline->requests_->Pop(&request))
+    return false;
+  const PathStep& leaf = request->path[request->path_length - 1];
+  // The leaf is reached from the root by alternate moves, the first
+  // of which is made by the player to move at the root.
+  Player player = Opponent(leaf.player);
+  if (request->num_moves % 2 == 0)
+    player = leaf.player;
+  moves_.assign(request->moves, request->moves + request->num_moves);
+  for (int i = 0; i < request->num_moves; ++i) {
+    position_.MakeMoveReversibly(player, request->moves[i], &memento_);
+    player = Opponent(player);
+  }
+  rave_.Clear();
+  request->reward = GetPlayoutResult(
+      leaf.player, leaf.last_move, leaf.empty_cell_count);
+  request->rave.CopyFrom(rave_);
+  memento_.UndoAll();
+  const bool pushed = request->finished_playouts->Push(request);
+  assert(pushed);
+  (void)pushed;
+  return true;
+}
+
+bool MctsEngine::BudgetIsExhausted(SearchBudget* budget) {
+  if (budget->max_nodes > 0 &&
+      expansion_count() - budget->initial_expansion_count >=
+          budget->max_nodes) {
+    return true;
+  }
+  return budget->max_playouts > 0 &&
+         AtomicIncrement(&budget->num_playouts,
+                         options_->play_n_playouts_at_once) >
+             budget->max_playouts;
+}
+
+void MctsEngine::set_random_seed(unsigned seed) {
+  playout_->rng()->Init(seed);
+}
+
 void MctsEngine::GetTwoBestMoves(MoveInfo* move_1, MoveInfo* move_2) const {
-  transposition_table_->GetTwoMostSimulatedKids(
-      kRootHash, player_, position_.NumAvailableMoves(), move_1, move_2);
+  transposition_table_->GetTwoMostSimulatedKids(root_hash_, move_1, move_2);
+}
+
+void MctsEngine::GetRootMoves(std::vector<MoveInfo>* moves) const {
+  transposition_table_->GetKidMoves(root_hash_, moves);
 }
 
 void MctsEngine::PrintDebugInfo(int sec) {
   fprintf(stderr, "\n%d:%02d ", sec / 60, sec % 60);
   if (is_running())
-    transposition_table_->PrintDebugInfo(player_, position_);
+    transposition_table_->PrintDebugInfo(player_);
   else
     fprintf(stderr, "(waiting)");
 }
@@ -1262,10 +2538,14 @@ bool MctsEngine::DumpGameTree(
   }
   if (filename.size() > 5 &&
       filename.substr(filename.size() - 5) == ".html") {
-    transposition_table_->DumpToHtml(kRootHash, player_, position_, file);
+    transposition_table_->DumpToHtml(root_hash_, player_, position_, file);
   } else {
-    transposition_table_->DumpGameTree(
-        kRootHash, player_, depth, 1, "", position_, file);
+    const TableEntry* root_entry = transposition_table_->FindEntry(root_hash_);
+    if (root_entry != NULL) {
+      transposition_table_->DumpGameTree(
+          root_hash_, root_entry->node(), 0.0f, player_, depth, 1, "",
+          position_, file);
+    }
   }
   if (fclose(file) != 0) {
     *error = StringPrintf("Cannot close file %s", filename.c_str());
@@ -1280,7 +2560,7 @@ void MctsEngine::GetStatus(const Position& start_position,
   first_status->clear();
   second_status->clear();
   Hash best_move_hash = transposition_table_->GetStatus(
-      kRootHash, player_,
+      root_hash_, player_,
       start_position, first_status);
   transposition_table_->GetStatus(
       best_move_hash, Opponent(player_),
@@ -1295,27 +2575,21 @@ void MctsEngine::GetPositions(
 
 void MctsEngine::GetSgf(int threshold, std::string* sgf) const {
   *sgf = StringPrintf("(;FF[4]SZ[%d]", SIDE_LENGTH);
-  for (MoveIndex move = kZerothMove; move < position_.NumAvailableMoves();
-       move = NextMove(move)) {  
+  const KidBlock kids = transposition_table_->GetKids(root_hash_);
+  for (int i = 0, size = kids.size(); i < size; ++i) {
     RecursiveGetSgf(
-        player_,
-        Position::ModifyZobristHash(kRootHash, player_, move),
-        Position::MoveIndexToCell(move),
-        threshold,
-        sgf);
+        player_, root_hash_, kids.cell(i), kids.node(i), threshold, sgf);
   }
   *sgf += ')';
 }
 
 void MctsEngine::RecursiveGetSgf(
     Player player,
-    Hash hash,
+    Hash parent_hash,
     Cell cell,
+    const MctsNode* node,
     int threshold,
     std::string* sgf) const {
-  const MctsNode* node = transposition_table_->FindNode(hash);
-  if (node == NULL)
-    return;
   const int ucb_num_simulations = node->ucb_num_simulations();
   if (ucb_num_simulations < threshold)
     return;
@@ -1326,24 +2600,285 @@ void MctsEngine::RecursiveGetSgf(
       ToString(cell).c_str(),
       ucb_reward + ucb_num_simulations,
       ucb_num_simulations);
-  for (MoveIndex move = kZerothMove; move < position_.NumAvailableMoves();
-       move = NextMove(move)) {  
+  const Hash hash = Position::ModifyZobristHash(
+      parent_hash, player, Position::CellToMoveIndex(cell));
+  const KidBlock kids = transposition_table_->GetKids(hash);
+  for (int i = 0, size = kids.size(); i < size; ++i) {
     RecursiveGetSgf(
-        Opponent(player),
-        Position::ModifyZobristHash(hash, Opponent(player), move),
-        Position::MoveIndexToCell(move),
-        threshold,
-        sgf);
+        Opponent(player), hash, kids.cell(i), kids.node(i), threshold, sgf);
   }
   *sgf += ')';
 }
 
+int MctsEngine::root_simulation_count() const {
+  const TableEntry* root_entry = transposition_table_->FindEntry(root_hash_);
+  return (root_entry == NULL) ? 0 : root_entry->node()->ucb_num_simulations();
+}
+
 int MctsEngine::node_count() const {
   return transposition_table_->node_count();
 }
 
+int MctsEngine::eviction_count() const {
+  return transposition_table_->eviction_count();
+}
+
+int MctsEngine::expansion_failure_count() const {
+  return transposition_table_->expansion_failure_count();
+}
+
+long long MctsEngine::expansion_count() const {
+  return transposition_table_->expansion_count();
+}
+
 PlayoutOptions* MctsEngine::playout_options() {
   return playout_->options();
 }
 
+//-- EndgameSolver ----------------------------------------------------
+namespace {
+
+// The proof number search keeps 2**kLog2SolverTableSize positions.
+const int kLog2SolverTableSize = 18;
+// How long the solver waits for the tree to grow when nothing is left
+// to solve.
+const long kSolverNapNs = 10 * 1000 * 1000;
+
+bool HasMoreSimulations(const std::pair<int, int>& a,
+                        const std::pair<int, int>& b) {
+  return a.first > b.first;
+}
+
+}  // namespace
+
+EndgameSolver::EndgameSolver(MctsOptions* options)
+    : rng_(new Rng),
+      transposition_table_(new TranspositionTable(options, rng_)),
+      proof_number_search_(new ProofNumberSearch(kLog2SolverTableSize)),
+      options_(options),
+      mementos_(kNumMovesOnBoard + 1),
+      node_limit_(0),
+      solve_count_(0),
+      terminate_(NULL) {
+  for (int i = 0, size = mementos_.size(); i < size; ++i) {
+    mementos_[i] = new Memento;
+  }
+}
+
+EndgameSolver::~EndgameSolver() {
+  for (int i = 0, size = mementos_.size(); i < size; ++i) {
+    delete mementos_[i];
+  }
+  delete proof_number_search_;
+  delete transposition_table_;
+  delete rng_;
+}
+
+void EndgameSolver::set_tree_storage(TreeStorage* tree_storage) {
+  transposition_table_->set_storage(tree_storage);
+}
+
+void EndgameSolver::Run(Player player,
+                        const Position& start_position,
+                        volatile bool* terminate) {
+  position_.CopyFrom(start_position);
+  terminate_ = terminate;
+  tried_positions_.clear();
+  node_limit_ = std::max(options_->solver_node_limit, 1);
+  solve_count_ = 0;
+  const Hash root_hash = start_position.hash();
+  while (!*terminate) {
+    if (SolveOneKid(root_hash, player, 0))
+      continue;
+    if (tried_positions_.empty()) {
+      // The tree has not reached the end of the game yet.
+      timespec nap;
+      nap.tv_sec = 0;
+      nap.tv_nsec = kSolverNapNs;
+      nanosleep(&nap, NULL);
+    } else {
+      // Everything within reach has been tried. Try again harder.
+      tried_positions_.clear();
+      node_limit_ = std::min(node_limit_, INT_MAX / 2) * 2;
+    }
+  }
+}
+
+bool EndgameSolver::SolveOneKid(Hash position_hash, Player player, int depth) {
+  const KidBlock kids = transposition_table_->GetKids(position_hash);
+  std::vector<std::pair<int, int> > order;
+  for (int i = 0, size = kids.size(); i < size; ++i) {
+    const MctsNode* kid = kids.node(i);
+    if (!kid->HasForcedResult() && kid->ucb_num_simulations() > 0)
+      order.push_back(std::make_pair(kid->ucb_num_simulations(), i));
+  }
+  std::stable_sort(order.begin(), order.end(), HasMoreSimulations);
+  // NumAvailableMoves() counts only the permanent moves, not the depth
+  // moves made on the way here, nor the move to the kid.
+  const int num_empty_cells = position_.NumAvailableMoves() - depth - 1;
+  for (int j = 0, size = order.size(); j < size && !*terminate_; ++j) {
+    const int i = order[j].second;
+    const Cell cell = kids.cell(i);
+    Memento* memento = mementos_[depth];
+    if (position_.MakeMoveReversibly(player, cell, memento) != 0) {
+      // The engines find out about winning moves by themselves.
+      memento->UndoAll();
+      continue;
+    }
+    const Hash kid_hash = Position::ModifyZobristHash(
+        position_hash, player, Position::CellToMoveIndex(cell));
+    bool has_tried = false;
+    if (num_empty_cells <= options_->solver_empty_cells) {
+      if (tried_positions_.insert(kid_hash).second) {
+        Solve(position_hash, cell, Opponent(player));
+        has_tried = true;
+      }
+    } else {
+      has_tried = SolveOneKid(kid_hash, Opponent(player), depth + 1);
+    }
+    memento->UndoAll();
+    if (has_tried)
+      return true;
+  }
+  return false;
+}
+
+void EndgameSolver::Solve(Hash parent_hash, Cell cell, Player player) {
+  ++solve_count_;
+  // Nodes keep the results for the player who moved into them.
+  int plies;
+  int reward = 0;
+  ProofNumberSearch::Result result = proof_number_search_->Solve(
+      position_, player, player, node_limit_, terminate_, &plies);
+  if (result == ProofNumberSearch::kProven) {
+    reward = LostInNPlies(plies);
+  } else if (result == ProofNumberSearch::kDisproven) {
+    result = proof_number_search_->Solve(
+        position_, player, Opponent(player), node_limit_, terminate_, &plies);
+    if (result == ProofNumberSearch::kProven)
+      reward = WonInNPlies(plies);
+    else if (result == ProofNumberSearch::kDisproven)
+      reward = kBoardFilledDraw;
+  }
+  if (reward == 0)
+    return;
+  // Progressive widening may have moved the kids while the proof
+  // number search ran.
+  MctsNode* node = transposition_table_->FindKid(parent_hash, cell);
+  if (node != NULL)
+    node->UpdateUcbReward(reward);
+}
+
+//-- Benchmark --------------------------------------------------------
+namespace {
+
+typedef int (*FindBestKidFunction)(
+    const KidBlock&, float, float, float, float*);
+
+template<GetScore get_score>
+int FindBestKidScalar(const KidBlock& kids,
+                      float log_parent_simulations,
+                      float rave_bias,
+                      float first_play_urgency,
+                      float* best_value) {
+  return FindBestKid<get_score>(
+      kids, 0, log_parent_simulations, rave_bias,
+      first_play_urgency, best_value);
+}
+
+#ifdef USE_VECTORIZED_SCORES
+#define STRATEGY(get_score) \
+    { #get_score, &FindBestKidScalar<get_score>, \
+      &FindBestKidVectorized<get_score, get_score##Vector> }
+#else
+#define STRATEGY(get_score) \
+    { #get_score, &FindBestKidScalar<get_score>, NULL }
+#endif  // USE_VECTORIZED_SCORES
+
+const struct {
+  const char* name;
+  FindBestKidFunction scalar;
+  FindBestKidFunction vectorized;
+} kStrategies[kNumStrategies] = {
+  STRATEGY(UtcHoeffding),
+  STRATEGY(UtcHoeffdingSlow),
+  STRATEGY(RaveGelly),
+  STRATEGY(RaveTeytaud),
+  STRATEGY(RaveSilver),
+  STRATEGY(RaveSilverWithProgressiveBias),
+  STRATEGY(RaveSilverUnsimplified),
+  STRATEGY(ProgressiveHistoryNijssenWinands),
+};
+
+#undef STRATEGY
+
+// Returns millions of kids scored per second of CPU time and stores
+// the chosen kids in best_kids.
+float MeasureSelectionSpeed(FindBestKidFunction find_best_kid,
+                            const MctsOptions& options,
+                            const KidBlock& kids,
+                            std::vector<int>* best_kids) {
+  const int num_kids = kids.size();
+  const clock_t start = clock();
+  for (int i = 0, size = best_kids->size(); i < size; ++i) {
+    // Vary the parent so that the compiler cannot hoist the work.
+    const float log_parent_simulations =
+        options.exploration_factor * logf(1000 + i);
+    float best_value = -FLT_MAX;
+    (*best_kids)[i] = find_best_kid(
+        kids, log_parent_simulations, options.rave_bias,
+        options.first_play_urgency, &best_value);
+  }
+  const float seconds =
+      static_cast<float>(clock() - start) / CLOCKS_PER_SEC;
+  return 1e-6f * num_kids * best_kids->size() / std::max(seconds, 1e-6f);
+}
+
+}  // namespace
+
+void BenchmarkExplorationStrategies(
+    const MctsOptions& options, int num_kids, int num_rounds) {
+  Rng rng;
+  rng.Init(12345);
+  std::vector<MctsNode> nodes(num_kids);
+  std::vector<short> cells(num_kids);
+  std::vector<short> biases(num_kids);
+  const KidBlock kids(&nodes[0], &cells[0], &biases[0], num_kids);
+  for (int i = 0; i < num_kids; ++i) {
+    MctsNode* kid = kids.node(i);
+    kid->Init();
+    // Leave some kids unvisited to exercise ResultForNoVisits().
+    const int ucb_num_simulations = rng(4) == 0 ? 0 : 1 + rng(1000);
+    kid->UpdateUcbNumSimulations(ucb_num_simulations);
+    kid->UpdateUcbReward(
+        rng(2 * ucb_num_simulations + 1) - ucb_num_simulations);
+    const int rave_num_simulations = 1 + rng(5000);
+    kid->UpdateRave(rng(2 * rave_num_simulations + 1) - rave_num_simulations,
+                    rave_num_simulations);
+    kids.set_bias(i, 0.01f * rng(100));
+  }
+  printf("%-34s %12s %12s %10s\n",
+         "strategy", "scalar", "vectorized", "mismatches");
+  std::vector<int> scalar_best_kids(num_rounds);
+  std::vector<int> vectorized_best_kids(num_rounds);
+  for (int i = 0; i < kNumStrategies; ++i) {
+    const float scalar_speed = MeasureSelectionSpeed(
+        kStrategies[i].scalar, options, kids, &scalar_best_kids);
+    if (kStrategies[i].vectorized == NULL) {
+      printf("%-34s %12.1f %12s %10s\n",
+             kStrategies[i].name, scalar_speed, "n/a", "n/a");
+      continue;
+    }
+    const float vectorized_speed = MeasureSelectionSpeed(
+        kStrategies[i].vectorized, options, kids, &vectorized_best_kids);
+    int mismatches = 0;
+    for (int j = 0; j < num_rounds; ++j) {
+      mismatches += (scalar_best_kids[j] != vectorized_best_kids[j]);
+    }
+    printf("%-34s %12.1f %12.1f %10d\n",
+           kStrategies[i].name, scalar_speed, vectorized_speed, mismatches);
+  }
+  printf("(millions of kids per second)\n");
+}
+
 }  // namespace lajkonik
@@ -28,17 +28,27 @@
 
 #include <limits.h>
 #include <math.h>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "havannah.h"
 #include "options.h"
+#include "playout.h"
 
 namespace lajkonik {
 
+class KidArena;
 class MctsNode;
-class Playout;
+class ProofNumberSearch;
+class Rng;
+class TableEntry;
 class TranspositionTable;
+struct PlayoutRequest;
+template<typename T> class LockFreeQueue;
+template<typename Key, typename Value> class WaitFreeHashMap;
+
+typedef WaitFreeHashMap<Hash, TableEntry> HashMap;
 
 const int kBoardFilledDraw = 0x8000 - INT_MAX;
 
@@ -111,6 +121,103 @@ class Statistics {
   double v_;
 };
 
+// The nodes of a search tree. A Controller owns one and lends it to all
+// its engines, so that different Controllers search independently.
+class TreeStorage {
+ public:
+  explicit TreeStorage(int megabytes);
+  ~TreeStorage();
+
+  // Empties the tree. Reallocates it if its size differs from megabytes.
+  void Clear(int megabytes);
+  // Returns true if the size of the tree differs from megabytes.
+  bool NeedsClearing(int megabytes) const;
+  // Returns true if the tree is too full to go on growing for long.
+  bool NeedsPruning() const;
+  // Forgets the kids of the positions simulated least, keeping those
+  // of the root, until the tree is at most a quarter full, and
+  // reclaims their room. Must not be called during a search.
+  void Prune(Hash root_hash);
+  // Counts a position that could not be expanded for lack of room.
+  void CountExpansionFailure();
+  // Counts a position that got its kids.
+  void CountExpansion();
+
+  HashMap* nodes() const { return nodes_; }
+  KidArena* kids() const { return kids_; }
+  int megabytes() const { return megabytes_; }
+  // The number of positions that could not be expanded for lack
+  // of room since the last clearing.
+  int num_expansion_failures() const { return num_expansion_failures_; }
+  // The number of positions expanded since the construction. Neither
+  // clearing nor pruning decreases it.
+  long long num_expansions() const { return num_expansions_; }
+
+ private:
+  void Allocate(int megabytes);
+
+  // Maps Zobrist hashes of positions to their statistics.
+  HashMap* nodes_;
+  // The blocks of kids of expanded positions.
+  KidArena* kids_;
+  int megabytes_;
+  int num_expansion_failures_;
+  long long num_expansions_;
+
+  TreeStorage(const TreeStorage&);
+  void operator=(const TreeStorage&);
+};
+
+// Bounds the work of a search by all engines of a Controller,
+// independently of the speed of the machine.
+struct SearchBudget {
+  // The number of playouts from the root and of positions expanded
+  // in the tree after which the search stops, or 0 for no bound.
+  int max_playouts;
+  int max_nodes;
+  // The playouts started so far. Updated by the engines.
+  int num_playouts;
+  // The expansion count when the search started.
+  long long initial_expansion_count;
+};
+
+// A position on the way from the root to a leaf of the search tree.
+struct PathStep {
+  Hash position_hash;
+  MctsNode* node;
+  TableEntry* entry;
+  Player player;
+  Cell last_move;
+  // The length of the way to this position.
+  int move_index;
+  int empty_cell_count;
+};
+
+// Lets some engines of a Controller only descend the tree to leaves
+// while the others play out the leaves and return the results.
+class PlayoutPipeline {
+ public:
+  // Holds the playouts of up to max_num_selecting_engines engines.
+  explicit PlayoutPipeline(int max_num_selecting_engines);
+  ~PlayoutPipeline();
+
+  // Must be called before the engines start a search.
+  void Start(int num_selecting_engines) {
+    num_selecting_engines_ = num_selecting_engines;
+  }
+
+ private:
+  friend class MctsEngine;
+
+  // The leaves waiting for a playout.
+  LockFreeQueue<PlayoutRequest*>* requests_;
+  // The selecting engines that have not finished the current search.
+  volatile int num_selecting_engines_;
+
+  PlayoutPipeline(const PlayoutPipeline&);
+  void operator=(const PlayoutPipeline&);
+};
+
 // TODO(mciura)
 class MctsEngine {
  public:
@@ -118,14 +225,37 @@ class MctsEngine {
   MctsEngine(MctsOptions* mcts_options, Playout* playout);
   ~MctsEngine();
 
+  // Does not take ownership of tree_storage. Must be called
+  // before the engine searches.
+  void set_tree_storage(TreeStorage* tree_storage);
   //
   void ClearTranspositionTable();
-  //
+  // Returns true if the size of the transposition table should change.
+  bool TranspositionTableNeedsClearing() const;
+  // Returns true if the transposition table is too full to go on
+  // growing for long.
+  bool TranspositionTableNeedsPruning() const;
+  // Prunes the transposition table if it needs pruning and pins
+  // the root of a search from start_position in it. Must not be
+  // called during a search.
+  void PrepareTranspositionTable(const Position& start_position);
+  // If pipeline is not NULL, leaves the playouts to engines that
+  // run RunPlayouts() with the same pipeline.
   void SearchForMove(Player player,
                      const Position& start_position,
+                     SearchBudget* budget,
+                     PlayoutPipeline* pipeline,
                      volatile bool* terminate);
+  // Plays out the leaves that the engines searching start_position
+  // with pipeline reach, until all of them finish their search.
+  void RunPlayouts(const Position& start_position, PlayoutPipeline* pipeline);
+  // Reseeds the random number generator of the playouts.
+  void set_random_seed(unsigned seed);
   //
   void GetTwoBestMoves(MoveInfo* move_1, MoveInfo* move_2) const;
+  // Appends the statistics of all moves from the root of the last
+  // search to moves, as GetTwoBestMoves() reports them.
+  void GetRootMoves(std::vector<MoveInfo>* moves) const;
   //
   void PrintDebugInfo(int secs);
   //
@@ -143,8 +273,20 @@ class MctsEngine {
   void mark_as_not_running() { is_running_ = false; }
   //
   bool is_running() const { return is_running_; }
+  // Returns the number of simulations of the root of the last search.
+  int root_simulation_count() const;
   //
   int node_count() const;
+  // Returns the number of nodes replaced since the last clearing
+  // of the transposition table.
+  int eviction_count() const;
+  // Returns the number of positions that could not be expanded
+  // for lack of room for their kids since the last clearing
+  // of the transposition table.
+  int expansion_failure_count() const;
+  // Returns the number of positions expanded in the tree, which never
+  // decreases.
+  long long expansion_count() const;
   // Getter for options_.
   MctsOptions* mcts_options() { return options_; }
   // Getter for playout options.
@@ -153,36 +295,47 @@ class MctsEngine {
  private:
   //
   void UpdateRaveInTree(Hash position_hash,
+                        TableEntry* entry,
                         Player player,
                         int rave_i,
                         int reward,
                         int num_simulations);
+  // Returns true if the search has used up its budget. Otherwise
+  // claims the next playout from it.
+  bool BudgetIsExhausted(SearchBudget* budget);
   // A helper for playout_->PlayOnce(). Translates its result
   // into +1, 0, or -1 from player's point of view.
   int GetPlayoutResult(Player player, Cell last_move, int empty_cell_count);
-  //
-  int Descend(Hash position_hash,
-              MctsNode* node,
-              Player player,
-              Cell last_move,
-              int empty_cell_count);
-  // Updates the UCB reward and number of simulations for node
-  // (== node_map_->FindNode(position_hash)) that corresponds to the given
-  // position with the given player to move. Returns the UCB reward.
-  int UpdateNodeAndGetReward(Hash position_hash,
-                             MctsNode* node,
-                             Player player,
-                             Cell last_move,
-                             int empty_cell_count);
+  // Descends from the root to a leaf, making the moves in position_
+  // and recording the way in path_. Returns true if the leaf needs
+  // a playout from the last step of path_. Otherwise sets *reward
+  // to the result of the leaf for the last step of path_.
+  bool SelectLeaf(MctsNode* root, Cell last_move, int empty_cell_count,
+                  int* reward);
+  // Updates the statistics of the steps of path_ bottom-up with the
+  // reward for the last one.
+  void Backpropagate(int reward);
+  // Keeps kMaxPlayoutsInFlight leaves in pipeline and backpropagates
+  // their results as they come.
+  void SearchWithPipeline(MctsNode* root,
+                          Cell last_move,
+                          int empty_cell_count,
+                          SearchBudget* budget,
+                          PlayoutPipeline* pipeline,
+                          volatile bool* terminate);
+  // Plays out a leaf waiting in pipeline, if any, and returns
+  // the result to the engine that selected it.
+  bool PlayRequestedPlayout(PlayoutPipeline* pipeline);
   //
   void RecursiveGetSgf(
       Player player,
-      Hash hash,
+      Hash parent_hash,
       Cell cell,
+      const MctsNode* node,
       int threshold,
       std::string* sgf) const;
 
-  // Maps Zobrist hashes of positions to MctsNodes.
+  // Maps Zobrist hashes of positions to their kids.
   TranspositionTable* transposition_table_;
   // TODO(mciura)
   Playout* playout_;
@@ -198,17 +351,86 @@ class MctsEngine {
   bool is_running_;
   //
   Player player_;
+  // The Zobrist hash of the position from which the search starts.
+  Hash root_hash_;
   // Moves made in the game tree.
   std::vector<Cell> moves_;
+  // The way from the root to the current leaf.
+  PathStep path_[kNumMovesOnBoard + 1];
+  int path_length_;
+  // Virtual loss is always on when a pipeline is used.
+  bool use_virtual_loss_;
+  // The leaves of this engine that may wait for a playout
+  // in a pipeline, and those among them that do not.
+  PlayoutRequest* playout_requests_;
+  std::vector<PlayoutRequest*> free_playout_requests_;
+  // The playouts of this engine's leaves played by other engines.
+  LockFreeQueue<PlayoutRequest*>* finished_playouts_;
+  // The indices in moves_ of cells filled in the game tree.
+  int tree_move_numbers_[kNumCellsWithSentinels];
   //
   Statistics stats_[kNumMovesOnBoard + 1];
   //
-  int rave_[2][kNumMovesOnBoard];
+  RaveUpdates rave_;
 
   MctsEngine(const MctsEngine&);
   void operator=(const MctsEngine&);
 };
 
+// Proves the results of positions in the search tree that have at most
+// options->solver_empty_cells empty cells, so that the engines stop
+// spending playouts on them. Runs beside the engines in its own thread.
+class EndgameSolver {
+ public:
+  // Does not take ownership of options.
+  explicit EndgameSolver(MctsOptions* options);
+  ~EndgameSolver();
+
+  // Does not take ownership of tree_storage.
+  void set_tree_storage(TreeStorage* tree_storage);
+  // Solves the positions in the tree of a search for player's move
+  // from start_position, the most simulated first, and writes their
+  // results into the tree until *terminate becomes true.
+  void Run(Player player,
+           const Position& start_position,
+           volatile bool* terminate);
+  // Returns the number of positions that the last Run() tried to prove.
+  int solve_count() const { return solve_count_; }
+
+ private:
+  // Tries to solve one position below that with the given hash,
+  // which is position_. Returns false if no position was left to try.
+  bool SolveOneKid(Hash position_hash, Player player, int depth);
+  // Writes the result of position_ with player to move into the kid
+  // of the position with parent_hash that moves into cell if it can
+  // be proved.
+  void Solve(Hash parent_hash, Cell cell, Player player);
+
+  // Only gives access to the tree, which needs no random numbers.
+  Rng* rng_;
+  TranspositionTable* transposition_table_;
+  ProofNumberSearch* proof_number_search_;
+  MctsOptions* options_;
+  Position position_;
+  // The moves made at each depth are undone separately.
+  std::vector<Memento*> mementos_;
+  // The positions that the solver has given up in this search.
+  std::set<Hash> tried_positions_;
+  // The positions the proof number search may expand per try.
+  int node_limit_;
+  int solve_count_;
+  volatile bool* terminate_;
+
+  EndgameSolver(const EndgameSolver&);
+  void operator=(const EndgameSolver&);
+};
+
+// Prints how many kids per second each exploration strategy scores
+// with and without vector instructions, choosing the best of num_kids
+// kids num_rounds times.
+void BenchmarkExplorationStrategies(
+    const MctsOptions& options, int num_kids, int num_rounds);
+
 }  // namespace lajkonik
 
 #endif  // MCTS_H_
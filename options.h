@@ -46,6 +46,7 @@ struct PlayoutOptions {
   float chance_of_connection_defense_slope;
   float chance_of_connection_defense_intercept;
   int retries_of_isolated_moves;
+  int moves_before_filling_board;
   bool use_havannah_mate;
   bool use_havannah_antimate;
   bool use_ring_detection;
@@ -59,6 +60,7 @@ struct PlayoutOptions {
     ADD_STRING(chance_of_forced_connection_intercept);
     ADD_STRING(chance_of_connection_defense_slope);
     ADD_STRING(chance_of_connection_defense_intercept);
+    ADD_STRING(moves_before_filling_board);
     ADD_STRING(use_havannah_mate);
     ADD_STRING(use_havannah_antimate);
     ADD_STRING(use_ring_detection);
@@ -73,6 +75,11 @@ struct MctsOptions {
   float tricky_epsilon;
   float locality_bias;
   float chain_size_bias_factor;
+  // If widening_base is positive, the search considers only the
+  // widening_base + widening_factor * ln(n) kids with the greatest
+  // biases of a position simulated n times.
+  float widening_factor;
+  int widening_base;
   int expand_after_n_playouts;
   int play_n_playouts_at_once;
   int exploration_strategy;
@@ -81,6 +88,12 @@ struct MctsOptions {
   int prior_num_simulations_range;
   int prior_reward_halfrange;
   int neighborhood_size;
+  int tt_size_mb;
+  // If positive, a proof-number search in a separate thread solves
+  // positions in the tree with at most this many empty cells, expanding
+  // at first at most solver_node_limit positions for each of them.
+  int solver_empty_cells;
+  int solver_node_limit;
   bool use_rave_randomization;
   bool use_mate_in_tree;
   bool use_antimate_in_tree;
@@ -96,6 +109,8 @@ struct MctsOptions {
     ADD_STRING(tricky_epsilon);
     ADD_STRING(locality_bias);
     ADD_STRING(chain_size_bias_factor);
+    ADD_STRING(widening_factor);
+    ADD_STRING(widening_base);
     ADD_STRING(first_play_urgency);
     ADD_STRING(expand_after_n_playouts);
     ADD_STRING(play_n_playouts_at_once);
@@ -105,6 +120,9 @@ struct MctsOptions {
     ADD_STRING(prior_num_simulations_range);
     ADD_STRING(prior_reward_halfrange);
     ADD_STRING(neighborhood_size);
+    ADD_STRING(tt_size_mb);
+    ADD_STRING(solver_empty_cells);
+    ADD_STRING(solver_node_limit);
     ADD_STRING(use_rave_randomization);
     ADD_STRING(use_mate_in_tree);
     ADD_STRING(use_antimate_in_tree);
@@ -118,19 +136,52 @@ struct MctsOptions {
 struct ControllerOptions {
   float sole_nonlosing_move_win_ratio_threshold;
   float win_ratio_threshold;
-  int seconds_per_move;
+  // Used when the game has no clock.
+  float seconds_per_move;
+  // Milliseconds kept in reserve per move when the game has a clock.
+  int time_safety_margin_ms;
+  // If positive, a search ignores the time and stops after this many
+  // playouts from the root or this many positions expanded in the tree,
+  // whichever comes first.
+  int playout_budget;
+  int node_budget;
+  // If nonzero, the random number generators of the engines are reseeded
+  // with it before each search, so that searches can be repeated.
+  int random_seed;
+  // How many engines search. Values outside [1, number of engines]
+  // mean all of them.
+  int num_threads;
+  // Pins the worker of engine i to core first_core + i modulo the number
+  // of cores. A negative value lets the workers run on any core.
+  int first_core;
+  // If positive and more than one engine searches, this many of them
+  // only run the playouts of leaves that the others select.
+  int playout_threads;
   bool end_games_quickly;
   bool print_debug_info;
   bool use_human_like_time_control;
   bool use_swap;
   bool clear_tt_after_move;
+  bool reuse_search_tree;
+  // End the search when the second most simulated move cannot overtake
+  // the first one at the current speed of the search.
+  bool stop_when_decided;
+  // Search on the opponent's time. Requires reuse_search_tree.
+  bool ponder;
 
   std::string ToString() const {
     const char struct_name[] = "controller_options";
     std::string result;
     ADD_STRING(seconds_per_move);
+    ADD_STRING(num_threads);
+    ADD_STRING(playout_threads);
+    ADD_STRING(playout_budget);
+    ADD_STRING(node_budget);
     ADD_STRING(use_swap);
     ADD_STRING(use_human_like_time_control);
+    ADD_STRING(reuse_search_tree);
+    ADD_STRING(stop_when_decided);
+    ADD_STRING(ponder);
     return result;
   }
 };
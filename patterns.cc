@@ -34,11 +34,6 @@
 namespace lajkonik {
 namespace {
 
-const unsigned long long kOrTo12Neighbors =
-    ~(~0ULL << 36) & ~(((1ULL << 18) + 1ULL) * kAndTo12Neighbors);
-const unsigned long long kOrTo6Neighbors =
-    ~(~0ULL << 36) & ~(((1ULL << 18) + 1ULL) * kAndTo6Neighbors);
-
 const int kKeyIndices[6 + 1 + 6 + 1 + 6] = {
   8, 12, 13, 9, 5, 4, -1,
   11, 16, 14, 6, 1, 3, -1,
@@ -221,29 +216,4 @@ Patterns::~Patterns() {
   delete hash_map_;
 }
 
-MoveSuggestion Patterns::GetMoveSuggestion(
-    unsigned long long neighbors18) const {
-  MoveSuggestion result;
-  const Element* elem;
-  elem = hash_map_->Find(neighbors18);
-  if (elem != NULL) {
-    result.mask = elem->mask;
-    result.chance = elem->chance;
-    return result;
-  }
-  elem = hash_map_->Find(neighbors18 | kOrTo12Neighbors);
-  if (elem != NULL) {
-    result.mask = elem->mask;
-    result.chance = elem->chance;
-    return result;
-  }
-  elem = hash_map_->Find(neighbors18 | kOrTo6Neighbors);
-  if (elem != NULL) {
-    result.mask = elem->mask;
-    result.chance = elem->chance;
-    return result;
-  }
-  return result;
-}
-
 }  // namespace lajkonik
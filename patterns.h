@@ -172,6 +172,13 @@ struct Element {
   unsigned chance: 4;
 };
 
+// ORed to a mask of 18 neighbors, these constants set the bits
+// of the neighbors farther than the closest 12 or 6 for both players.
+static const unsigned long long kOrTo12Neighbors =
+    ~(~0ULL << 36) & ~(((1ULL << 18) + 1ULL) * kAndTo12Neighbors);
+static const unsigned long long kOrTo6Neighbors =
+    ~(~0ULL << 36) & ~(((1ULL << 18) + 1ULL) * kAndTo6Neighbors);
+
 // TODO.
 class Patterns {
  public:
@@ -188,7 +195,21 @@ class Patterns {
   // to the closest 12 neighbors, or the mask trimmed to the closest
   // 6 neighbors is a key of a known pattern, returns the found
   // MoveSuggestion. Otherwise, returns a zeroed out MoveSuggestion.
-  MoveSuggestion GetMoveSuggestion(unsigned long long neighbors18) const;
+  // Defined here, so that playouts can inline it.
+  MoveSuggestion GetMoveSuggestion(unsigned long long neighbors18) const {
+    MoveSuggestion result;
+    const Element* elem;
+    elem = hash_map_->Find(neighbors18);
+    if (elem == NULL)
+      elem = hash_map_->Find(neighbors18 | kOrTo12Neighbors);
+    if (elem == NULL)
+      elem = hash_map_->Find(neighbors18 | kOrTo6Neighbors);
+    if (elem != NULL) {
+      result.mask = elem->mask;
+      result.chance = elem->chance;
+    }
+    return result;
+  }
 
  private:
   // The underlying PatternHashMap.
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <time.h>
 #include <algorithm>
 
 #ifdef DUMP_PLAYOUTS
@@ -45,35 +46,71 @@ Playout::Playout(PlayoutOptions* playout_options,
     : options_(playout_options),
       patterns_(patterns) {
   rng_.Init(seed);
+  ring_closing_cells_.ZeroBits();
 }
 
 void Playout::PrepareForPlayingFromPosition(const Position* position) {
-  position->GetFreeCells(&free_cells_);
+  position->GetFreeCells(&playout_moves_);
+  for (int i = 0, size = playout_moves_.size(); i < size; ++i) {
+    reverse_playout_moves_[playout_moves_[i]] = i;
+  }
   position_ = position;
+  start_board_.InitFromPosition(*position);
 }
 
 int Playout::Play(
     Player player,
     Cell last_move,
-    int rave[2][kNumMovesOnBoard],
+    const std::vector<Cell>& tree_moves,
+    RaveUpdates* rave,
     int* num_moves) {
-  mutable_position_.CopyFrom(*position_);
-  playout_moves_.clear();
-  for (int i = 0, size = free_cells_.size(); i < size; ++i) {
-    const Cell cell = free_cells_[i];
-    if (mutable_position_.CellIsEmpty(cell)) {
-      playout_moves_.push_back(cell);
-    }
-  }
-  rng_.Shuffle(playout_moves_.begin(), playout_moves_.end());
-  for (int i = 0, size = playout_moves_.size(); i < size; ++i) {
-    reverse_playout_moves_[playout_moves_[i]] = i;
+  typedef int (Playout::*PlayFunction)(
+      Player, Cell, const std::vector<Cell>&, RaveUpdates*, int*);
+  // Without kUseHavannahMate, the other bits but kRetryIsolatedMoves
+  // do not matter, so the policies that differ only in them share code.
+  static const PlayFunction kPlayFunctions[16] = {
+    &Playout::PlayWithPolicy<0>, &Playout::PlayWithPolicy<1>,
+    &Playout::PlayWithPolicy<2>, &Playout::PlayWithPolicy<3>,
+    &Playout::PlayWithPolicy<0>, &Playout::PlayWithPolicy<1>,
+    &Playout::PlayWithPolicy<6>, &Playout::PlayWithPolicy<7>,
+    &Playout::PlayWithPolicy<0>, &Playout::PlayWithPolicy<1>,
+    &Playout::PlayWithPolicy<10>, &Playout::PlayWithPolicy<11>,
+    &Playout::PlayWithPolicy<0>, &Playout::PlayWithPolicy<1>,
+    &Playout::PlayWithPolicy<14>, &Playout::PlayWithPolicy<15>,
+  };
+  const int policy =
+      kRetryIsolatedMoves * (options_->retries_of_isolated_moves > 1) +
+      kUseHavannahMate * options_->use_havannah_mate +
+      kUseHavannahAntimate * options_->use_havannah_antimate +
+      kUseRingDetection * options_->use_ring_detection;
+  return (this->*kPlayFunctions[policy])(
+      player, last_move, tree_moves, rave, num_moves);
+}
+
+template<int policy>
+int Playout::PlayWithPolicy(
+    Player player,
+    Cell last_move,
+    const std::vector<Cell>& tree_moves,
+    RaveUpdates* rave,
+    int* num_moves) {
+  // Draws the moves lazily, so that a playout that ends early
+  // does not pay for shuffling the whole board.
+  board_.CopyFrom(start_board_);
+  num_playout_moves_ = playout_moves_.size();
+  for (int i = 0, size = tree_moves.size(); i < size; ++i) {
+    const Cell cell = tree_moves[i];
+    board_.MakeMove(
+        static_cast<Player>((position_->GetCell(cell) & 3) - 1), cell);
+    --num_playout_moves_;
+    SwapMoves(reverse_playout_moves_[cell], num_playout_moves_);
   }
+  num_drawn_moves_ = 0;
   canned_moves_ = std::max(
       ReplaceMovesInRingFrames(player, 0),
       ReplaceMovesInRingFrames(Opponent(player), 1));
   const int num_chains =
-      mutable_position_.player_position(player).CountChains();
+      position_->player_position(player).CountChains();
   chance_of_forced_connection_ =
       options_->chance_of_forced_connection_intercept +
       num_chains * options_->chance_of_forced_connection_slope;
@@ -84,11 +121,15 @@ int Playout::Play(
   playout_players_.clear();
   int noli_me_tangere = -1;
   unsigned long long neighbors18 =
-      mutable_position_.Get18Neighbors(player, last_move);
+      board_.Get18Neighbors(player, last_move);
+  bool ignored_ring = false;
   int i;
-  const int size = playout_moves_.size();
+  const int size = num_playout_moves_;
   DUMP(printf("-----------------------------------\n"));
   for (i = 0; i < size; ++i) {
+    // An ignored ring would end the game on the filled board at once.
+    if (i == options_->moves_before_filling_board && !ignored_ring)
+      return FillBoard(player, i, rave, num_moves);
     playout_players_.push_back(player);
     if (noli_me_tangere < 0) {
       DUMP(printf("Pattern at %s: %0llx\n",
@@ -105,22 +146,19 @@ int Playout::Play(
         ReplaceMove(i, next_move);
       }
     }
-    Cell cell = playout_moves_[i];
-    assert(mutable_position_.CellIsEmpty(cell));
-    if (noli_me_tangere < 0) {
+    Cell cell = NthPlayoutMove(i);
+    assert(board_.CellIsEmpty(cell));
+    // With one try, the best cell is the first one.
+    if ((policy & kRetryIsolatedMoves) && noli_me_tangere < 0) {
       int highest_num_neighbor_chains =
-          mutable_position_.
-          player_position(player).
-          GetSizeOfNeighborChains(cell, 12);
+          board_.GetSizeOfNeighborChains(player, cell, 12);
       Cell best_cell = cell;
       for (int j = 1; j < options_->retries_of_isolated_moves &&
            i + j < size; ++j) {
-        cell = playout_moves_[i + j];
-        assert(mutable_position_.CellIsEmpty(cell));
+        cell = NthPlayoutMove(i + j);
+        assert(board_.CellIsEmpty(cell));
         const int num_neighbor_chains =
-            mutable_position_.
-            player_position(player).
-            GetSizeOfNeighborChains(cell, 12);
+            board_.GetSizeOfNeighborChains(player, cell, 12);
         if (num_neighbor_chains > highest_num_neighbor_chains) {
           best_cell = cell;
           highest_num_neighbor_chains = num_neighbor_chains;
@@ -129,9 +167,9 @@ int Playout::Play(
       ReplaceMove(i, best_cell);
       cell = best_cell;
     }
-    neighbors18 = mutable_position_.Get18Neighbors(Opponent(player), cell);
-    const WinningCondition victory = mutable_position_.MakeMoveFast(player, cell);
-    DUMP(printf("%s", mutable_position_.MakeString(cell).c_str()));
+    neighbors18 = board_.Get18Neighbors(Opponent(player), cell);
+    const WinningCondition victory = board_.MakeMove(player, cell);
+    DUMP(printf("%c %s\n", player["xo"], ToString(cell).c_str()));
     if (victory != kNoWinningCondition) {
       DUMP(printf("%c won in %d moves by %d\n", player["xo"], i, victory));
       if ((victory & ~(kBenzeneRing | kRing)) == 0) {
@@ -141,26 +179,18 @@ int Playout::Play(
              options_->initial_chance_of_ring_notice) *
              (i - canned_moves_) / (size - canned_moves_);
         if (rng_(100) > ring_notice_threshold) {
+          ignored_ring = true;
           --noli_me_tangere;
           neighbors18 = 0ULL;
           continue;
         }
       }
-      for (int j = 0; j <= i; ++j) {
-        const MoveIndex jth_move =
-            Position::CellToMoveIndex(playout_moves_[j]);
-        assert(Position::MoveIndexToCell(jth_move) == playout_moves_[j]);
-        const Player jth_player = playout_players_[j];
-        if (jth_player == player)
-          ++rave[jth_player][jth_move];
-        else
-          --rave[jth_player][jth_move];
-      }
+      AddRaveRewards(player, i + 1, rave);
       *num_moves = i;
       return 2 * victory + player;
     }
-    if (noli_me_tangere < 0 && options_->use_havannah_mate) {
-      noli_me_tangere = HavannahMate(player, i);
+    if ((policy & kUseHavannahMate) && noli_me_tangere < 0) {
+      noli_me_tangere = HavannahMate<policy>(player, i);
     }
     last_move = playout_moves_[i];
     player = Opponent(player);
@@ -170,8 +200,37 @@ int Playout::Play(
   return 0;
 }
 
+int Playout::FillBoard(
+    Player player, int i, RaveUpdates* rave, int* num_moves) {
+  const int size = num_playout_moves_;
+  NthPlayoutMove(size - 1);
+  for (int j = i; j < size; ++j) {
+    playout_players_.push_back((j - i) % 2 == 0 ? player : Opponent(player));
+  }
+  WinningCondition victory;
+  *num_moves = i + board_.FindFirstWinningMove(
+      player, &playout_moves_[i], size - i, &victory);
+  if (victory == kNoWinningCondition)
+    return 0;
+  const Player winner = playout_players_[*num_moves];
+  DUMP(printf("%c won in %d moves by %d\n",
+              winner["xo"], *num_moves, victory));
+  AddRaveRewards(winner, *num_moves + 1, rave);
+  return 2 * victory + winner;
+}
+
+void Playout::AddRaveRewards(
+    Player player, int num_moves, RaveUpdates* rave) const {
+  for (int j = 0; j < num_moves; ++j) {
+    const MoveIndex jth_move = Position::CellToMoveIndex(playout_moves_[j]);
+    assert(Position::MoveIndexToCell(jth_move) == playout_moves_[j]);
+    const Player jth_player = playout_players_[j];
+    rave->Add(jth_player, jth_move, (jth_player == player) ? +1 : -1);
+  }
+}
+
 int Playout::ReplaceMovesInRingFrames(Player player, int offset) {
-  const PlayerPosition& pp = mutable_position_.player_position(player);
+  const PlayerPosition& pp = position_->player_position(player);
   int canned_moves = 0;
   for (int i = 0, size = pp.ring_frame_count(); i < size; ++i) {
     const unsigned* frame = pp.ring_frame(i);
@@ -191,43 +250,47 @@ int Playout::ReplaceMovesInRingFrames(Player player, int offset) {
 }
 
 void Playout::ReplaceMove(int i, Cell cell) {
-  assert(mutable_position_.CellIsEmpty(cell));
-  const int j = reverse_playout_moves_[cell];
-  reverse_playout_moves_[playout_moves_[i]] = j;
-  reverse_playout_moves_[cell] = i;
-  playout_moves_[j] = playout_moves_[i];
-  playout_moves_[i] = cell;
+  assert(board_.CellIsEmpty(cell));
+  if (i >= num_playout_moves_)
+    return;
+  NthPlayoutMove(i);
+  SwapMoves(i, reverse_playout_moves_[cell]);
 }
 
+template<int policy>
 void Playout::LookForMate(
-    Player player, Cell cell, ChainNum current_chain, RowBitmask mask[]) {
+    Player player, Cell cell, Cell current_chain, RowBitmask mask[]) {
   static const int kMyOffsets[6] = {  +31, +32, -1, +1, -32, -31 };
-  const int neighborhood = mutable_position_.Get6Neighbors(player, cell);
+  const int neighborhood = board_.Get6Neighbors(player, cell);
 // if (CountSetBits(neighborhood) == 1 ||
 //    Position::CountNeighborGroupsWithPossibleBenzeneRings(neighborhood) == 9)
 //   neighbors_.push_back(cell);
-  if (mutable_position_.MoveIsWinning(player, cell, neighborhood, 0)) {
+  if (board_.MoveIsWinning(player, cell, neighborhood, kZerothCell)) {
     winning_moves_[winning_move_count_][0] = TwoMoves(cell);
     ++winning_move_count_;
   } else {
-    const PlayerPosition& player_position = mutable_position_.player_position(player);
     const int neighbor_groups = Position::CountNeighborGroups(neighborhood);
     if (neighbor_groups >= 2) {
       connecting_cells_.push_back(cell);
-      if (options_->use_ring_detection) {
+      if (policy & kUseRingDetection) {
         const int set_bits = CountSetBits(neighborhood);
+        Cell neighbor_chains[6];
+        int num_neighbor_chains = 0;
         for (int i = 0; i < set_bits; ++i) {
           const Cell neighbor_cell = OffsetCell(
               cell, kMyOffsets[GetIndexOfNthBit(i, neighborhood)]);
-          const ChainNum neighbor_chain =
-              player_position.NewestChainForCell(neighbor_cell);
-          assert(neighbor_chain != 0);
-          if (neighbor_chain != current_chain) {
-            std::vector<Cell>& v = ring_closing_moves_[neighbor_chain];
-            if (find(v.begin(), v.end(), cell) == v.end()) {
-              v.push_back(cell);
-            }
-         }
+          const Cell neighbor_chain = board_.ChainForCell(neighbor_cell);
+          if (neighbor_chain == current_chain)
+            continue;
+          int j = 0;
+          while (j < num_neighbor_chains &&
+                 neighbor_chains[j] != neighbor_chain) {
+            ++j;
+          }
+          if (j == num_neighbor_chains) {
+            neighbor_chains[num_neighbor_chains++] = neighbor_chain;
+            AddRingClosingMove(neighbor_chain, cell);
+          }
         }
       }
     } else if (neighbor_groups == 1) {
@@ -236,9 +299,9 @@ void Playout::LookForMate(
         assert((edges_corners & ~(~0 << 12)) != 0);
         const Cell neighbor_cell =
             OffsetCell(cell, kMyOffsets[GetIndexOfNthBit(0, neighborhood)]);
-        assert(mutable_position_.GetCell(neighbor_cell) == player + 1);
+        assert(board_.GetCell(neighbor_cell) == player + 1);
         const unsigned neighbor_edges_corners =
-            player_position.EdgesCornersRingForCell(neighbor_cell);
+            board_.EdgesCornersForCell(neighbor_cell);
         if (edges_corners & ~neighbor_edges_corners & ~(~0 << 12))
           connecting_cells_.push_back(cell);
       }
@@ -246,7 +309,7 @@ void Playout::LookForMate(
     int local_winning_move_count = 0;
     for (int k = 0; k < 6; ++k) {
       const Cell neighbor_cell = NthNeighbor(cell, k);
-      if (!mutable_position_.CellIsEmpty(neighbor_cell))
+      if (!board_.CellIsEmpty(neighbor_cell))
         continue;
       const XCoord neighbor_x = CellToX(neighbor_cell);
       const YCoord neighbor_y = CellToY(neighbor_cell);
@@ -254,11 +317,11 @@ void Playout::LookForMate(
         continue;
       further_neighbors_.push_back(neighbor_cell);
       const int neighbor_neighborhood =
-          mutable_position_.Get6Neighbors(player, neighbor_cell) |
+          board_.Get6Neighbors(player, neighbor_cell) |
           kReverseNeighborhoods[k];
-      if (mutable_position_.MoveIsWinning(
+      if (board_.MoveIsWinning(
               player, neighbor_cell, neighbor_neighborhood, current_chain)) {
-        mate_threats_.push_back(TwoMoves(neighbor_cell, cell));
+        AddMateThreat(neighbor_cell, cell);
         winning_moves_[winning_move_count_][local_winning_move_count % 2] =
             TwoMoves(cell, neighbor_cell);
         ++local_winning_move_count;
@@ -271,7 +334,7 @@ void Playout::LookForMate(
 
 int Playout::ForceMateInOne(int i, int index, const TwoMoves mating_moves[2]) {
   Cell mating_move = mates_in_one_move_[index];
-  if (playout_moves_[i + 1] == mating_move) {
+  if (NthPlayoutMove(i + 1) == mating_move) {
     if (mates_in_one_move_.size() > 1) {
       mating_move =
           mates_in_one_move_[(index + 1) % mates_in_one_move_.size()];
@@ -281,8 +344,8 @@ int Playout::ForceMateInOne(int i, int index, const TwoMoves mating_moves[2]) {
   }
   DUMP(printf("Mate in one\n"));
   ReplaceMove(i + 2, mating_move);
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 1]));
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 2]));
+  assert(PlayoutMoveIsLegal(i + 1));
+  assert(PlayoutMoveIsLegal(i + 2));
   return 2;
 }
 
@@ -291,103 +354,154 @@ int Playout::ForceMateInTwo(int i, const TwoMoves mating_moves[2]) {
   const int index = rng_(2);
   const Cell first_move_to_mate = mating_moves[index].first();
   const Cell second_move_to_mate = mating_moves[index].second();
-  int next_move = playout_moves_[i + 1];
+  int next_move = NthPlayoutMove(i + 1);
   if (next_move == first_move_to_mate || next_move == second_move_to_mate)
     return 0;
-  next_move = playout_moves_[i + 3];
+  next_move = NthPlayoutMove(i + 3);
   if (next_move == first_move_to_mate || next_move == second_move_to_mate)
     return 0;
   DUMP(printf("Mate in two\n"));
   ReplaceMove(i + 2, first_move_to_mate);
   ReplaceMove(i + 4, second_move_to_mate);
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 1]));
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 2]));
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 3]));
-  assert(mutable_position_.CellIsEmpty(playout_moves_[i + 4]));
+  assert(PlayoutMoveIsLegal(i + 1));
+  assert(PlayoutMoveIsLegal(i + 2));
+  assert(PlayoutMoveIsLegal(i + 3));
+  assert(PlayoutMoveIsLegal(i + 4));
   return 4;
 }
 
+void Playout::AddMateThreat(Cell threatened_cell, Cell cell) {
+  const XCoord x = CellToX(threatened_cell);
+  const YCoord y = CellToY(threatened_cell);
+  if (!threatened_cells_.get(x, y)) {
+    threatened_cells_.set(x, y);
+    first_mate_threats_[threatened_cell] = cell;
+  } else if (!doubly_threatened_cells_.get(x, y)) {
+    doubly_threatened_cells_.set(x, y);
+    second_mate_threats_[threatened_cell] = cell;
+  }
+}
+
+void Playout::AddRingClosingMove(Cell chain, Cell cell) {
+  assert(num_ring_closing_moves_ < ARRAYSIZE(ring_closing_moves_));
+  const int n = num_ring_closing_moves_++;
+  ring_closing_moves_[n] = cell;
+  next_ring_closing_moves_[n] = -1;
+  const XCoord x = CellToX(chain);
+  const YCoord y = CellToY(chain);
+  if (!ring_chains_.get(x, y)) {
+    ring_chains_.set(x, y);
+    first_ring_closing_moves_[chain] = n;
+  } else {
+    next_ring_closing_moves_[last_ring_closing_moves_[chain]] = n;
+  }
+  last_ring_closing_moves_[chain] = n;
+}
+
+void Playout::LookForRingThreats(Cell chain) {
+  for (int j = first_ring_closing_moves_[chain]; j >= 0;
+       j = next_ring_closing_moves_[j]) {
+    const Cell cell = ring_closing_moves_[j];
+    ring_closing_cells_.set(CellToX(cell), CellToY(cell));
+  }
+  // Splits the moves into ring_group_, connected to the first of them,
+  // and the others, clearing ring_closing_cells_ on the way.
+  ring_group_[0] = ring_closing_moves_[first_ring_closing_moves_[chain]];
+  ring_closing_cells_.clear(CellToX(ring_group_[0]), CellToY(ring_group_[0]));
+  int group_size = 1;
+  for (int j = 0; j < group_size; ++j) {
+    for (int k = 0; k < 6; ++k) {
+      const Cell neighbor_cell = NthNeighbor(ring_group_[j], k);
+      const XCoord x = CellToX(neighbor_cell);
+      const YCoord y = CellToY(neighbor_cell);
+      if (ring_closing_cells_.get(x, y)) {
+        ring_closing_cells_.clear(x, y);
+        ring_group_[group_size++] = neighbor_cell;
+      }
+    }
+  }
+  Cell others[2];
+  int num_others = 0;
+  for (int j = first_ring_closing_moves_[chain]; j >= 0;
+       j = next_ring_closing_moves_[j]) {
+    const Cell cell = ring_closing_moves_[j];
+    const XCoord x = CellToX(cell);
+    const YCoord y = CellToY(cell);
+    if (ring_closing_cells_.get(x, y)) {
+      ring_closing_cells_.clear(x, y);
+      if (num_others < 2)
+        others[num_others] = cell;
+      ++num_others;
+    }
+  }
+
+  if (num_others != 0 && (group_size > 1 || num_others > 1)) {
+    winning_moves_[winning_move_count_][0] =
+        TwoMoves(ring_group_[0], others[0]);
+    if (group_size > 1) {
+      winning_moves_[winning_move_count_][1] =
+          TwoMoves(ring_group_[1], others[0]);
+    } else {
+      winning_moves_[winning_move_count_][1] =
+          TwoMoves(others[1], ring_group_[0]);
+    }
+    ++winning_move_count_;
+    if (group_size > 1 && num_others > 1) {
+      winning_moves_[winning_move_count_][0] =
+          TwoMoves(ring_group_[1], others[1]);
+      winning_moves_[winning_move_count_][1] =
+          TwoMoves(others[1], ring_group_[1]);
+      ++winning_move_count_;
+      DUMP(printf("Double ring threat\n"));
+    } else {
+      DUMP(printf("Single ring threat\n"));
+    }
+  }
+}
+
+template<int policy>
 int Playout::HavannahMate(Player player, int i) {
-  mate_threats_.clear();
   connecting_cells_.clear();
   winning_move_count_ = 0;
   // neighbors_.clear();
   further_neighbors_.clear();
-  ring_closing_moves_.clear();
-  const ChainNum chain_num =
-      mutable_position_.player_position(player).
-      NewestChainForCell(playout_moves_[i]);
-  RepeatForCellsAdjacentToChain(
-      mutable_position_, player, chain_num, LookForMate);
+  threatened_cells_.ZeroBits();
+  doubly_threatened_cells_.ZeroBits();
+  ring_chains_.ZeroBits();
+  num_ring_closing_moves_ = 0;
+  const Cell chain = board_.ChainForCell(playout_moves_[i]);
+  board_.GetChainRows(chain, chain_rows_);
+  RepeatForCellsAdjacentToRows(
+      chain_rows_, board_.stone_rows(Opponent(player)),
+      player, chain, LookForMate<policy>);
   if (winning_move_count_ < 2) {
-    sort(mate_threats_.begin(), mate_threats_.end());
-    for (std::vector<TwoMoves>::const_iterator ita = mate_threats_.begin();
-          ita != mate_threats_.end(); /**/) {
-      std::vector<TwoMoves>::const_iterator itb =
-          std::adjacent_find<std::vector<TwoMoves>::const_iterator>(
-              ita, mate_threats_.end());
-      if (itb == mate_threats_.end())
-        break;
-      winning_moves_[winning_move_count_][0] = *itb;
-      winning_moves_[winning_move_count_][1] = *(itb + 1);
-      ++winning_move_count_;
-      for (ita = itb + 2; ita != mate_threats_.end(); ++ita) {
-        if (*ita != *itb)
-          break;
+    for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+      for (RowBitmask row = doubly_threatened_cells_.Row(y); row != 0;
+           row &= row - 1) {
+        const Cell cell =
+            XYToCell(static_cast<XCoord>(CountTrailingZeroes(row)), y);
+        winning_moves_[winning_move_count_][0] =
+            TwoMoves(cell, first_mate_threats_[cell]);
+        winning_moves_[winning_move_count_][1] =
+            TwoMoves(cell, second_mate_threats_[cell]);
+        ++winning_move_count_;
       }
     }
   }
 
-  if (winning_move_count_ == 1 && options_->use_havannah_antimate) {
+  if ((policy & kUseHavannahAntimate) && winning_move_count_ == 1) {
     const Cell almost_mating_move = winning_moves_[0][0].first();
     DUMP(printf("Defense against mate\n"));
     ReplaceMove(i + 1, almost_mating_move);
-    assert(mutable_position_.CellIsEmpty(playout_moves_[i + 1]));
+    assert(PlayoutMoveIsLegal(i + 1));
     return -1;
   }
 
   if (winning_move_count_ < 2) {
-    for (std::map<ChainNum, std::vector<Cell> >::const_iterator it =
-         ring_closing_moves_.begin();
-         it != ring_closing_moves_.end(); ++it) {
-      const std::vector<Cell>& v = it->second;
-      assert(!v.empty());
-      tmp0_.clear();
-      tmp0_.push_back(v[0]);
-      for (int j = 0, size = tmp0_.size(); j < size; ++j) {
-        const Cell cell = tmp0_[j];
-        for (int k = 0; k < 6; ++k) {
-          const Cell neighbor_cell = NthNeighbor(cell, k);
-          if (find(v.begin(), v.end(), neighbor_cell) != v.end() &&
-              find(tmp0_.begin(), tmp0_.end(), neighbor_cell) == tmp0_.end()) {
-            tmp0_.push_back(neighbor_cell);
-          }
-        }
-      }
-      tmp1_.clear();
-      for (int j = 0, size = v.size(); j < size; ++j) {
-        if (find(tmp0_.begin(), tmp0_.end(), v[j]) == tmp0_.end()) {
-          tmp1_.push_back(v[j]);
-        }
-      }
-
-      if (!tmp0_.empty() && !tmp1_.empty() &&
-          (tmp0_.size() > 1 || tmp1_.size() > 1)) {
-        winning_moves_[winning_move_count_][0] = TwoMoves(tmp0_[0], tmp1_[0]);
-        if (tmp0_.size() > 1) {
-          winning_moves_[winning_move_count_][1] = TwoMoves(tmp0_[1], tmp1_[0]);
-        } else {
-          winning_moves_[winning_move_count_][1] = TwoMoves(tmp1_[1], tmp0_[0]);
-        }
-        ++winning_move_count_;
-        if (tmp0_.size() > 1 && tmp1_.size() > 1) {
-          winning_moves_[winning_move_count_][0] = TwoMoves(tmp0_[1], tmp1_[1]);
-          winning_moves_[winning_move_count_][1] = TwoMoves(tmp1_[1], tmp0_[1]);
-          ++winning_move_count_;
-          DUMP(printf("Double ring threat\n"));
-        } else {
-          DUMP(printf("Single ring threat\n"));
-        }
+    for (YCoord y = kGapAround; y < kPastRows; y = NextY(y)) {
+      for (RowBitmask row = ring_chains_.Row(y); row != 0; row &= row - 1) {
+        LookForRingThreats(
+            XYToCell(static_cast<XCoord>(CountTrailingZeroes(row)), y));
       }
     }
   }
@@ -421,7 +535,7 @@ int Playout::HavannahMate(Player player, int i) {
       if (rng_(100) < chance_of_forced_connection_) {
         const Cell connecting_cell =
             rng_.GetRandomElement(connecting_cells_);
-        if (playout_moves_[i + 1] != connecting_cell) {
+        if (NthPlayoutMove(i + 1) != connecting_cell) {
           DUMP(printf("Connecting move\n"));
           ReplaceMove(i + 2, connecting_cell);
           return 1;
@@ -439,7 +553,7 @@ int Playout::HavannahMate(Player player, int i) {
   else if (!further_neighbors_.empty()) {
     if (!further_neighbors_.empty()) {
       const int next_move = rng_.GetRandomElement(further_neighbors_);
-      if (playout_moves_[i + 1] != next_move) {
+      if (NthPlayoutMove(i + 1) != next_move) {
         DUMP(printf("Jump\n"));
         ReplaceMove(i + 2, next_move);
       }
@@ -449,4 +563,59 @@ int Playout::HavannahMate(Player player, int i) {
   return -1;
 }
 
+//-- Benchmark --------------------------------------------------------
+// Returns the number of thousands of playouts per second and sets
+// *average_moves to the average length of the playouts.
+static float MeasurePlayoutSpeed(PlayoutOptions options,
+                                 const Patterns* patterns,
+                                 int num_playouts, float* average_moves) {
+  Position position;
+  position.InitToStartPosition();
+  position.MakePermanentMove(kWhite, kBoardCenter);
+  Playout playout(&options, patterns, 12345);
+  playout.PrepareForPlayingFromPosition(&position);
+  const std::vector<Cell> tree_moves;
+  RaveUpdates rave;
+  long long total_moves = 0;
+  const clock_t start = clock();
+  for (int i = 0; i < num_playouts; ++i) {
+    int num_moves;
+    rave.Clear();
+    playout.Play(kBlack, kBoardCenter, tree_moves, &rave, &num_moves);
+    total_moves += num_moves;
+  }
+  const float seconds =
+      static_cast<float>(clock() - start) / CLOCKS_PER_SEC;
+  *average_moves = static_cast<float>(total_moves) / num_playouts;
+  return 1e-3f * num_playouts / std::max(seconds, 1e-6f);
+}
+
+void BenchmarkPlayouts(const PlayoutOptions& options,
+                       const Patterns* patterns, int num_playouts) {
+  static const int kNumVariants = 5;
+  PlayoutOptions variants[kNumVariants];
+  const char* names[kNumVariants] = {
+    "all features",
+    "no Havannah mate",
+    "no Havannah antimate",
+    "no ring detection",
+    "filling the board after 20 moves",
+  };
+  for (int i = 0; i < kNumVariants; ++i) {
+    variants[i] = options;
+  }
+  variants[1].use_havannah_mate = false;
+  variants[2].use_havannah_antimate = false;
+  variants[3].use_ring_detection = false;
+  variants[4].moves_before_filling_board = 20;
+  printf("%-34s %12s %12s\n", "playout options", "speed", "avg. moves");
+  for (int i = 0; i < kNumVariants; ++i) {
+    float average_moves;
+    const float speed = MeasurePlayoutSpeed(
+        variants[i], patterns, num_playouts, &average_moves);
+    printf("%-34s %12.1f %12.1f\n", names[i], speed, average_moves);
+  }
+  printf("(thousands of playouts per second)\n");
+}
+
 }  // namespace lajkonik
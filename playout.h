@@ -26,7 +26,6 @@
 
 // The declaration of the Playout class and its helpers.
 
-#include <map>
 #include <vector>
 
 #include "havannah.h"
@@ -61,6 +60,62 @@ class TwoMoves {
   Cell second_;
 };
 
+// The sums of RAVE rewards that playouts give to the moves of each
+// player. Remembers which moves it has touched, so that clearing it
+// and visiting them take time proportional to the playouts rather
+// than to the board.
+class RaveUpdates {
+ public:
+  RaveUpdates() : size_(0) {
+    for (int i = 0; i < kNumMovesOnBoard; ++i) {
+      rewards_[0][i] = rewards_[1][i] = 0;
+      is_touched_[0][i] = is_touched_[1][i] = false;
+    }
+  }
+  ~RaveUpdates() {}
+
+  void Add(Player player, MoveIndex move, int reward) {
+    rewards_[player][move] += reward;
+    if (!is_touched_[player][move]) {
+      is_touched_[player][move] = true;
+      players_[size_] = player;
+      moves_[size_++] = move;
+    }
+  }
+  void Clear() {
+    for (int i = 0; i < size_; ++i) {
+      rewards_[players_[i]][moves_[i]] = 0;
+      is_touched_[players_[i]][moves_[i]] = false;
+    }
+    size_ = 0;
+  }
+  void CopyFrom(const RaveUpdates& other) {
+    Clear();
+    for (int i = 0; i < other.size_; ++i) {
+      Add(other.players_[i], other.moves_[i], other.reward(i));
+    }
+  }
+
+  // The reward of the i-th touched move. Can be zero.
+  int reward(int i) const { return rewards_[players_[i]][moves_[i]]; }
+  Player player(int i) const { return players_[i]; }
+  MoveIndex move(int i) const { return moves_[i]; }
+  int size() const { return size_; }
+  int at(Player player, MoveIndex move) const {
+    return rewards_[player][move];
+  }
+
+ private:
+  int rewards_[2][kNumMovesOnBoard];
+  bool is_touched_[2][kNumMovesOnBoard];
+  Player players_[2 * kNumMovesOnBoard];
+  MoveIndex moves_[2 * kNumMovesOnBoard];
+  int size_;
+
+  RaveUpdates(const RaveUpdates&);
+  void operator=(const RaveUpdates&);
+};
+
 class Playout {
  public:
   Playout(PlayoutOptions* playout_options,
@@ -70,19 +125,85 @@ class Playout {
 
   void PrepareForPlayingFromPosition(const Position* position);
 
+  // Plays from the position given to PrepareForPlayingFromPosition()
+  // with the tree_moves made in it. Adds +1 for the moves of the winner
+  // and -1 for the moves of the loser to *rave.
   int Play(Player player, Cell last_move,
-           int rave[2][kNumMovesOnBoard], int* num_moves);
+           const std::vector<Cell>& tree_moves,
+           RaveUpdates* rave, int* num_moves);
 
   PlayoutOptions* options() const { return options_; }
   Rng* rng() { return &rng_; }
 
  private:
+  // The bits of the policy template parameter of PlayWithPolicy().
+  // Each of them stands for an option that is set in options_.
+  // The last two take effect only with kUseHavannahMate.
+  enum {
+    kRetryIsolatedMoves = 1,
+    kUseHavannahMate = 2,
+    kUseHavannahAntimate = 4,
+    kUseRingDetection = 8
+  };
+
+  // Play() compiled for the options given by policy, so that its loop
+  // does not test them for every move.
+  template<int policy>
+  int PlayWithPolicy(Player player, Cell last_move,
+                     const std::vector<Cell>& tree_moves,
+                     RaveUpdates* rave, int* num_moves);
   int ReplaceMovesInRingFrames(Player player, int offset);
+  // Draws all the remaining moves of the playout, makes them
+  // in turns from the ith on, and finds the first of them that wins.
+  // Returns the same as Play(), which calls it after
+  // options_->moves_before_filling_board moves.
+  int FillBoard(Player player, int i, RaveUpdates* rave, int* num_moves);
+  // Adds the rewards of the first num_moves moves of the playout
+  // that player has won to *rave.
+  void AddRaveRewards(Player player, int num_moves, RaveUpdates* rave) const;
+  // Returns the ith move of the playout, drawing the moves up to it
+  // from the remaining cells if they have not been drawn yet. Returns
+  // kZerothCell if the board gets filled before the ith move.
+  Cell NthPlayoutMove(int i) {
+    if (i >= num_playout_moves_)
+      return kZerothCell;
+    while (num_drawn_moves_ <= i) {
+      SwapMoves(num_drawn_moves_,
+                num_drawn_moves_ + rng_(num_playout_moves_ - num_drawn_moves_));
+      ++num_drawn_moves_;
+    }
+    return playout_moves_[i];
+  }
+  void SwapMoves(int i, int j) {
+    const Cell cell_i = playout_moves_[i];
+    const Cell cell_j = playout_moves_[j];
+    playout_moves_[i] = cell_j;
+    playout_moves_[j] = cell_i;
+    reverse_playout_moves_[cell_j] = i;
+    reverse_playout_moves_[cell_i] = j;
+  }
+  // Returns true if the ith move of the playout, if any, goes
+  // into an empty cell.
+  bool PlayoutMoveIsLegal(int i) const {
+    return i >= num_playout_moves_ || board_.CellIsEmpty(playout_moves_[i]);
+  }
+  // Makes the cell the ith move of the playout.
   void ReplaceMove(int i, Cell cell);
+  template<int policy>
   void LookForMate(
-      Player player, Cell cell, ChainNum current_chain, unsigned mask[]);
+      Player player, Cell cell, Cell current_chain, unsigned mask[]);
+  // Remembers that the move to the cell would make the move
+  // to the threatened cell winning.
+  void AddMateThreat(Cell threatened_cell, Cell cell);
+  // Remembers that the move to the cell would connect the chain
+  // to the current chain of HavannahMate().
+  void AddRingClosingMove(Cell chain, Cell cell);
+  // Adds the moves that would close a ring with the chain
+  // and the current chain to winning_moves_.
+  void LookForRingThreats(Cell chain);
   int ForceMateInOne(int i, int index, const TwoMoves mating_moves[2]);
   int ForceMateInTwo(int i, const TwoMoves mating_moves[2]);
+  template<int policy>
   int HavannahMate(Player player, int i);
 
   PlayoutOptions* options_;
@@ -90,18 +211,25 @@ class Playout {
 
   Rng rng_;
   const Position* position_;
-  Position mutable_position_;
-  std::vector<Cell> free_cells_;
+  // The stones of position_, and of position_ with the moves
+  // of the tree that lead to the leaf where the playout starts.
+  PlayoutBoard start_board_;
+  PlayoutBoard board_;
+  RowBitmask chain_rows_[kBoardHeight];
+  // The cells that are empty in position_, in the order of the moves
+  // of the playout up to num_drawn_moves_ and in no particular order
+  // up to num_playout_moves_. The moves of the tree follow them.
+  // The order of the cells carries over between playouts.
   std::vector<Cell> playout_moves_;
+  int num_playout_moves_;
+  int num_drawn_moves_;
+  // The inverse permutation of playout_moves_.
   int reverse_playout_moves_[kNumCellsWithSentinels];
   std::vector<Player> playout_players_;
-  std::vector<TwoMoves> mate_threats_;
   std::vector<Cell> connecting_cells_;
   std::vector<Cell> neighbors_;
   std::vector<Cell> further_neighbors_;
   std::vector<Cell> other_two_bridge_cells_;
-  std::vector<Cell> tmp0_;
-  std::vector<Cell> tmp1_;
   std::vector<Cell> mates_in_one_move_;
   std::vector<int> mates_in_two_moves_indices_;
   TwoMoves winning_moves_[kNumMovesOnBoard][2];
@@ -109,12 +237,40 @@ class Playout {
   int canned_moves_;
   int chance_of_forced_connection_;
   int chance_of_connection_defense_;
-  std::map<ChainNum, std::vector<Cell> > ring_closing_moves_;
+  // The cells threatened by one and by two moves next to the current
+  // chain of HavannahMate(), with the first and the second of these
+  // moves in first_mate_threats_ and second_mate_threats_.
+  BoardBitmask threatened_cells_;
+  BoardBitmask doubly_threatened_cells_;
+  Cell first_mate_threats_[kNumCellsWithSentinels];
+  Cell second_mate_threats_[kNumCellsWithSentinels];
+  // The roots of the chains that moves next to the current chain
+  // connect to it. The moves of each chain form a list, from
+  // ring_closing_moves_[first_ring_closing_moves_[chain]] through
+  // next_ring_closing_moves_ to -1.
+  BoardBitmask ring_chains_;
+  int first_ring_closing_moves_[kNumCellsWithSentinels];
+  int last_ring_closing_moves_[kNumCellsWithSentinels];
+  // A move connects at most three chains to the current chain.
+  Cell ring_closing_moves_[3 * kNumMovesOnBoard];
+  int next_ring_closing_moves_[3 * kNumMovesOnBoard];
+  int num_ring_closing_moves_;
+  // The ring closing moves of one chain during LookForRingThreats().
+  // Empty outside it.
+  BoardBitmask ring_closing_cells_;
+  // The ring closing moves connected to the first of them.
+  Cell ring_group_[kNumMovesOnBoard];
 
   Playout(const Playout&);
   void operator=(const Playout&);
 };
 
+// Prints how many playouts per second Playout makes with options
+// and with each of its features turned off in turn, playing
+// num_playouts playouts after the first move to the center.
+void BenchmarkPlayouts(const PlayoutOptions& options,
+                       const Patterns* patterns, int num_playouts);
+
 }  // namespace lajkonik
 
 #endif  // PLAYOUT_H_
@@ -110,6 +110,7 @@ int main() {
   prototype_playout_options.chance_of_connection_defense_intercept = 42.0;
   prototype_playout_options.chance_of_connection_defense_slope = -28.0;
   prototype_playout_options.retries_of_isolated_moves = 1;
+  prototype_playout_options.moves_before_filling_board = -1;
   prototype_playout_options.use_havannah_mate = true;
   prototype_playout_options.use_havannah_antimate = true;
   prototype_playout_options.use_ring_detection = true;
@@ -143,6 +144,8 @@ int main() {
   prototype_mcts_options.tricky_epsilon = 0.02;
   prototype_mcts_options.locality_bias = 4.0;
   prototype_mcts_options.chain_size_bias_factor = 6.0;
+  prototype_mcts_options.widening_factor = 4.0;
+  prototype_mcts_options.widening_base = 0;
   prototype_mcts_options.rave_update_depth = 1000;
   prototype_mcts_options.expand_after_n_playouts = 160;
   prototype_mcts_options.play_n_playouts_at_once = 1;
@@ -150,6 +153,12 @@ int main() {
   prototype_mcts_options.prior_num_simulations_range = 7;
   prototype_mcts_options.prior_reward_halfrange = 5;
   prototype_mcts_options.neighborhood_size = 2;
+  // Each player has a tree of a quarter of the physical memory
+  // but no more than 1 GB.
+  prototype_mcts_options.tt_size_mb =
+      std::min(1024, lajkonik::GetPhysicalMemoryInMegabytes() / 4);
+  prototype_mcts_options.solver_empty_cells = 16;
+  prototype_mcts_options.solver_node_limit = 10000;
   prototype_mcts_options.exploration_strategy =
       lajkonik::kSilverWithProgressiveBias;
   prototype_mcts_options.use_rave_randomization = false;
@@ -176,6 +185,13 @@ int main() {
   lajkonik::ControllerOptions controller_options[2];
 
   prototype_controller_options.seconds_per_move = 30;
+  prototype_controller_options.time_safety_margin_ms = 100;
+  prototype_controller_options.playout_budget = 0;
+  prototype_controller_options.node_budget = 0;
+  prototype_controller_options.random_seed = 0;
+  prototype_controller_options.num_threads = NUM_THREADS;
+  prototype_controller_options.first_core = -1;
+  prototype_controller_options.playout_threads = 0;
   prototype_controller_options.sole_nonlosing_move_win_ratio_threshold = 0.2;
   prototype_controller_options.win_ratio_threshold = 0.6;
   prototype_controller_options.use_swap = false;
@@ -183,6 +199,9 @@ int main() {
   prototype_controller_options.end_games_quickly = false;
   prototype_controller_options.print_debug_info = true;
   prototype_controller_options.clear_tt_after_move = false;  // Don't care.
+  prototype_controller_options.reuse_search_tree = true;
+  prototype_controller_options.stop_when_decided = true;
+  prototype_controller_options.ponder = false;
 
   controller_options[kWhite] = prototype_controller_options;
   controller_options[kBlack] = prototype_controller_options;
@@ -21,15 +21,26 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
-// Unit tests for havannah.cc
+// Unit tests for havannah.cc, wfhashmap.h, and the endgame solver
+// in mcts.cc
 
 #include "havannah.h"
 
+#include <pthread.h>
 #include <string.h>
+#include <time.h>
+#include <algorithm>
 #include <set>
 #include <string>
+#include <vector>
 
+#include "define-playout-patterns.h"
 #include "fct.h"
+#include "mcts.h"
+#include "options.h"
+#include "patterns.h"
+#include "playout.h"
+#include "wfhashmap.h"
 
 using lajkonik::Player;
 using lajkonik::XCoord;
@@ -42,7 +53,10 @@ using lajkonik::Chain;
 using lajkonik::ChainSet;
 using lajkonik::PlayerPosition;
 using lajkonik::Position;
+using lajkonik::PlayoutBoard;
 using lajkonik::Memento;
+using lajkonik::MoveIndex;
+using lajkonik::WinningCondition;
 
 using lajkonik::CountSetBits;
 using lajkonik::CountTrailingZeroes;
@@ -64,6 +78,8 @@ using lajkonik::kBoardHeight;
 using lajkonik::kZerothCell;
 using lajkonik::kBoardCenter;
 using lajkonik::kNumCellsWithSentinels;
+using lajkonik::kNoWinningCondition;
+using lajkonik::kBenzeneRing;
 
 using lajkonik::kNeighborOffsets;
 using lajkonik::kReverseNeighborhoods;
@@ -183,6 +199,78 @@ do { \
   return result;
 }
 
+// A value of WaitFreeHashMap whose weight can be set at will.
+struct WeightedValue {
+  void Init() { weight_ = 0; }
+  int weight() const { return weight_; }
+  int weight_;
+};
+
+typedef lajkonik::WaitFreeHashMap<unsigned long long, WeightedValue>
+    WeightedHashMap;
+
+// Returns the nth of the keys that share the probe sequence
+// of a WaitFreeHashMap with 1024 slots.
+unsigned long long NthKeyInProbeWindow(int n) {
+  return (0x155ULL << 54) | (static_cast<unsigned long long>(n + 1) << 20) |
+         0x2A5;
+}
+
+// Sets playout_options as lajkonik.cc does.
+void InitPlayoutOptions(lajkonik::PlayoutOptions* playout_options) {
+  playout_options->initial_chance_of_ring_notice = 150.0;
+  playout_options->final_chance_of_ring_notice = -350.0;
+  playout_options->chance_of_forced_connection_intercept = 34.0;
+  playout_options->chance_of_forced_connection_slope = -30.0;
+  playout_options->chance_of_connection_defense_intercept = 42.0;
+  playout_options->chance_of_connection_defense_slope = -28.0;
+  playout_options->retries_of_isolated_moves = 1;
+  playout_options->moves_before_filling_board = -1;
+  playout_options->use_havannah_mate = true;
+  playout_options->use_havannah_antimate = true;
+  playout_options->use_ring_detection = true;
+}
+
+// Sets mcts_options as lajkonik.cc does, but expands positions at once,
+// so that short searches grow deep trees.
+void InitMctsOptions(lajkonik::MctsOptions* mcts_options) {
+  mcts_options->exploration_factor = 0.0;
+  mcts_options->rave_bias = 1e-4;
+  mcts_options->first_play_urgency = 1e3;
+  mcts_options->tricky_epsilon = 0.02;
+  mcts_options->locality_bias = 1.0;
+  mcts_options->chain_size_bias_factor = 0.0;
+  mcts_options->widening_factor = 4.0;
+  mcts_options->widening_base = 0;
+  mcts_options->rave_update_depth = 1000;
+  mcts_options->expand_after_n_playouts = 1;
+  mcts_options->play_n_playouts_at_once = 1;
+  mcts_options->prior_num_simulations_base = 4;
+  mcts_options->prior_num_simulations_range = 7;
+  mcts_options->prior_reward_halfrange = 5;
+  mcts_options->neighborhood_size = 2;
+  mcts_options->tt_size_mb = 16;
+  mcts_options->solver_empty_cells = 0;
+  mcts_options->solver_node_limit = 1;
+  mcts_options->exploration_strategy = lajkonik::kSilverWithProgressiveBias;
+  mcts_options->use_rave_randomization = false;
+  mcts_options->use_mate_in_tree = true;
+  mcts_options->use_antimate_in_tree = true;
+  mcts_options->use_deeper_mate_in_tree = true;
+  mcts_options->use_virtual_loss = true;
+  mcts_options->use_solver = true;
+}
+
+// Sets *terminate, which points to a volatile bool, after 200 ms.
+void* TerminateSoon(void* terminate) {
+  timespec delay;
+  delay.tv_sec = 0;
+  delay.tv_nsec = 200 * 1000 * 1000;
+  nanosleep(&delay, NULL);
+  *static_cast<volatile bool*>(terminate) = true;
+  return NULL;
+}
+
 }  // namespace
 
 // Slow implementation of Position::Get18Neighbors() on an empty board.
@@ -406,6 +494,58 @@ FCT_QTEST_BGN(Memento_forgets_undone_changes)
   fct_chk_eq_int(chain_set.size(), 2);
 FCT_QTEST_END();
 
+FCT_QTEST_BGN(WaitFreeHashMap_evicts_the_lightest_evictable_value)
+  // The smallest map has 1024 slots and probe windows of 16 slots.
+  WeightedHashMap map(0);
+  const int kLightest = 9;
+  const int kHeavy = 3;
+  for (int i = 0; i < 16; ++i) {
+    WeightedValue* value = map.InsertKey(NthKeyInProbeWindow(i));
+    fct_req(value != NULL);
+    value->weight_ = (i == kLightest) ? 1 : (i == kHeavy) ? INT_MAX : 100 + i;
+  }
+  fct_chk_eq_int(map.num_elements(), 16);
+  fct_chk_eq_int(map.num_evictions(), 0);
+  WeightedValue* value = map.InsertKey(NthKeyInProbeWindow(16));
+  fct_req(value != NULL);
+  fct_chk_eq_int(value->weight(), 0);
+  fct_chk_eq_int(map.num_evictions(), 1);
+  for (int i = 0; i <= 16; ++i) {
+    WeightedValue* found = map.FindValue(NthKeyInProbeWindow(i));
+    fct_xchk((found == NULL) == (i == kLightest), "key %d", i);
+  }
+  // Values of weight INT_MAX are never evicted.
+  for (int i = 0; i <= 16; ++i) {
+    WeightedValue* found = map.FindValue(NthKeyInProbeWindow(i));
+    if (found != NULL)
+      found->weight_ = INT_MAX;
+  }
+  fct_chk(map.InsertKey(NthKeyInProbeWindow(17)) == NULL);
+  fct_chk(map.FindValue(NthKeyInProbeWindow(kHeavy)) != NULL);
+  fct_chk_eq_int(map.num_evictions(), 1);
+FCT_QTEST_END();
+
+FCT_QTEST_BGN(WaitFreeHashMap_tells_apart_keys_that_differ_in_generation_bits)
+  // Bits 10 to 15 feed neither hash of a map with 1024 slots, so the
+  // keys below share their probe sequence and their stamps.
+  WeightedHashMap map(0);
+  const unsigned long long key = NthKeyInProbeWindow(0);
+  WeightedValue* value = map.InsertKey(key);
+  fct_req(value != NULL);
+  value->weight_ = 1;
+  for (int i = 1; i < 8; ++i) {
+    const unsigned long long other_key = key ^ (i << 10);
+    fct_chk(map.FindValue(other_key) == NULL);
+    WeightedValue* other_value = map.InsertKey(other_key);
+    fct_req(other_value != NULL);
+    fct_chk(other_value != value);
+    fct_chk_eq_int(other_value->weight(), 0);
+    fct_chk(map.FindValue(other_key) == other_value);
+  }
+  fct_chk(map.FindValue(key) == value);
+  fct_chk_eq_int(map.num_elements(), 8);
+FCT_QTEST_END();
+
 FCT_QTEST_BGN(ChainSet_sets_board_correctly)
   ChainSet chain_set;
   Memento memento;
@@ -609,26 +749,33 @@ FCT_QTEST_BGN(ChainSet_sets_dumpling_ring_correctly)
   }
 FCT_QTEST_END();
 
-FCT_QTEST_BGN(PlayerPosition_correctly_updates_chains_to_newest_versions)
+FCT_QTEST_BGN(PlayerPosition_merges_smaller_chains_into_larger_ones_reversibly)
   PlayerPosition player_position;
   Memento memento;
   const Cell a1 = FromClassicalString("a1");
-  const Cell a2 = FromClassicalString("a2");
-  const Cell a3 = FromClassicalString("a3");
   const Cell a4 = FromClassicalString("a4");
-  player_position.MakeMoveReversibly(a1, &memento);
-  player_position.MakeMoveReversibly(a3, &memento);
+  const Cell a5 = FromClassicalString("a5");
+  player_position.MakeMoveFast(a1);
+  player_position.MakeMoveFast(FromClassicalString("a2"));
+  player_position.MakeMoveFast(FromClassicalString("a3"));
+  player_position.MakeMoveFast(a5);
+  const ChainNum large = player_position.chain_for_cell(a1);
+  const ChainNum small = player_position.chain_for_cell(a5);
+  fct_chk(large != small);
+  fct_chk_eq_int(player_position.CountChains(), 2);
   player_position.MakeMoveReversibly(a4, &memento);
-  player_position.MakeMoveReversibly(a2, &memento);
-  /*const ChainNo ch1 =*/ player_position.chain_for_cell(a1);
-  const ChainNum ch2 = player_position.chain_for_cell(a3);
-  const ChainNum ch3 = player_position.chain_for_cell(a2);
-  fct_chk(player_position.chain_for_cell(a4) == ch2);
-  player_position.UpdateChainsToNewestVersionsReversibly(&memento);
-  fct_chk(player_position.chain_for_cell(a1) == ch3);
-  fct_chk(player_position.chain_for_cell(a2) == ch3);
-  fct_chk(player_position.chain_for_cell(a3) == ch3);
-  fct_chk(player_position.chain_for_cell(a4) == ch3);
+  fct_chk(player_position.NewestChainForCell(a4) == large);
+  fct_chk(player_position.NewestChainForCell(a5) == large);
+  fct_chk_eq_int(player_position.NthChain(large)->num_stones(), 5);
+  fct_chk(player_position.ChainMaskForCell(a5).get(CellToX(a1), CellToY(a1)));
+  fct_chk_eq_int(player_position.CountChains(), 1);
+  memento.UndoAll();
+  fct_chk(player_position.NewestChainForCell(a5) == small);
+  fct_chk_eq_int(player_position.NthChain(large)->num_stones(), 3);
+  fct_chk_eq_int(player_position.NthChain(small)->num_stones(), 1);
+  fct_chk(!player_position.ChainMaskForCell(a1).get(CellToX(a5), CellToY(a5)));
+  fct_chk(!player_position.ChainMaskForCell(a1).get(CellToX(a4), CellToY(a4)));
+  fct_chk_eq_int(player_position.CountChains(), 2);
 FCT_QTEST_END();
 
 FCT_QTEST_BGN(PlayerPosition_MoveWouldCloseForkBridgeOrRing_sees_rings)
@@ -836,6 +983,102 @@ FCT_QTEST_BGN(Position_ParseString_gives_correct_results)
   g_use_lg_coordinates = remember_coordinate_system;
 FCT_QTEST_END();
 
+FCT_QTEST_BGN(PlayoutBoard_agrees_with_Position)
+  unsigned seed = 12345;
+  for (int game = 0; game < 20; ++game) {
+    Position position;
+    position.InitToStartPosition();
+    std::vector<Cell> free_cells;
+    position.GetFreeCells(&free_cells);
+    for (int i = free_cells.size() - 1; i > 0; --i) {
+      seed = seed * 1103515245 + 12345;
+      std::swap(free_cells[i], free_cells[(seed >> 16) % (i + 1)]);
+    }
+    // Some moves go into position before the PlayoutBoard sees it.
+    const int num_permanent_moves = 2 * game;
+    for (int i = 0; i < num_permanent_moves; ++i) {
+      position.MakePermanentMove(static_cast<Player>(i % 2), free_cells[i]);
+    }
+    PlayoutBoard board;
+    board.InitFromPosition(position);
+    Position fast_position;
+    fast_position.CopyFrom(position);
+    const int num_moves = std::min(
+        static_cast<int>(free_cells.size()), num_permanent_moves + 100);
+    for (int i = num_permanent_moves; i < num_moves; ++i) {
+      const Player player = static_cast<Player>(i % 2);
+      for (int j = i; j < num_moves; ++j) {
+        const Cell cell = free_cells[j];
+        const unsigned neighborhood = fast_position.Get6Neighbors(player, cell);
+        fct_chk_eq_int(board.Get6Neighbors(player, cell), neighborhood);
+        fct_chk(board.Get18Neighbors(player, cell) ==
+                fast_position.Get18Neighbors(player, cell));
+        fct_chk_eq_int(
+            board.MoveIsWinning(player, cell, neighborhood, kZerothCell),
+            fast_position.MoveIsWinning(player, cell, neighborhood, 0));
+        fct_chk_eq_int(
+            board.GetSizeOfNeighborChains(player, cell, 18),
+            fast_position.player_position(player).
+                GetSizeOfNeighborChains(cell, 18));
+      }
+      const Cell cell = free_cells[i];
+      const WinningCondition expected =
+          fast_position.MakeMoveFast(player, cell);
+      const WinningCondition result = board.MakeMove(player, cell);
+      fct_chk_eq_int(result, expected);
+      fct_chk_eq_int(board.GetCell(cell), fast_position.GetCell(cell) & 3);
+      fct_chk_eq_int(
+          board.EdgesCornersForCell(cell),
+          fast_position.player_position(player).
+              EdgesCornersRingForCell(cell));
+    }
+    for (int i = 0; i < num_permanent_moves; ++i) {
+      position.UndoPermanentMove();
+    }
+  }
+FCT_QTEST_END();
+
+FCT_QTEST_BGN(FindFirstWinningMove_agrees_with_MakeMove)
+  unsigned seed = 54321;
+  for (int game = 0; game < 200; ++game) {
+    Position position;
+    position.InitToStartPosition();
+    std::vector<Cell> free_cells;
+    position.GetFreeCells(&free_cells);
+    for (int i = free_cells.size() - 1; i > 0; --i) {
+      seed = seed * 1103515245 + 12345;
+      std::swap(free_cells[i], free_cells[(seed >> 16) % (i + 1)]);
+    }
+    PlayoutBoard board;
+    board.InitFromPosition(position);
+    // Some moves go into the board before the search starts.
+    const int num_moves = free_cells.size();
+    int num_board_moves = game % 20;
+    for (int i = 0; i < num_board_moves; ++i) {
+      if (board.MakeMove(static_cast<Player>(i % 2), free_cells[i]) !=
+          kNoWinningCondition) {
+        num_board_moves = 0;
+        board.InitFromPosition(position);
+        break;
+      }
+    }
+    const Player player = static_cast<Player>(num_board_moves % 2);
+    WinningCondition victory;
+    const int winning_move = board.FindFirstWinningMove(
+        player, &free_cells[num_board_moves], num_moves - num_board_moves,
+        &victory);
+    WinningCondition expected = kNoWinningCondition;
+    int i;
+    for (i = num_board_moves; i < num_moves; ++i) {
+      expected = board.MakeMove(static_cast<Player>(i % 2), free_cells[i]);
+      if (expected != kNoWinningCondition)
+        break;
+    }
+    fct_chk_eq_int(num_board_moves + winning_move, i);
+    fct_chk_eq_int(victory, expected & ~kBenzeneRing);
+  }
+FCT_QTEST_END();
+
 FCT_QTEST_BGN(RepeatForCellsAdjacentToChain_gives_correct_results)
   static const char* empty_black[] = { NULL };
   static const char* white1[] = { "a1", NULL };
@@ -863,4 +1106,165 @@ FCT_QTEST_BGN(RepeatForCellsAdjacentToChain_gives_correct_results)
   fct_chk(TestRepeatForCells(white7, black7, expected7));
 FCT_QTEST_END();
 
+
+FCT_QTEST_BGN(EndgameSolver_solves_kids_one_ply_below_the_threshold)
+  lajkonik::PlayoutOptions playout_options;
+  InitPlayoutOptions(&playout_options);
+  lajkonik::Patterns patterns(lajkonik::kPlayoutPatterns);
+  lajkonik::Playout playout(&playout_options, &patterns, 1);
+
+  lajkonik::MctsOptions mcts_options;
+  InitMctsOptions(&mcts_options);
+
+  lajkonik::TreeStorage tree_storage(mcts_options.tt_size_mb);
+  lajkonik::MctsEngine engine(&mcts_options, &playout);
+  engine.set_tree_storage(&tree_storage);
+  Position position;
+  position.InitToStartPosition();
+  position.MakePermanentMove(kWhite, kBoardCenter);
+  lajkonik::SearchBudget budget;
+  budget.max_playouts = 1000;
+  budget.max_nodes = 0;
+  budget.num_playouts = 0;
+  budget.initial_expansion_count = 0;
+  volatile bool terminate = false;
+  engine.SearchForMove(kBlack, position, &budget, NULL, &terminate);
+
+  // The kids of the root have one empty cell too many to be solved,
+  // but their kids do not.
+  mcts_options.solver_empty_cells = position.NumAvailableMoves() - 2;
+  lajkonik::EndgameSolver solver(&mcts_options);
+  solver.set_tree_storage(&tree_storage);
+  pthread_t terminator;
+  fct_req(pthread_create(&terminator, NULL, TerminateSoon,
+                         const_cast<bool*>(&terminate)) == 0);
+  solver.Run(kBlack, position, &terminate);
+  pthread_join(terminator, NULL);
+  fct_chk(solver.solve_count() > 0);
+FCT_QTEST_END();
+
+
+FCT_QTEST_BGN(TreeStorage_prunes_all_but_the_most_simulated_positions)
+  lajkonik::PlayoutOptions playout_options;
+  InitPlayoutOptions(&playout_options);
+  lajkonik::Patterns patterns(lajkonik::kPlayoutPatterns);
+  lajkonik::Playout playout(&playout_options, &patterns, 1);
+  lajkonik::MctsOptions mcts_options;
+  InitMctsOptions(&mcts_options);
+  // Positions expanded at once would fill the tree in one descent.
+  mcts_options.expand_after_n_playouts = 20;
+  mcts_options.tt_size_mb = 1;
+
+  lajkonik::TreeStorage tree_storage(mcts_options.tt_size_mb);
+  lajkonik::MctsEngine engine(&mcts_options, &playout);
+  engine.set_tree_storage(&tree_storage);
+  Position position;
+  position.InitToStartPosition();
+  position.MakePermanentMove(kWhite, kBoardCenter);
+  lajkonik::SearchBudget budget;
+  budget.max_playouts = 0;
+  budget.max_nodes = 0;
+  budget.num_playouts = 0;
+  budget.initial_expansion_count = 0;
+  volatile bool terminate = false;
+  for (int i = 0; i < 100 && !engine.TranspositionTableNeedsPruning(); ++i) {
+    budget.max_playouts = 1000 * (i + 1);
+    engine.SearchForMove(kBlack, position, &budget, NULL, &terminate);
+  }
+  fct_req(engine.TranspositionTableNeedsPruning());
+  std::vector<lajkonik::MoveInfo> moves_before;
+  engine.GetRootMoves(&moves_before);
+
+  engine.PrepareTranspositionTable(position);
+  fct_chk(!engine.TranspositionTableNeedsPruning());
+  // The root keeps its kids with their statistics.
+  std::vector<lajkonik::MoveInfo> moves_after;
+  engine.GetRootMoves(&moves_after);
+  fct_req(moves_after.size() == moves_before.size());
+  for (int i = 0, size = moves_before.size(); i < size; ++i) {
+    fct_chk_eq_int(moves_after[i].move, moves_before[i].move);
+    fct_chk_eq_int(moves_after[i].num_simulations,
+                   moves_before[i].num_simulations);
+  }
+  // The room of the forgotten kids goes to new ones.
+  const int expansion_failure_count = engine.expansion_failure_count();
+  budget.num_playouts = 0;
+  budget.max_playouts = 500;
+  engine.SearchForMove(kBlack, position, &budget, NULL, &terminate);
+  fct_chk_eq_int(engine.expansion_failure_count(), expansion_failure_count);
+FCT_QTEST_END();
+
+
+FCT_QTEST_BGN(MctsEngine_counts_only_expanded_positions_against_node_budget)
+  lajkonik::PlayoutOptions playout_options;
+  InitPlayoutOptions(&playout_options);
+  lajkonik::Patterns patterns(lajkonik::kPlayoutPatterns);
+  lajkonik::Playout playout(&playout_options, &patterns, 1);
+  lajkonik::MctsOptions mcts_options;
+  InitMctsOptions(&mcts_options);
+  mcts_options.expand_after_n_playouts = 20;
+
+  lajkonik::TreeStorage tree_storage(mcts_options.tt_size_mb);
+  lajkonik::MctsEngine engine(&mcts_options, &playout);
+  engine.set_tree_storage(&tree_storage);
+  Position position;
+  position.InitToStartPosition();
+  position.MakePermanentMove(kWhite, kBoardCenter);
+  lajkonik::SearchBudget budget;
+  budget.max_playouts = 0;
+  budget.max_nodes = 10;
+  budget.num_playouts = 0;
+  budget.initial_expansion_count = engine.expansion_count();
+  volatile bool terminate = false;
+  engine.SearchForMove(kBlack, position, &budget, NULL, &terminate);
+  fct_chk_eq_int(engine.expansion_count() - budget.initial_expansion_count,
+                 10);
+  // The RAVE statistics of playouts insert many more positions.
+  fct_chk(engine.root_simulation_count() >= 10 * 20);
+FCT_QTEST_END();
+
+
+FCT_QTEST_BGN(MctsEngine_creates_kids_as_progressive_widening_unveils_them)
+  lajkonik::PlayoutOptions playout_options;
+  InitPlayoutOptions(&playout_options);
+  lajkonik::Patterns patterns(lajkonik::kPlayoutPatterns);
+  lajkonik::Playout playout(&playout_options, &patterns, 1);
+  lajkonik::MctsOptions mcts_options;
+  InitMctsOptions(&mcts_options);
+  mcts_options.expand_after_n_playouts = 20;
+  mcts_options.widening_base = 2;
+  mcts_options.widening_factor = 1.0;
+
+  lajkonik::TreeStorage tree_storage(mcts_options.tt_size_mb);
+  lajkonik::MctsEngine engine(&mcts_options, &playout);
+  engine.set_tree_storage(&tree_storage);
+  Position position;
+  position.InitToStartPosition();
+  position.MakePermanentMove(kWhite, kBoardCenter);
+  lajkonik::SearchBudget budget;
+  budget.max_nodes = 0;
+  budget.initial_expansion_count = 0;
+  volatile bool terminate = false;
+  std::vector<lajkonik::MoveInfo> moves;
+  // The root gets expanded after 20 playouts and has more kids to
+  // unveil after 2000.
+  for (int max_playouts = 30; max_playouts <= 3000; max_playouts *= 100) {
+    budget.max_playouts = max_playouts;
+    budget.num_playouts = 0;
+    engine.SearchForMove(kBlack, position, &budget, NULL, &terminate);
+    moves.clear();
+    engine.GetRootMoves(&moves);
+    const int num_kids_to_consider =
+        2 + static_cast<int>(logf(engine.root_simulation_count()));
+    fct_chk(static_cast<int>(moves.size()) >= num_kids_to_consider - 1);
+    fct_chk(static_cast<int>(moves.size()) <= num_kids_to_consider);
+  }
+  // The unveiled kids follow the old ones without repeating them.
+  std::set<int> cells;
+  for (int i = 0, size = moves.size(); i < size; ++i) {
+    cells.insert(moves[i].move);
+  }
+  fct_chk_eq_int(cells.size(), moves.size());
+FCT_QTEST_END();
+
 FCT_END();
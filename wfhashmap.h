@@ -25,9 +25,28 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 // Definitions of atomic operations and the WaitFreeHashMap class.
+// The Value type must provide void Init() and int weight() const;
+// values with lower weight are evicted first when the map fills up
+// and values with weight INT_MAX are never evicted. No operation
+// of the map waits for other threads for more than a bounded number
+// of steps; when it would have to, it reports a miss instead.
 
 #include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#ifdef USE_BUCKETED_HASH_MAP
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif  // defined(__AVX2__) || defined(__SSE4_1__)
+// Buckets hold only stamps, so that a whole bucket fits in a cache line.
+#ifndef USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+#define USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+#endif  // USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+#endif  // USE_BUCKETED_HASH_MAP
 
 namespace lajkonik {
 
@@ -75,82 +94,214 @@ bool AtomicIncrementIfFalse(T* ptr, T increment, bool(*predicate)(T)) {
 }
 #endif  // NUM_THREADS > 1
 
-template<typename Key, typename Value, int kLogCapacity>
+// Returns size bytes of zero-filled memory, preferably backed by huge
+// pages to reduce TLB misses on random accesses, or NULL on failure.
+// The memory must be released with FreeHugePages(memory, size).
+inline void* AllocateHugePages(size_t size) {
+  void* memory;
+#ifdef MAP_HUGETLB
+  memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+  if (memory != MAP_FAILED)
+    return memory;
+#endif  // MAP_HUGETLB
+  memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (memory == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  // Transparent huge pages are merely a hint.
+  madvise(memory, size, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+  return memory;
+}
+
+inline void FreeHugePages(void* memory, size_t size) {
+  munmap(memory, size);
+}
+
+template<typename Key, typename Value>
 class WaitFreeHashMap {
  public:
-  WaitFreeHashMap() {}
-  ~WaitFreeHashMap() {}
+  // Creates the largest map that fits in the given number of megabytes.
+  explicit WaitFreeHashMap(int megabytes)
+      : megabytes_(megabytes),
+        generation_(kFirstGeneration) {
+    int log_capacity = 10;
+    while (log_capacity < 30 &&
+           (static_cast<size_t>(2) << log_capacity) * sizeof(Entry) <=
+               (static_cast<size_t>(megabytes) << 20)) {
+      ++log_capacity;
+    }
+    assert(2 * log_capacity <= static_cast<int>(8 * sizeof(Key)));
+    capacity_ = 1 << log_capacity;
+    limit_ = capacity_ / 4 * 3;
+    shift_ = 8 * sizeof(Key) - log_capacity;
+    // Round up to the size of a huge page for the sake of MAP_HUGETLB.
+    mapped_size_ = (static_cast<size_t>(capacity_) * sizeof(Entry) +
+                    kHugePageSize - 1) & ~(kHugePageSize - 1);
+    void* memory = AllocateHugePages(mapped_size_);
+    if (memory == NULL) {
+      fprintf(stderr, "Cannot allocate %d MB for a hash map\n", megabytes);
+      exit(EXIT_FAILURE);
+    }
+#ifdef USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+    stamps_ = static_cast<Key*>(memory);
+    slots_ = reinterpret_cast<Slot*>(stamps_ + capacity_);
+#else
+    array_ = static_cast<Entry*>(memory);
+#endif  // USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+    // Fresh anonymous mappings are zero-filled, so all slots are empty.
+    memset(num_elements_, 0, sizeof num_elements_);
+    memset(num_evictions_, 0, sizeof num_evictions_);
+  }
+
+  ~WaitFreeHashMap() {
+#ifdef USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+    FreeHugePages(stamps_, mapped_size_);
+#else
+    FreeHugePages(array_, mapped_size_);
+#endif  // USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
+  }
 
+  // Empties the map in O(1) time. Keys inserted before the call belong
+  // to an older generation and their slots are considered empty.
   void Clear() {
-    for (int i = 0; i < kCapacity; ++i) {
-      *keys(i) = kEmptyKey;
-      values(i)->Init();
+    generation_ = generation_ + 1;
+    if (generation_ == kBusyGeneration) {
+      Scrub();
+      generation_ = kFirstGeneration;
     }
     memset(num_elements_, 0, sizeof num_elements_);
+    memset(num_evictions_, 0, sizeof num_evictions_);
   }
 
+  // Returns the value associated with key, inserting the key if it is
+  // absent. Each key lives within the first kProbeWindow slots of its
+  // probe sequence. When none of them is free, the slot whose value has
+  // the lowest weight() below INT_MAX is taken over by key. Returns NULL
+  // if each of these slots holds a value of weight INT_MAX, if another
+  // thread keeps initializing a value with the stamp of key for longer
+  // than kMaxBusyReads reads, or if other threads take kProbeWindow
+  // victims in a row. A pointer to a value stays valid once the value
+  // has reached weight INT_MAX and FindValue() still returns it
+  // afterwards.
   Value* InsertKey(Key key) {
-    if (num_elements_[0] > kLimit / ARRAYSIZE(num_elements_))
-      return NULL;
-    int hash = PrimaryHash(key);
-    Key old_key;
-    if (key != kEmptyKey) {
-      old_key = AtomicCompareAndSwap(keys(hash), kEmptyKey, key);
-      if (old_key == kEmptyKey) {
-        increment_num_elements(key);
-        return values(hash);
-      } else if (old_key == key) {
-        return values(hash);
-      }
-      const int jump = SecondaryHash(key);
-      while (true) {
-        hash = (hash + jump) % kCapacity;
-        old_key = AtomicCompareAndSwap(keys(hash), kEmptyKey, key);
-        if (old_key == kEmptyKey) {
-          increment_num_elements(key);
-          return values(hash);
-        } else if (old_key == key) {
+    const Key generation = generation_;
+    const Key stamped_key = StampKey(key, generation);
+    const Key busy_key = StampKey(key, kBusyGeneration);
+    const int jump = Jump(key);
+    for (int attempt = 0; attempt < kProbeWindow; ++attempt) {
+      int hash = FirstSlot(key);
+#ifdef USE_BUCKETED_HASH_MAP
+      const int match = FindInBucket(hash, key, stamped_key);
+      if (match != -1)
+        return values(match);
+#endif  // USE_BUCKETED_HASH_MAP
+      int victim = -1;
+      int victim_weight = INT_MAX;
+      Key victim_stamp = kEmptyKey;
+      for (int i = 0; i < kProbeWindow; ++i) {
+        Key old_stamp = LoadStamp(hash);
+        if (IsStale(old_stamp, generation)) {
+          const Key found_stamp =
+              AtomicCompareAndSwap(stamps(hash), old_stamp, busy_key);
+          if (found_stamp == old_stamp) {
+            // Other threads do not see the key until its value is reset.
+            *keys(hash) = key;
+            values(hash)->Init();
+            AtomicCompareAndSwap(stamps(hash), busy_key, stamped_key);
+            increment_num_elements(key);
+            return values(hash);
+          }
+          old_stamp = found_stamp;
+        }
+        if (old_stamp == busy_key) {
+          // Another thread may be inserting the same key. An aborted
+          // eviction gives the slot back to its old key.
+          for (int j = 0; j < kMaxBusyReads && old_stamp == busy_key; ++j) {
+            old_stamp = LoadStamp(hash);
+          }
+          if (old_stamp == busy_key)
+            return NULL;
+        }
+        if (old_stamp == stamped_key && HoldsKey(hash, key)) {
           return values(hash);
+        } else if ((old_stamp & kGenerationMask) == generation) {
+          const int weight = values(hash)->weight();
+          if (weight < victim_weight) {
+            victim = hash;
+            victim_weight = weight;
+            victim_stamp = old_stamp;
+          }
         }
+        hash = NextSlot(hash, jump);
       }
-    } else {
-      old_key = AtomicCompareAndSwap(keys(hash), kEmptyKey, kEmptyKey + 1);
-      if (old_key == kEmptyKey) {
-        increment_num_elements(key);
-        return values(PrimaryHash(kEmptyKey));
-      } else {
-        assert(old_key == kEmptyKey + 1);
-        return values(PrimaryHash(kEmptyKey));
+      if (victim == -1)
+        return NULL;
+      // Overwriting the victim in place keeps the probe sequences
+      // of other keys intact.
+      if (AtomicCompareAndSwap(stamps(victim), victim_stamp, busy_key) ==
+          victim_stamp) {
+        if (values(victim)->weight() == INT_MAX) {
+          AtomicCompareAndSwap(stamps(victim), busy_key, victim_stamp);
+          continue;
+        }
+        *keys(victim) = key;
+        values(victim)->Init();
+        AtomicCompareAndSwap(stamps(victim), busy_key, stamped_key);
+        increment_num_evictions(key);
+        return values(victim);
       }
     }
+    return NULL;
   }
 
+  // Returns the value associated with key or NULL if the key is absent
+  // or its slot is being initialized.
   Value* FindValue(Key key) {
-    int hash = PrimaryHash(key);
-    Key found_key = *keys(hash);
-    if (key != kEmptyKey) {
-      if (found_key == key) {
-        return values(hash);
-      } else if (found_key == kEmptyKey) {
+    const Key generation = generation_;
+    const Key stamped_key = StampKey(key, generation);
+    const Key busy_key = StampKey(key, kBusyGeneration);
+    int hash = FirstSlot(key);
+    const int jump = Jump(key);
+#ifdef USE_BUCKETED_HASH_MAP
+    // Slots never become stale within a generation, so a key is absent
+    // if a bucket that lacks it has a stale slot.
+    for (int i = 0; i < kProbeWindow; i += kBucketSize) {
+      const int match = FindInBucket(hash, key, stamped_key);
+      if (match != -1)
+        return values(match);
+      const int current = MatchBucket(hash, generation, kGenerationMask);
+      const int busy = MatchBucket(hash, kBusyGeneration, kGenerationMask);
+      if ((current | busy) != kFullBucket ||
+          MatchBucket(hash, busy_key, ~kEmptyKey) != 0) {
         return NULL;
       }
-      const int jump = SecondaryHash(key);
-      while (true) {
-        hash = (hash + jump) % kCapacity;
-        found_key = *keys(hash);
-        if (found_key == key) {
-          return values(hash);
-        } else if (found_key == kEmptyKey) {
-          return NULL;
-        }
-      }
-    } else {
-      if (found_key == kEmptyKey + 1) {
-        return values(PrimaryHash(kEmptyKey));
-      } else {
-        assert(found_key == kEmptyKey);
+      hash = (hash + jump) & (capacity_ - 1);
+    }
+    return NULL;
+#else
+    for (int i = 0; i < kProbeWindow; ++i) {
+      const Key found_stamp = LoadStamp(hash);
+      if (found_stamp == stamped_key && HoldsKey(hash, key)) {
+        return values(hash);
+      } else if (IsStale(found_stamp, generation) || found_stamp == busy_key) {
         return NULL;
       }
+      hash = NextSlot(hash, jump);
+    }
+    return NULL;
+#endif  // USE_BUCKETED_HASH_MAP
+  }
+
+  // Calls (*visitor)(value) for the value of each key inserted since
+  // the last Clear(). Other threads must not use the map meanwhile.
+  template<typename Visitor>
+  void ForEachValue(Visitor* visitor) {
+    for (int i = 0; i < capacity_; ++i) {
+      if ((*stamps(i) & kGenerationMask) == generation_)
+        (*visitor)(values(i));
     }
   }
 
@@ -163,46 +314,208 @@ class WaitFreeHashMap {
     return size;
   }
 
+  // Getter for num_evictions_.
+  int num_evictions() const {
+    int count = num_evictions_[0];
+    for (int i = 1; i < ARRAYSIZE(num_evictions_); ++i) {
+      count += num_evictions_[i];
+    }
+    return count;
+  }
+
+  // Returns true if at least half of the elements that fit in the map
+  // without evictions are already filled.
+  bool IsHalfFull() const {
+    return num_elements() >= limit_ / 2;
+  }
+
+  // Getter for limit_.
+  int limit() const { return limit_; }
+
+  // Getter for megabytes_.
+  int megabytes() const { return megabytes_; }
+
  private:
   // Check assumptions about template arguments.
   STATIC_ASSERT(Key_must_be_an_unsigned_type, static_cast<Key>(-1) > 0);
-  STATIC_ASSERT(the_number_of_elements_must_fit_in_int,
-                kLogCapacity < 8 * sizeof(int));
-  STATIC_ASSERT(the_hash_functions_must_be_independent,
-                2 * kLogCapacity <= 8 * sizeof(Key));
+
+  // The full key is kept next to its value, as the stamp of the key
+  // lacks the bits taken by the generation.
+  struct Slot {
+    Key key;
+    Value value;
+  };
+
+  struct Entry {
+    Key stamp;
+    Slot slot;
+  };
 
   void increment_num_elements(Key key) {
     AtomicIncrement(&num_elements_[key % ARRAYSIZE(num_elements_)], 1);
   }
 
-  static int PrimaryHash(Key key) { return key % kCapacity; }
-  static int SecondaryHash(Key key) { return (key >> kShift) | 1; }
+  void increment_num_evictions(Key key) {
+    AtomicIncrement(&num_evictions_[key % ARRAYSIZE(num_evictions_)], 1);
+  }
+
+  // Marks all slots as never used.
+  void Scrub() {
+    for (int i = 0; i < capacity_; ++i) {
+      *stamps(i) = kEmptyKey;
+    }
+  }
+
+  // Replaces the low bits of key with the number of a generation.
+  // Stamps tell apart the slots of the current generation and the slots
+  // being initialized, and make a short tag of the key.
+  static Key StampKey(Key key, Key generation) {
+    return (key & ~kGenerationMask) | generation;
+  }
+
+  // Returns true if the slot with stamped_key can be reused.
+  static bool IsStale(Key stamped_key, Key generation) {
+    const Key key_generation = stamped_key & kGenerationMask;
+    return key_generation != generation && key_generation != kBusyGeneration;
+  }
+
+  // Reads the stamp of a slot that other threads may be changing.
+  Key LoadStamp(int slot) {
+    return *static_cast<volatile Key*>(stamps(slot));
+  }
+
+  // Returns true if the slot, whose stamp says it is initialized,
+  // holds key. The stamp is read first, so the key is in place.
+  bool HoldsKey(int slot, Key key) {
+    return *static_cast<volatile Key*>(keys(slot)) == key;
+  }
 
-  static const int kCapacity = 1 << kLogCapacity;
-  static const int kLimit = kCapacity * 3 / 4;
-  static const int kShift = 8 * sizeof(Key) - kLogCapacity;
+  int PrimaryHash(Key key) const { return key & (capacity_ - 1); }
+  int SecondaryHash(Key key) const { return (key >> shift_) | 1; }
+
+#ifdef USE_BUCKETED_HASH_MAP
+  // Probes visit all slots of a bucket before jumping to another one.
+  int FirstSlot(Key key) const {
+    return PrimaryHash(key) & ~(kBucketSize - 1);
+  }
+  int Jump(Key key) const {
+    return (SecondaryHash(key) * kBucketSize) & (capacity_ - 1);
+  }
+  int NextSlot(int slot, int jump) const {
+    if ((slot + 1) % kBucketSize != 0)
+      return slot + 1;
+    return (slot + 1 - kBucketSize + jump) & (capacity_ - 1);
+  }
+
+  // Returns the slot of the bucket starting at slot that holds key
+  // stamped with stamped_key or -1 if there is no such slot.
+  int FindInBucket(int slot, Key key, Key stamped_key) {
+    int mask = MatchBucket(slot, stamped_key, ~kEmptyKey);
+    while (mask != 0) {
+      const int match = slot + __builtin_ctz(mask);
+      if (HoldsKey(match, key))
+        return match;
+      mask &= mask - 1;
+    }
+    return -1;
+  }
+
+  // Returns a bitmask of the slots of the bucket starting at slot
+  // whose keys equal pattern in the bits selected by mask.
+  int MatchBucket(int slot, Key pattern, Key mask) {
+    const Key* bucket = stamps(slot);
+#if defined(__AVX512F__)
+    return _mm512_cmpeq_epi64_mask(
+        _mm512_and_si512(_mm512_load_si512(bucket), _mm512_set1_epi64(mask)),
+        _mm512_set1_epi64(pattern));
+#elif defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi64x(pattern);
+    const __m256i selector = _mm256_set1_epi64x(mask);
+    const __m256i* lines = reinterpret_cast<const __m256i*>(bucket);
+    return
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(_mm256_load_si256(lines), selector), needle))) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(_mm256_load_si256(lines + 1), selector),
+            needle))) << 4);
+#elif defined(__SSE4_1__)
+    const __m128i needle = _mm_set1_epi64x(pattern);
+    const __m128i selector = _mm_set1_epi64x(mask);
+    const __m128i* lines = reinterpret_cast<const __m128i*>(bucket);
+    int matches = 0;
+    for (int i = 0; i < kBucketSize / 2; ++i) {
+      matches |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(
+          _mm_and_si128(_mm_load_si128(lines + i), selector), needle)))
+          << (2 * i);
+    }
+    return matches;
+#else
+    int matches = 0;
+    for (int i = 0; i < kBucketSize; ++i) {
+      matches |= ((bucket[i] & mask) == pattern) << i;
+    }
+    return matches;
+#endif  // defined(__AVX512F__)
+  }
+
+  // The number of stamps in a 64-byte cache line.
+  static const int kBucketSize = 8;
+  static const int kFullBucket = (1 << kBucketSize) - 1;
+  STATIC_ASSERT(Stamps_must_fill_a_cache_line, sizeof(Key) * 8 == 64);
+#else
+  int FirstSlot(Key key) const { return PrimaryHash(key); }
+  int Jump(Key key) const { return SecondaryHash(key); }
+  int NextSlot(int slot, int jump) const {
+    return (slot + jump) & (capacity_ - 1);
+  }
+#endif  // USE_BUCKETED_HASH_MAP
+
+  static const size_t kHugePageSize = 2 << 20;
+  // The number of slots where a key can be stored.
+  static const int kProbeWindow = 16;
   static const Key kEmptyKey = static_cast<Key>(0);
+  // Stamps carry the generation in the low 16 bits. Generation 0
+  // belongs to kEmptyKey and the highest one marks slots whose values
+  // are being initialized.
+  static const Key kGenerationMask = static_cast<Key>(0xFFFF);
+  static const Key kFirstGeneration = static_cast<Key>(1);
+  static const Key kBusyGeneration = kGenerationMask;
+  // How many times InsertKey() reads a busy slot before giving up.
+  static const int kMaxBusyReads = 1000;
 
 #ifdef USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
-  Key* keys(int n) { return &keys_[n]; }
-  Value* values(int n) { return &values_[n]; }
-  Key keys_[kCapacity];
-  Value values_[kCapacity];
+  Key* stamps(int n) { return &stamps_[n]; }
+  Key* keys(int n) { return &slots_[n].key; }
+  Value* values(int n) { return &slots_[n].value; }
+  Key* stamps_;
+  Slot* slots_;
 #else
-  Key* keys(int n) { return &array_[n].key; }
-  Value* values(int n) { return &array_[n].value; }
-  struct {
-    Key key;
-    Value value;
-  } array_[kCapacity];
+  Key* stamps(int n) { return &array_[n].stamp; }
+  Key* keys(int n) { return &array_[n].slot.key; }
+  Value* values(int n) { return &array_[n].slot.value; }
+  Entry* array_;
 #endif  // USE_SEPARATE_ARRAYS_FOR_KEYS_AND_VALUES
 
+  // The number of slots, a power of two.
+  int capacity_;
+  // The number of elements that the map holds at its nominal load.
+  int limit_;
+  // Selects the bits of keys used by SecondaryHash().
+  int shift_;
+  // The size of the memory mapping that holds the slots.
+  size_t mapped_size_;
+  // The size requested in the constructor.
+  int megabytes_;
+
   // The number of filled elements in this WaitFreeHashMap.
   int num_elements_[16];
+  // The number of values that InsertKey() reused for other keys.
+  int num_evictions_[16];
+  // The generation of keys inserted since the last Clear().
+  Key generation_;
 
-  WaitFreeHashMap<Key, Value, kLogCapacity>(
-      const WaitFreeHashMap<Key, Value, kLogCapacity>&);
-  void operator=(const WaitFreeHashMap<Key, Value, kLogCapacity>&);
+  WaitFreeHashMap<Key, Value>(const WaitFreeHashMap<Key, Value>&);
+  void operator=(const WaitFreeHashMap<Key, Value>&);
 };
 
 }  // namespace lajkonik